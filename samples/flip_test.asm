@@ -0,0 +1,106 @@
+.include "syscall.asm"
+.reserve BUFFER_A 4800
+.reserve BUFFER_B 4800
+.data ERROR_STRING "Failed to set the graphics mode\n"
+
+start:
+	pushiw BUFFER_A
+	pullx
+	pushi 0x20				; 120x80, 4 bpp, border off
+	syscall GRAPHICSTART
+	pushi 0
+	cmp
+	beq start_flipping
+	pushiw ERROR_STRING
+	pullx
+	syscall PRINT
+	syscall EXIT
+
+start_flipping:
+	; Show B, which makes A the buffer blits draw into
+	pushiw BUFFER_B
+	pullx
+	pushi 0
+	syscall GRAPHICFLIP
+	pop
+	; [0] is the box's x position, [2] the buffer being drawn
+	pushi 0
+	pulldp
+	pushiw 0
+	pullw [dp]
+	pushi 2
+	pulldp
+	pushiw BUFFER_A
+	pullw [dp]
+
+frame_loop:
+	; Clear the hidden buffer and draw the box into it
+	pushiw 0
+	pushiw 0
+	pushiw 120
+	pushiw 80
+	pushi 0
+	syscall BLITFILL
+	pushi 0
+	pulldp
+	pushw [dp]
+	pushiw 32
+	pushiw 16
+	pushiw 16
+	pushi 15
+	syscall BLITFILL
+
+	; Show it once the renderer gets to its next frame
+	pushi 2
+	pulldp
+	pushw [dp]
+	pullx
+	pushi 1
+	syscall GRAPHICFLIP
+	pop
+
+	; The buffer that was just replaced is drawn next
+	pushiw BUFFER_A
+	pushiw BUFFER_B
+	addw
+	pushw [dp]
+	subw
+	pullw [dp]
+
+	; Move the box along, wrapping around at the right edge
+	pushi 0
+	pulldp
+	pushw [dp]
+	incw
+	dupw
+	pushiw 104
+	cmpw
+	beq wrap
+	pullw [dp]
+	b frame_loop
+wrap:
+	popw
+	pushiw 0
+	pullw [dp]
+	b frame_loop
+
+; Pseudocode:
+;start()
+;{
+;	if (start_graphics(BUFFER_A, 0x20) != 0)				// syscall GRAPHICSTART
+;	{
+;		print(ERROR_STRING);								// syscall PRINT
+;		exit();												// syscall EXIT
+;	}
+;	flip(BUFFER_B, false);									// syscall GRAPHICFLIP
+;	x = 0;
+;	drawing = BUFFER_A;
+;	while (true)
+;	{
+;		fill(0, 0, 120, 80, 0);								// syscall BLITFILL
+;		fill(x, 32, 16, 16, 15);							// syscall BLITFILL
+;		flip(drawing, true);								// syscall GRAPHICFLIP
+;		drawing = BUFFER_A + BUFFER_B - drawing;
+;		x = (x + 1) % 104;
+;	}
+;}
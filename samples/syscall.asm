@@ -32,6 +32,16 @@
 .defword			GRAPHICSTART    0x0400
 .defword			GRAPHICEND      0x0401
 
+; Blitter, these draw into the active bitmap graphics and clip to it
+; Arguments are pushed in the order listed, coordinates are signed words
+.defword			BLITFILL        0x0402	; x, y, width, height, colour byte
+.defword			BLITCOPY        0x0403	; source x, source y, destination x, destination y, width, height
+.defword			BLITMASK        0x0404	; x, y, width, height, key colour byte, with the packed source bitmap at X
+.defword			BLITLINE        0x0405	; x0, y0, x1, y1, colour byte
+.defword			BLITSPAN        0x0406	; x, y, length, colour byte
+.defword			GRAPHICFLIP     0x0407	; wait for frame byte, shows the buffer at X and blits go to the one it replaced
+.defword			GRAPHICPALETTE  0x0408	; first entry byte, entry count word, with R, G, B bytes for each entry at X
+
 ; Audio
 .defword			SOUNDACK		0x0500
 .defword			SOUNDNACK		0x0501
@@ -0,0 +1,23 @@
+; Tile mode memory, laid out from the address given to GRAPHICSTART
+; These offsets match the TILE_MODE_* definitions in graphics.h
+.struct tile_memory
+	scroll_x			2
+	scroll_y			2
+	reserved			12
+	sprites				192
+	reserved_sprites	48
+	map					4096
+	patterns			8192
+.endstruct
+
+; One entry in tile_memory.sprites, there are 32 of them
+.struct tile_sprite
+	x					2
+	y					2
+	pattern				1
+	flags				1
+.endstruct
+
+.defbyte SPRITE_VISIBLE		0x01
+.defbyte SPRITE_FLIP_X		0x02
+.defbyte SPRITE_FLIP_Y		0x04
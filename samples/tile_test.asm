@@ -0,0 +1,93 @@
+.include "syscall.asm"
+.include "tile_mode.asm"
+.reserve TILES 0x3100
+.data ERROR_STRING "Failed to set the graphics mode\n"
+
+start:
+	pushiw TILES
+	pullx
+	pushi 0x42				; 240x160, tiles and sprites, border off
+	syscall GRAPHICSTART
+	pushi 0
+	cmp
+	beq fill_map
+	pushiw ERROR_STRING
+	pullx
+	syscall PRINT
+	syscall EXIT
+
+fill_map:
+	; Alternate between pattern 0 and pattern 1 across the whole map
+	pushiw TILES
+	pushiw tile_memory.map
+	addw
+	pullx
+fill_map_loop:
+	pushi 0
+	pull [x+]
+	pushi 1
+	pull [x+]
+	pushx
+	pushiw TILES
+	pushiw tile_memory.patterns
+	addw
+	cmpw
+	beq fill_patterns
+	b fill_map_loop
+
+fill_patterns:
+	; Pattern 0 is left blank, pattern 1 is solid colour 5
+	pushx
+	pushiw 32
+	addw
+	pullx
+fill_stripe_loop:
+	pushi 0x55
+	pull [x+]
+	pushx
+	pushiw TILES
+	pushiw tile_memory.patterns
+	addw
+	pushiw 64
+	addw
+	cmpw
+	beq fill_sprite_loop
+	b fill_stripe_loop
+
+	; Pattern 2 is solid colour 15, for the sprite
+fill_sprite_loop:
+	pushi 0xFF
+	pull [x+]
+	pushx
+	pushiw TILES
+	pushiw tile_memory.patterns
+	addw
+	pushiw 96
+	addw
+	cmpw
+	beq place_sprite
+	b fill_sprite_loop
+
+place_sprite:
+	pushiw TILES
+	pushiw tile_memory.sprites
+	addw
+	pullx
+	pushiw 116
+	pullw [x++]
+	pushiw 76
+	pullw [x++]
+	pushi 2
+	pull [x+]
+	pushi SPRITE_VISIBLE
+	pull [x+]
+
+	; Scroll the background under the sprite, one pixel per frame
+	pushiw TILES
+	pullx
+scroll_loop:
+	pushw [x]
+	incw
+	pullw [x]
+	sync
+	b scroll_loop
@@ -1,13 +1,28 @@
 #include "assembler_internal.hpp"
 
 #include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <filesystem>
 #include "opcodes.h"
 #include "memory.h"
 #include "executable_file.h"
 #include "assembler_parser.hpp"
+#include "line_lexer.hpp"
 #include "assembler_visitors.hpp"
+#include "include_cache.hpp"
+#include "object_file.hpp"
+#include "macros.hpp"
+#include "peephole.hpp"
+#include "debug_info.hpp"
+#include "region_map.hpp"
+#include "expressions.hpp"
 
 struct assembled_region_t
 {
@@ -19,45 +34,321 @@ struct assembled_region_t
     uint16_t data_length;
     uint8_t* data;
     bool executable;
+    // Placed by .org rather than wherever there was room
+    bool fixed = false;
+};
+
+// A place where the value of an address symbol was written, which has to be
+// patched if the code is moved by the linker
+struct relocation_record_t
+{
+    uint16_t location;
+    relocation_kind kind;
+};
+
+// The code bytes assembled from one line, for the debug info
+struct instruction_line_t
+{
+    uint16_t address;
+    uint16_t length;
+    uint16_t file;
+    int line;
+};
+
+// A branch or jmp to a label that isn't defined yet, held back in case the
+// label turns out to be the next instruction
+struct held_jump_t
+{
+    const opcode_entry_t *opcode;
+    std::string symbol;
+    int line_number;
+};
+
+// Where a symbol was used before it was defined, for reporting it if it never
+// is. file indexes instruction_files.
+struct symbol_reference_line_t
+{
+    uint16_t file;
+    int line_number;
+};
+
+// An operand or a .defbyte/.defword whose expression uses symbols that
+// weren't defined yet, finished by expression_resolution_callback
+struct pending_expression_t
+{
+    assembler_data_t *data;
+    std::vector<rc_assembler::expression_term> terms;
+    std::string text;
+    // The operand bytes, for an instruction
+    uint16_t location;
+    const opcode_entry_t *opcode;
+    // The symbol being defined otherwise
+    std::string symbol;
+    symbol_type_t type;
+    std::string filename;
+    int line_number;
+    bool done;
 };
 
 struct assembler_data_t
 {
+    ~assembler_data_t();
+
     const char **search_paths = nullptr;
+    include_cache *cache = nullptr;
+    assembler_options options{};
+    std::vector<relocation_record_t> relocations{};
+    // In the order they were created, which is the order they're output in
     std::vector<assembled_region_t*> regions{};
+    // The regions themselves, which a deque doesn't move as it grows
+    std::deque<assembled_region_t> region_storage{};
+    // Which addresses regions take, by index in regions
+    region_map region_addresses{ 0x100, DATA_SIZE };
+    // Every region's data lives at its own address in here, so regions never
+    // have to be copied to grow. Allocated with the first region that has data.
+    std::unique_ptr<uint8_t[]> memory_image{};
     assembled_region_t *current_region = nullptr;
     symbol_table_t *symbol_table = nullptr;
     int lineNumber = 0;
     std::vector<std::string> filename_stack{};
+    // Canonical paths of every file read, in the order they were opened
+    std::vector<std::string> source_file_paths{};
     std::vector<char*> files_to_process{};
     std::vector<assembler_error_t> errors{};
-    char * error_buffer = nullptr;
+    char error_buffer[ERROR_BUFFER_SIZE + 1]{};
     int error_buffer_size = 0;
+    // Scratch space for formatting error messages
+    char temp_buffer[ERROR_BUFFER_SIZE + 1]{};
     int symbol_references_count = 0;
+    // Every line each symbol was used on before it was defined, by symbol_key
+    std::unordered_map<std::string, std::vector<symbol_reference_line_t>> reference_lines{};
     uint16_t current_org_address = 0;
     std::optional<uint16_t> execution_start{};
     bool current_org_address_valid = false;
     std::string output_filename{};
-    rc_assembler::assembler_grammar<std::string::iterator> parser;
+    // Every source file read so far, kept whole until assembly finishes so
+    // lines can be parsed in place. Moving a vector keeps its buffer.
+    std::vector<std::vector<char>> source_files{};
+    // The file being assembled, when it was handed over in memory rather
+    // than read from disk
+    const std::vector<char> *memory_source = nullptr;
+    rc_assembler::assembler_grammar<const char*> parser;
+    // Handles the simple lines before they get to the parser
+    rc_assembler::line_lexer lexer{};
+    std::unique_ptr<assembly_line_visitor> visitor{};
+    std::unique_ptr<macro_handler> macros{};
+    // Instructions the peephole optimizer can still change, which haven't
+    // been given addresses yet
+    std::vector<peephole_instruction_t> held_instructions{};
+    std::optional<held_jump_t> held_jump{};
+
+    // Branches to labels are numbered in the order they're assembled, which
+    // is the same on every pass over the source
+    int branch_count = 0;
+    // Branches an earlier pass found were too far to reach their label
+    std::set<int> long_branches{};
+    // Forward branches waiting for their label, by where their offset goes
+    std::unordered_map<uint16_t, int> pending_branches{};
+    // Forward branches this pass found were too far, left to the next pass
+    // rather than reported when relax_branches is set
+    std::vector<int> far_branches{};
+    bool relax_branches = false;
+
+    // Symbol references point at these, so they're kept in a deque
+    std::deque<pending_expression_t> pending_expressions{};
+    // Definitions whose symbols have all been defined, which are made once
+    // the symbol table is done calling back
+    std::vector<pending_expression_t*> ready_definitions{};
+
+    // What the code under each label, and each data block and constant,
+    // uses, by symbol_key. Code that isn't under a label, before the first
+    // one or after an .org, is under "" and is always kept.
+    std::unordered_map<std::string, std::vector<std::string>> symbol_uses{};
+    bool track_symbol_uses = false;
+    std::string current_block{};
+    // Whether the code under the current label runs on into the next one
+    bool block_falls_through = true;
+    // Symbols an earlier pass found nothing reachable uses, which this pass
+    // leaves out
+    std::unordered_set<std::string> unused_symbols{};
+    // In the code under an unused label, which isn't assembled
+    bool skipping_block = false;
+
+    // Where every instruction came from, in the order they were assembled
+    std::vector<instruction_line_t> instruction_lines{};
+    // The files those lines, and the lines of forward references, are in
+    std::vector<std::string> instruction_files{};
+
+    assembler_timings timings{};
+    // How many phase_timers are running
+    int timed_phase_depth = 0;
 };
 
-char *error_buffer = new char[ERROR_BUFFER_SIZE + 1];
-char temp_buffer[ERROR_BUFFER_SIZE + 1];
-assembler_data_t *assembler_data;
-int *lineNumber;
-
 namespace
 {
     const uint16_t MIN_INSTRUCTION_ALLOC_SIZE = 0x100;
-
-    assembly_line_visitor *visitor = nullptr;
+    // The patterns only look a few instructions back, so anything older is
+    // written out rather than held on to
+    const size_t MAX_HELD_INSTRUCTIONS = 16;
+    // Every pass makes at least one more branch long, and they rarely push
+    // another out of range, so this is only reached by something pathological
+    const int MAX_ASSEMBLY_PASSES = 16;
 } // namespace
 
+void write_held_instructions(assembler_data_t *data, const opcode_entry_t *next = nullptr);
+void define_ready_constants(assembler_data_t *data);
+
+// Adds the time until it goes out of scope to one of the phase timings, when
+// they're being measured. Only the outermost timer counts, so resolving
+// references into regions while defining a symbol isn't counted twice.
+class phase_timer
+{
+public:
+    phase_timer(assembler_data_t *data, double assembler_timings::*phase) : data(data), phase(phase)
+    {
+        if (data->options.measure_phases && data->timed_phase_depth++ == 0)
+        {
+            start_time = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~phase_timer()
+    {
+        if (data->options.measure_phases && --data->timed_phase_depth == 0)
+        {
+            data->timings.*phase += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        }
+    }
+
+private:
+    assembler_data_t *data;
+    double assembler_timings::*phase;
+    std::chrono::steady_clock::time_point start_time{};
+};
+
+assembler_data_t::~assembler_data_t()
+{
+    for (auto file : files_to_process)
+    {
+        delete [] file;
+    }
+
+    if (symbol_table != nullptr)
+    {
+        dispose_symbol_table(symbol_table);
+    }
+}
+
+void assembler_data_deleter::operator()(assembler_data_t *data) const
+{
+    delete data;
+}
+
 std::string current_filename(assembler_data_t* data)
 {
     return data->filename_stack.back();
 }
 
+int current_line_number(assembler_data_t* data)
+{
+    return data->lineNumber;
+}
+
+size_t current_file_depth(assembler_data_t* data)
+{
+    return data->filename_stack.size();
+}
+
+// Symbols are case insensitive, and only the first SYMBOL_MAX_LENGTH
+// characters are kept in the symbol table
+std::string symbol_key(const char *name)
+{
+    std::string key{ name, strnlen(name, SYMBOL_MAX_LENGTH) };
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return key;
+}
+
+uint16_t current_file_index(assembler_data_t *data)
+{
+    auto &filename = data->filename_stack.back();
+    if (data->instruction_files.empty() || data->instruction_files.back() != filename)
+    {
+        data->instruction_files.push_back(filename);
+    }
+
+    return (uint16_t)(data->instruction_files.size() - 1);
+}
+
+void note_symbol_reference(assembler_data_t *data, const char *name)
+{
+    data->symbol_references_count++;
+    symbol_reference_line_t reference{ current_file_index(data), data->lineNumber };
+    auto &lines = data->reference_lines[symbol_key(name)];
+    if (lines.empty() || lines.back().file != reference.file || lines.back().line_number != reference.line_number)
+    {
+        lines.push_back(reference);
+    }
+}
+
+void add_symbol_use(assembler_data_t *data, const std::string &user, const char *name)
+{
+    if (data->track_symbol_uses)
+    {
+        data->symbol_uses[user].push_back(symbol_key(name));
+    }
+}
+
+bool is_unused_symbol(assembler_data_t *data, const char *name)
+{
+    return !data->unused_symbols.empty() && data->unused_symbols.count(symbol_key(name)) > 0;
+}
+
+bool in_unused_code(assembler_data_t *data)
+{
+    return data->skipping_block;
+}
+
+// The code from a label up to the next one is kept or left out as a whole
+void start_code_block(assembler_data_t *data, const char *name)
+{
+    if (data->block_falls_through)
+    {
+        add_symbol_use(data, data->current_block, name);
+    }
+
+    data->current_block = symbol_key(name);
+    data->block_falls_through = true;
+    data->skipping_block = is_unused_symbol(data, name);
+}
+
+bool find_constant_symbol(assembler_data_t *data, const char *name, int &value)
+{
+    phase_timer timer(data, &assembler_timings::symbols);
+    // The set and get macros use these as they're expanded
+    add_symbol_use(data, data->current_block, name);
+    symbol_type_t type;
+    symbol_signedness_t signedness;
+    uint16_t word_value;
+    uint8_t byte_value;
+    if (resolve_symbol(data->symbol_table, name, &type, &signedness, &word_value, &byte_value) != SYMBOL_ASSIGNED)
+    {
+        return false;
+    }
+
+    if (type == SYMBOL_WORD)
+    {
+        value = word_value;
+        return true;
+    }
+    else if (type == SYMBOL_BYTE)
+    {
+        value = byte_value;
+        return true;
+    }
+
+    return false;
+}
+
 uint16_t executable_file_size(assembler_data_t *data)
 {
     uint16_t file_size = sizeof(executable_file_header_t);
@@ -153,146 +444,119 @@ const char *get_output_filename(assembler_data_t *data)
     return data->output_filename.c_str();
 }
 
-bool region_contains_address(assembled_region_t *region, uint16_t address)
+const assembler_timings &get_assembler_timings(assembler_data_t *data)
 {
-    auto next_region_address = region->start_location + region->length;
-    return (address >= region->start_location) && (address < next_region_address);
+    return data->timings;
 }
 
-bool region_intersects_range(assembled_region_t *region, uint16_t address, uint16_t length)
+const std::vector<std::string> &get_source_files(assembler_data_t *data)
 {
-    auto query_end_address = address + length - 1;
-    return region_contains_address(region, address) || region_contains_address(region, query_end_address);
+    return data->source_file_paths;
 }
 
-assembled_region_t *find_region_containing(assembler_data_t *data, uint16_t address)
+void collect_debug_info(assembler_data_t *data, debug_info_t &info)
 {
-    for (auto region : data->regions)
+    // Code placed with .org can come before code assembled earlier
+    auto lines = data->instruction_lines;
+    std::stable_sort(lines.begin(), lines.end(), [](const instruction_line_t &a, const instruction_line_t &b) { return a.address < b.address; });
+    for (auto &line : lines)
     {
-        if (region_contains_address(region, address))
-        {
-            return region;
-        }
+        info.add_line(line.address, line.length, data->instruction_files[line.file], (uint32_t)line.line);
     }
 
-    return nullptr;
+    visit_symbols(data->symbol_table, [](void *context, const char *name, symbol_type_t type, uint16_t word_value, uint8_t byte_value)
+    {
+        reinterpret_cast<debug_info_t*>(context)->add_symbol(name, type, type == SYMBOL_BYTE ? byte_value : word_value);
+    }, &info);
 }
 
-int find_new_address_for_region_of_size(assembler_data_t *data, uint16_t size)
+bool region_contains_address(assembled_region_t *region, uint16_t address)
 {
-    uint16_t search_start = 0x100;
-    bool found_new_start = false;
-
-    if (data->regions.size() > 0)
-    {
-        for (auto region : data->regions)
-        {
-            if (region_intersects_range(region, search_start, size))
-            {
-                search_start = region->start_location + region->length;
-                found_new_start = true;
-            }
-            else
-            {
-                return search_start;
-            }
-        }
+    auto next_region_address = region->start_location + region->length;
+    return (address >= region->start_location) && (address < next_region_address);
+}
 
-        // We've exhausted the regions, but we didn't do anything with the final
-        // search position
-        if (found_new_start && (search_start + size) <= DATA_SIZE)
-        {
-            return search_start;
-        }
-    }
-    else
-    {
-        return search_start;
-    }
+assembled_region_t *find_region_containing(assembler_data_t *data, uint16_t address)
+{
+    phase_timer timer(data, &assembler_timings::regions);
+    int index = data->region_addresses.find(address);
+    return index >= 0 ? data->regions[index] : nullptr;
+}
 
-    return -1;
+int find_new_address_for_region_of_size(assembler_data_t *data, uint16_t size)
+{
+    // The lowest address there's room at, from 0x100 up
+    return data->region_addresses.find_free(size);
 }
 
 assembled_region_t *create_new_region(assembler_data_t *data, uint16_t size, bool allocate_memory = true, int base_address = -1)
 {
-    assembled_region_t *new_region = nullptr;
+    phase_timer timer(data, &assembler_timings::regions);
+    int new_address = -1;
     if (base_address >= 0)
     {
-        bool region_available = true;
-        for (auto region : data->regions)
-        {
-            if (region_intersects_range(region, base_address, size))
-            {
-                region_available = false;
-                break;
-            }
-        }
-
-        if (region_available)
+        if (!data->region_addresses.intersects(base_address, size))
         {
-            new_region = new assembled_region_t { (uint16_t)base_address, 0, size };
-            new_region->data = nullptr;
-            new_region->data_length = 0;
-            new_region->length = size;
-
-            if (allocate_memory)
-            {
-                new_region->data = new uint8_t[size];
-                new_region->data_length = size;
-            }
+            new_address = base_address;
+            // Regions can't run off the end of memory
+            size = (uint16_t)std::min<uint32_t>(size, DATA_SIZE - base_address);
         }
         else
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "No space to place a region at 0x%04x of %d size", base_address, size);
-            add_error(data, temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "No space to place a region at 0x%04x of %d size", base_address, size);
+            add_error(data, data->temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
         }
     }
     else
     {
         // Find an empty starting address that can fit this data
-        int new_address = find_new_address_for_region_of_size(data, size);
-        if (new_address >= 0)
-        {
-            new_region = new assembled_region_t { (uint16_t)new_address, 0, size };
-            new_region->data = nullptr;
-            new_region->data_length = 0;
-            new_region->length = size;
-
-            if (allocate_memory)
-            {
-                new_region->data = new uint8_t[size];
-                new_region->data_length = size;
-            }
-        }
-        else
+        new_address = find_new_address_for_region_of_size(data, size);
+        if (new_address < 0)
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Couldn't find a suitable address to place a region of %d size", size);
-            add_error(data, temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Couldn't find a suitable address to place a region of %d size", size);
+            add_error(data, data->temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
         }
     }
 
-    if (new_region == nullptr)
+    if (new_address < 0)
     {
         if (base_address >= 0)
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "No available space for data at %d of size %d", base_address, size);
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "No available space for data at %d of size %d", base_address, size);
         }
         else
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "No available space for data of size %d", size);
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "No available space for data of size %d", size);
         }
         
-        add_error(data, temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
+        add_error(data, data->temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
+        return nullptr;
     }
-    else
+
+    // By default regions are not marked as executable.
+    // Functions adding code should set their regions to
+    // executable
+    auto new_region = &data->region_storage.emplace_back();
+    new_region->start_location = (uint16_t)new_address;
+    new_region->current_instruction_offset = 0;
+    new_region->length = size;
+    new_region->data = nullptr;
+    new_region->data_length = 0;
+    new_region->executable = false;
+
+    if (allocate_memory)
     {
-        // By default regions are not marked as executable.
-        // Functions adding code should set their regions to
-        // executable
-        new_region->executable = false;
-        data->regions.push_back(new_region);
+        if (!data->memory_image)
+        {
+            data->memory_image.reset(new uint8_t[DATA_SIZE]());
+        }
+
+        new_region->data = &data->memory_image[new_address];
+        new_region->data_length = size;
     }
-    
+
+    data->region_addresses.insert(new_region->start_location, size, data->regions.size());
+    data->regions.push_back(new_region);
     return new_region;
 }
 
@@ -302,53 +566,26 @@ assembled_region_t *create_new_region(assembler_data_t *data, uint16_t size, boo
 //  be used for instructions as data definitions
 uint16_t extend_region(assembler_data_t *data, assembled_region_t *region, uint16_t extend_by = MIN_INSTRUCTION_ALLOC_SIZE)
 {
-    uint16_t extended_by = 0;
-    bool error = false;
-    auto new_size = region->length + extend_by;
-    auto extend_it = [region](uint16_t new_size)
-    {
-        auto current_data = region->data;
-        auto data_length = region->data_length;
-        auto new_region = new uint8_t[new_size];
-        memcpy(new_region, current_data, data_length);
-        region->length = new_size;
-        region->data_length = new_size;
-    };
+    phase_timer timer(data, &assembler_timings::regions);
 
-    for (auto existing_region : data->regions)
+    // A region can grow up to the next one, or the end of memory. Its data is
+    // already in place in the memory image.
+    uint32_t end = region->start_location + region->length;
+    uint32_t new_end = std::min<uint32_t>(end + extend_by, data->region_addresses.next_start(region->start_location));
+    if (new_end <= end)
     {
-        if (existing_region != region && region_intersects_range(existing_region, region->start_location, new_size))
-        {
-            // We'd extend into another region, so we'll need to reduce the number of bytes we're allocating
-            auto available_size = existing_region->start_location - region->start_location;
-            if (available_size < region->length)
-            {
-                error = true;
-                // TODO: Handle this overlap error!
-            }
-            else if (available_size == region->length)
-            {
-                error = true;
-                // TODO: Report that there's no room to grow
-            }
-            else
-            {
-                auto region_length = region->length;
-                extend_it(available_size);
-                extended_by = available_size - region_length;
-                break;
-            }
-        }
+        // TODO: Report that there's no room to grow
+        return 0;
     }
 
-    if (!error && extended_by == 0)
+    region->length = (uint16_t)(new_end - region->start_location);
+    if (region->data != nullptr)
     {
-        auto region_length = region->length;
-        extend_it(new_size);
-        extended_by = new_size - region_length;
+        region->data_length = region->length;
     }
 
-    return extended_by;
+    data->region_addresses.resize(region->start_location, region->length);
+    return (uint16_t)(new_end - end);
 }
 
 void add_file_to_process(assembler_data_t *data, const char *filename)
@@ -360,6 +597,14 @@ void add_file_to_process(assembler_data_t *data, const char *filename)
 
 void add_data(assembler_data_t *data, const std::string &name, const rc_assembler::byte_array &bytes)
 {
+    if (!name.empty() && is_unused_symbol(data, name.c_str()))
+    {
+        return;
+    }
+
+    // Held code goes first, so regions are placed the same with or without the optimizer
+    write_held_instructions(data);
+
     assembled_region_t *region = create_new_region(data, bytes.size(), true);
 
     if (region == nullptr)
@@ -378,18 +623,60 @@ void add_data(assembler_data_t *data, const std::string &name, const rc_assemble
 
 void reserve_data(assembler_data_t* data, const char* name, uint16_t size)
 {
+    if (is_unused_symbol(data, name))
+    {
+        return;
+    }
+
+    write_held_instructions(data);
+
     assembled_region_t *region = create_new_region(data, size, false);
     handle_symbol_def(data, name, region->start_location, SYMBOL_ADDRESS_DATA);
 }
 
-void parse_assembly_line(assembler_data_t *data, std::string& line)
+// Visits a line, keeping it in parsed_file if there is one, for the include cache
+void handle_parsed_line(assembler_data_t *data, const rc_assembler::line_options &line, parsed_file_t *parsed_file)
+{
+    if (parsed_file != nullptr)
+    {
+        parsed_file->lines.push_back({ data->lineNumber, line });
+    }
+
+    boost::apply_visitor(*data->visitor, line);
+}
+
+// Returns false if the line can't be replayed from the include cache, either
+// because of a syntax error or because it used a macro
+bool parse_assembly_line(assembler_data_t *data, const char *line_start, const char *line_end, parsed_file_t *parsed_file)
 {
+    switch (data->macros->handle_line(line_start, line_end, parsed_file))
+    {
+    case macro_line_result::expanded:
+        return true;
+
+    case macro_line_result::handled:
+    case macro_line_result::error:
+        return false;
+
+    case macro_line_result::not_macro:
+        break;
+    }
+
     rc_assembler::assembly_line lineData;
-    if (boost::spirit::qi::phrase_parse(line.begin(), line.end(), data->parser, boost::spirit::ascii::space, lineData))
+    bool parsed;
+    {
+        phase_timer timer(data, &assembler_timings::parsing);
+        auto lexed = data->lexer.lex_line(line_start, line_end, lineData);
+        parsed = lexed == rc_assembler::lex_result::parsed
+            || (lexed == rc_assembler::lex_result::unhandled
+                && boost::spirit::qi::phrase_parse(line_start, line_end, data->parser, boost::spirit::ascii::space, lineData));
+    }
+
+    if (parsed)
     {
         if (lineData.line_options.has_value())
         {
-            boost::apply_visitor(*visitor, lineData.line_options.value());
+            handle_parsed_line(data, lineData.line_options.value(), parsed_file);
         }
 
         if (lineData.comment.has_value())
@@ -399,16 +686,128 @@ void parse_assembly_line(assembler_data_t *data, std::string& line)
     }
     else
     {
-        add_error(data, std::string("Unrecognized line: ") + line, assembler_status::SYNTAX_ERROR);
+        add_error(data, "Unrecognized line: " + std::string(line_start, line_end), assembler_status::SYNTAX_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
+// Includes are handled as soon as the line that asks for them is done
+void process_pending_includes(assembler_data_t *data)
+{
+    if (data->files_to_process.size() > 0)
+    {
+        auto it = data->files_to_process.begin();
+        while (it != data->files_to_process.end())
+        {
+            auto file = *it;
+            data->files_to_process.erase(data->files_to_process.begin());
+            it = data->files_to_process.begin();
+            handle_file(data, file);
+            delete [] file;
+        }
+    }
+}
+
+// Feeds the lines of an include file parsed earlier through the visitor again
+void replay_parsed_file(assembler_data_t *data, const parsed_file_t &parsed_file)
+{
+    for (auto &parsed_line : parsed_file.lines)
+    {
+        data->lineNumber = parsed_line.line_number;
+        boost::apply_visitor(*data->visitor, parsed_line.line);
+        process_pending_includes(data);
+    }
+}
+
+// Reads the whole file with one call into a buffer owned by the context
+const std::vector<char> *read_source_file(assembler_data_t *data, FILE *file, const char *filename)
+{
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        file_size = ftell(file);
+        rewind(file);
+    }
+
+    if (file_size < 0)
+    {
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Couldn't get the size of %s", filename);
+        add_error(data, data->temp_buffer, assembler_status::IO_ERROR);
+        return nullptr;
+    }
+
+    std::vector<char> source(file_size);
+    if (fread(source.data(), 1, source.size(), file) != source.size())
+    {
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "File read error (%s - %d)", filename, ferror(file));
+        add_error(data, data->temp_buffer, assembler_status::IO_ERROR);
+        return nullptr;
+    }
+
+    data->source_files.push_back(std::move(source));
+    return &data->source_files.back();
+}
+
+// Parses and assembles every line of a file's source. parsed_file, if there
+// is one, is filled in with the lines for the include cache, or reset if the
+// file can't be cached.
+void parse_source(assembler_data_t *data, const std::vector<char> *source, std::shared_ptr<parsed_file_t> &parsed_file)
+{
+    // Copied out, as includes below can add to source_files and move the vector
+    const char *position = source != nullptr ? source->data() : nullptr;
+    const char *end = source != nullptr ? position + source->size() : nullptr;
+    int lineNumber = 1;
+    while (position < end)
+    {
+        auto newline = static_cast<const char*>(memchr(position, '\n', end - position));
+        auto line_end = newline != nullptr ? newline : end;
+        auto next_line = newline != nullptr ? newline + 1 : end;
+        if (line_end > position && line_end[-1] == '\r')
+        {
+            line_end--;
+        }
+
+        data->lineNumber = lineNumber;
+        data->timings.lines++;
+        if (line_end > position && !parse_assembly_line(data, position, line_end, parsed_file.get()))
+        {
+            // Files with syntax errors are parsed every time, so the errors
+            // are too, as are files that define or use macros
+            parsed_file.reset();
+        }
+
+        process_pending_includes(data);
+
+        position = next_line;
+        lineNumber++;
     }
+
+    data->macros->end_file();
+    write_held_instructions(data);
 }
 
 void handle_file(assembler_data_t *data, const char *filename)
 {
+    // Held instructions are written by the file they came from, so any errors
+    // are reported against it
+    write_held_instructions(data);
+
     auto old_line_number = data->lineNumber;
     data->filename_stack.push_back(filename);
 
-    FILE *file = fopen(filename, "r");
+    if (data->filename_stack.size() == 1 && data->memory_source != nullptr)
+    {
+        // Nothing to open, and the source outlives the assembly already
+        std::shared_ptr<parsed_file_t> parsed_file;
+        parse_source(data, data->memory_source, parsed_file);
+        data->filename_stack.pop_back();
+        return;
+    }
+
+    std::string source_path{ filename };
+    FILE *file = fopen(filename, "rb");
 
     if (file == 0 && data->search_paths != 0)
     {
@@ -418,9 +817,10 @@ void handle_file(assembler_data_t *data, const char *filename)
         {
             std::filesystem::path search_path{ current_search_path };
             search_path /= filename;
-            file = fopen(search_path.string().c_str(), "r");
+            file = fopen(search_path.string().c_str(), "rb");
             if (file != 0)
             {
+                source_path = search_path.string();
                 break;
             }
         }
@@ -428,74 +828,63 @@ void handle_file(assembler_data_t *data, const char *filename)
 
     if (file != 0)
     {
-        // printf("Processing %s\n", filename);
-        int lineNumber = 1;
-        char lineBuffer[LINE_BUFFER_SIZE + 1];
-        int charIndex = 0;
-        int currentChar;
-        bool had_eof = false;
-        while (!had_eof && (currentChar = fgetc(file)))
-        {
-            if (currentChar == EOF)
-            {
-                had_eof = true;
-            }
-
-            if (currentChar == '\r' || currentChar == '\n' || currentChar == EOF)
-            {
-                data->lineNumber = lineNumber;
-                lineBuffer[charIndex] = 0;
-                // Process the line
-                if (charIndex > 0)
-                {
-                    std::string line{lineBuffer};
-                    parse_assembly_line(data, line);
-                    // fprintf(stdout, "Got line %d: %s\n", lineNumber, lineBuffer);
-                }
+        std::error_code error;
+        auto dependency = std::filesystem::canonical(source_path, error);
+        auto dependency_path = error ? source_path : dependency.string();
+        if (std::find(data->source_file_paths.begin(), data->source_file_paths.end(), dependency_path) == data->source_file_paths.end())
+        {
+            data->source_file_paths.push_back(dependency_path);
+        }
+    }
 
-                if (data->files_to_process.size() > 0)
-                {
-                    auto it = data->files_to_process.begin();
-                    while (it != data->files_to_process.end())
-                    {
-                        auto file = *it;
-                        data->files_to_process.erase(data->files_to_process.begin());
-                        it = data->files_to_process.begin();
-                        handle_file(data, file);
-                        delete [] file;
-                    }
-                }
+    // Only included files are cached, the file being assembled changes too often
+    std::string canonical_path;
+    source_stamp_t stamp;
+    bool cacheable = file != 0 && data->cache != nullptr && data->filename_stack.size() > 1 &&
+        get_source_stamp(source_path.c_str(), canonical_path, stamp);
 
-                charIndex = 0;
-                lineNumber++;
-                continue;
-            }
+    if (cacheable)
+    {
+        auto cached = data->cache->find(canonical_path, stamp);
+        if (cached != nullptr)
+        {
+            fclose(file);
+            replay_parsed_file(data, *cached);
+            write_held_instructions(data);
+            data->filename_stack.pop_back();
+            return;
+        }
+    }
 
-            if (charIndex >= LINE_BUFFER_SIZE)
-            {
-                // Deal with this case
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Line %d is too long", lineNumber);
-                add_error(data, temp_buffer, assembler_status::INPUT_ERROR);
-            }
-            else
-            {
-                lineBuffer[charIndex++] = currentChar;
-            }
+    if (file != 0)
+    {
+        // printf("Processing %s\n", filename);
+        const std::vector<char> *source;
+        {
+            phase_timer timer(data, &assembler_timings::parsing);
+            source = read_source_file(data, file, filename);
+            fclose(file);
         }
 
-        if (currentChar == EOF && ferror(file) != 0)
+        std::shared_ptr<parsed_file_t> parsed_file;
+        if (cacheable && source != nullptr)
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "File read error (%s - %d)", filename, ferror(file));
-            add_error(data, temp_buffer, assembler_status::IO_ERROR);
+            parsed_file = std::make_shared<parsed_file_t>();
+            parsed_file->stamp = stamp;
         }
 
-        fclose(file);
-    }
+        parse_source(data, source, parsed_file);
+
+        if (parsed_file != nullptr)
+        {
+            data->cache->store(canonical_path, parsed_file);
+        }
+    }
     else
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Failed to open file (%s)", filename);
-        fprintf(stderr, "%s\n", temp_buffer);
-        add_error(data, temp_buffer, assembler_status::IO_ERROR);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Failed to open file (%s)", filename);
+        fprintf(stderr, "%s\n", data->temp_buffer);
+        add_error(data, data->temp_buffer, assembler_status::IO_ERROR);
     }
 
     data->filename_stack.pop_back();
@@ -518,18 +907,19 @@ int get_current_instruction_address(assembler_data_t *data)
             }
             else
             {
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Memory at address 0x%04x is not executable - overlaps with data region starting at 0x%04x", address, data->current_region->start_location);
-                add_error(data, temp_buffer, assembler_status::INTERNAL_ERROR);
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Memory at address 0x%04x is not executable - overlaps with data region starting at 0x%04x", address, data->current_region->start_location);
+                add_error(data, data->temp_buffer, assembler_status::INTERNAL_ERROR);
                 return -1;
             }
         }
-        else if (region_contains_address(data->current_region, address) && !region_contains_address(data->current_region, address + 2))
+        else if (address <= data->current_region->start_location + data->current_region->length)
         {
+            // Includes an address just past the end, after an instruction that filled the region
             auto extended_by_bytes = extend_region(data, data->current_region);
             if (extended_by_bytes < 2)
             {
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Couldn't extend region at 0x%04x to accommodate new instructions", address);
-                add_error(data, temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Couldn't extend region at 0x%04x to accommodate new instructions", address);
+                add_error(data, data->temp_buffer, assembler_status::NO_FREE_ADDRESS_RANGE);
                 return -1;
             }
             else
@@ -557,14 +947,22 @@ int get_current_instruction_address(assembler_data_t *data)
     return -1;
 }
 
+void add_relocation(assembler_data_t *data, uint16_t location, relocation_kind kind)
+{
+    if (data->options.relocatable)
+    {
+        data->relocations.push_back({ location, kind });
+    }
+}
+
 void symbol_resolution_callback(void *context, uint16_t ref_location, symbol_type_t symbol_type, symbol_signedness_t expected_signedness, uint8_t byte_value, machine_word_t word_value)
 {
     auto data = reinterpret_cast<assembler_data_t*>(context);
     auto region = find_region_containing(data, ref_location);
     if (region == nullptr)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Failed to find a region containing a symbol reference (should be at 0x%04x)", ref_location);
-        add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Failed to find a region containing a symbol reference (should be at 0x%04x)", ref_location);
+        add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
         return;
     }
 
@@ -575,11 +973,25 @@ void symbol_resolution_callback(void *context, uint16_t ref_location, symbol_typ
     }
     else if (symbol_type == SYMBOL_ADDRESS_INST && expected_signedness == SIGNEDNESS_SIGNED)
     {
+        add_relocation(data, ref_location, relocation_kind::branch);
         auto address_offset = (int)word_value.uword - ((int)ref_location - 1);
-        if (address_offset > 127 || address_offset < -128)
+        auto pending_branch = data->pending_branches.find(ref_location);
+        auto branch_index = pending_branch != data->pending_branches.end() ? pending_branch->second : -1;
+        if (pending_branch != data->pending_branches.end())
+        {
+            data->pending_branches.erase(pending_branch);
+        }
+
+        if ((address_offset > 127 || address_offset < -128) && data->relax_branches && branch_index >= 0)
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Tried to branch too far (from 0x%04x to 0x%04x)", ref_location, word_value.uword);
-            add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
+            // The next pass makes this a long branch, which moves everything after it
+            data->far_branches.push_back(branch_index);
+            return;
+        }
+        else if (address_offset > 127 || address_offset < -128)
+        {
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Tried to branch too far (from 0x%04x to 0x%04x)", ref_location, word_value.uword);
+            add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
             return;
         }
         else
@@ -591,6 +1003,11 @@ void symbol_resolution_callback(void *context, uint16_t ref_location, symbol_typ
     }
     else
     {
+        if (symbol_type == SYMBOL_ADDRESS_INST || symbol_type == SYMBOL_ADDRESS_DATA)
+        {
+            add_relocation(data, ref_location, relocation_kind::word);
+        }
+
         region->data[ref_index] = word_value.bytes[1];
         region->data[ref_index + 1] = word_value.bytes[0];
     }
@@ -598,6 +1015,28 @@ void symbol_resolution_callback(void *context, uint16_t ref_location, symbol_typ
 
 void handle_symbol_def(assembler_data_t *data, const char *name, int value, symbol_type_t type)
 {
+    if (type == SYMBOL_ADDRESS_INST || type == SYMBOL_ADDRESS_DATA)
+    {
+        if (type == SYMBOL_ADDRESS_INST && value == 0 && data->held_jump.has_value() &&
+            strncasecmp(data->held_jump->symbol.c_str(), name, SYMBOL_MAX_LENGTH) == 0)
+        {
+            // Jumping to the next instruction does nothing
+            data->held_jump.reset();
+        }
+
+        write_held_instructions(data);
+    }
+
+    if (type == SYMBOL_ADDRESS_INST && value == 0)
+    {
+        start_code_block(data, name);
+    }
+
+    if (is_unused_symbol(data, name))
+    {
+        return;
+    }
+
     symbol_error_t sym_err = SYMBOL_ERROR_NOERROR;
     if ((type == SYMBOL_ADDRESS_INST || type == SYMBOL_ADDRESS_DATA) && value < 0)
     {
@@ -611,6 +1050,7 @@ void handle_symbol_def(assembler_data_t *data, const char *name, int value, symb
 
     if (sym_err == SYMBOL_ERROR_NOERROR)
     {
+    phase_timer timer(data, &assembler_timings::symbols);
     switch (type)
     {
         case SYMBOL_WORD:
@@ -631,33 +1071,34 @@ void handle_symbol_def(assembler_data_t *data, const char *name, int value, symb
 
     if (sym_err == SYMBOL_ERROR_ALLOC_FAILED)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Couldn't allocate space for a symbol named %s", name);
-        add_error(data, temp_buffer, assembler_status::ALLOC_FAILED);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Couldn't allocate space for a symbol named %s", name);
+        add_error(data, data->temp_buffer, assembler_status::ALLOC_FAILED);
     }
     else if (sym_err == SYMBOL_ERROR_EXISTS)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Tried to redefine a symbol named %s", name);
-        add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Tried to redefine a symbol named %s", name);
+        add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
         output_symbols(stderr, data->symbol_table);
     }
     else if (sym_err == SYMBOL_ERROR_INTERNAL)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Internal error trying to define a symbol named %s", name);
-        add_error(data, temp_buffer, assembler_status::INTERNAL_ERROR);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Internal error trying to define a symbol named %s", name);
+        add_error(data, data->temp_buffer, assembler_status::INTERNAL_ERROR);
     }
+
+    define_ready_constants(data);
 }
 
 void handle_org_directive(assembler_data_t *data, uint16_t address)
 {
-    assembled_region_t *target_region = nullptr;
-    for (auto region : data->regions)
-    {
-        if (region_contains_address(region, address))
-        {
-            target_region = region;
-        }
-    }
+    write_held_instructions(data);
 
+    // Code placed at an address is always kept, up to the next label
+    data->current_block.clear();
+    data->block_falls_through = true;
+    data->skipping_block = false;
+
+    assembled_region_t *target_region = find_region_containing(data, address);
     if (target_region == nullptr)
     {
         target_region = create_new_region(data, MIN_INSTRUCTION_ALLOC_SIZE, true, address);
@@ -667,10 +1108,27 @@ void handle_org_directive(assembler_data_t *data, uint16_t address)
     {
         target_region->current_instruction_offset = address - target_region->start_location;
         target_region->executable = true;
+        target_region->fixed = true;
         data->current_region = target_region;
     }
 }
 
+void add_instruction_line(assembler_data_t *data, uint16_t address, uint16_t length)
+{
+    uint16_t file = current_file_index(data);
+    if (!data->instruction_lines.empty())
+    {
+        auto &last = data->instruction_lines.back();
+        if (last.file == file && last.line == data->lineNumber && last.address + last.length == address)
+        {
+            last.length += length;
+            return;
+        }
+    }
+
+    data->instruction_lines.push_back({ address, length, file, data->lineNumber });
+}
+
 void apply_machine_instruction(assembler_data_t *data, uint8_t opcode, const opcode_entry_t* opcode_entry = nullptr, std::optional<uint8_t> byte0 = std::nullopt, std::optional<uint8_t> byte1 = std::nullopt)
 {
     auto address = get_current_instruction_address(data);
@@ -698,6 +1156,8 @@ void apply_machine_instruction(assembler_data_t *data, uint8_t opcode, const opc
     }
 
     data->current_region->current_instruction_offset = offset;
+    add_instruction_line(data, (uint16_t)address, (uint16_t)(byte_count + 1));
+    data->block_falls_through = opcode != OPCODE_RTS && opcode != OPCODE_JMP && opcode != OPCODE_B;
 
     if (opcode_entry != nullptr)
     {
@@ -705,13 +1165,49 @@ void apply_machine_instruction(assembler_data_t *data, uint8_t opcode, const opc
     }
 }
 
-void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg)
+void assemble_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg);
+
+// A branch that can't reach its label becomes a jmp. None of the conditions
+// have an opposite to branch around the jmp with, so a conditional branch
+// goes to the jmp when it's taken, and is followed by a b past it:
+//     bcc +4
+//     b +5
+//     jmp label
+void assemble_long_branch(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg)
+{
+    if (opcode->opcode != OPCODE_B)
+    {
+        apply_machine_instruction(data, opcode->opcode, opcode, 4);
+        apply_machine_instruction(data, OPCODE_B, get_opcode_entry_from_opcode(OPCODE_B), 5);
+    }
+
+    assemble_instruction(data, get_opcode_entry_from_opcode(OPCODE_JMP), symbol_arg, 0);
+
+    if (opcode->opcode != OPCODE_B)
+    {
+        // The b goes past the jmp when the condition isn't met
+        data->block_falls_through = true;
+    }
+}
+
+void assemble_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg)
 {
+    int branch_index = -1;
+    if (symbol_arg != nullptr && IS_BRANCH_INST(opcode->opcode))
+    {
+        branch_index = data->branch_count++;
+        if (data->long_branches.count(branch_index) > 0)
+        {
+            assemble_long_branch(data, opcode, symbol_arg);
+            return;
+        }
+    }
+
     int current_instruction_address = get_current_instruction_address(data);
     if (current_instruction_address < 0 || data->current_region == nullptr)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Not able to locate or allocate new instruction memory");
-        add_error(data, temp_buffer, assembler_status::INTERNAL_ERROR);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Not able to locate or allocate new instruction memory");
+        add_error(data, data->temp_buffer, assembler_status::INTERNAL_ERROR);
         return;
     }
 
@@ -720,13 +1216,13 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
     // printf("Handling instruction %s with arg (%s)\n", opcode->name, symbol_arg ? symbol_arg : "numerical");
     if (opcode->access_mode == STACK_ONLY && (symbol_arg != nullptr || literal_arg != 0))
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Stack-only instruction %s cannot take parameters", opcode->name);
-        add_error(data, temp_buffer, assembler_status::INVALID_ARGUMENT);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Stack-only instruction %s cannot take parameters", opcode->name);
+        add_error(data, data->temp_buffer, assembler_status::INVALID_ARGUMENT);
     }
     else if (opcode->access_mode == REGISTER_INDEXED)
     {
-        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Register indexed instruction %s cannot be handled through this function", opcode->name);
-        add_error(data, temp_buffer, assembler_status::INVALID_ARGUMENT);
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Register indexed instruction %s cannot be handled through this function", opcode->name);
+        add_error(data, data->temp_buffer, assembler_status::INVALID_ARGUMENT);
     }
     else if (symbol_arg)
     {
@@ -734,42 +1230,52 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
         symbol_signedness_t signedness = SIGNEDNESS_ANY;
         uint16_t word_value;
         uint8_t byte_value;
-        auto resolution = resolve_symbol(data->symbol_table, symbol_arg, &type, &signedness, &word_value, &byte_value);
-        if (resolution != SYMBOL_ASSIGNED)
+        symbol_resolution_t resolution;
         {
-            symbol_ref_status_t add_ref_result;
-            if (opcode->argument_type == SYMBOL_ADDRESS_INST)
+            phase_timer timer(data, &assembler_timings::symbols);
+            resolution = resolve_symbol(data->symbol_table, symbol_arg, &type, &signedness, &word_value, &byte_value);
+            if (resolution != SYMBOL_ASSIGNED)
             {
-                if (IS_BRANCH_INST(opcode->opcode))
+                symbol_ref_status_t add_ref_result;
+                if (opcode->argument_type == SYMBOL_ADDRESS_INST)
                 {
-                    signedness = SIGNEDNESS_SIGNED;
+                    if (IS_BRANCH_INST(opcode->opcode))
+                    {
+                        signedness = SIGNEDNESS_SIGNED;
+                        data->pending_branches[current_instruction_address + 1] = branch_index;
+                    }
+                    add_ref_result = add_symbol_reference(data->symbol_table, symbol_arg, 
+                                                            symbol_resolution_callback, data, current_instruction_address + 1,
+                                                            signedness, SYMBOL_ADDRESS_INST);
+                }
+                else 
+                {
+                    add_ref_result = add_symbol_reference(data->symbol_table, symbol_arg,
+                                                            symbol_resolution_callback, data, current_instruction_address + 1,
+                                                            opcode->argument_signedness, opcode->argument_type);
                 }
-                add_ref_result = add_symbol_reference(data->symbol_table, symbol_arg, 
-                                                        symbol_resolution_callback, data, current_instruction_address + 1,
-                                                        signedness, SYMBOL_ADDRESS_INST);
-            }
-            else 
-            {
-                add_ref_result = add_symbol_reference(data->symbol_table, symbol_arg,
-                                                        symbol_resolution_callback, data, current_instruction_address + 1,
-                                                        opcode->argument_signedness, opcode->argument_type);
-            }
 
-            if (add_ref_result != SYMBOL_REFERENCE_RESOLVABLE && add_ref_result != SYMBOL_REFERENCE_SUCCESS)
-            {
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Error trying to add a reference to symbol %s", symbol_arg);
-                add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
+                if (add_ref_result != SYMBOL_REFERENCE_RESOLVABLE && add_ref_result != SYMBOL_REFERENCE_SUCCESS)
+                {
+                    snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Error trying to add a reference to symbol %s", symbol_arg);
+                    add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
+                }
+                note_symbol_reference(data, symbol_arg);
             }
-            data->symbol_references_count++;
         }
+
         machine_word_t word;
         word.uword = word_value;
         if (resolution == SYMBOL_ASSIGNED)
         {
             switch (type)
             {
-            case SYMBOL_WORD:
             case SYMBOL_ADDRESS_DATA:
+                add_relocation(data, current_instruction_address + 1, relocation_kind::word);
+                apply_machine_instruction(data, opcode->opcode, opcode, word.bytes[1], word.bytes[0]);
+                break;
+
+            case SYMBOL_WORD:
                 apply_machine_instruction(data, opcode->opcode, opcode, word.bytes[1], word.bytes[0]);
                 break;
 
@@ -783,32 +1289,33 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
                     auto address_offset = (int)word_value - current_instruction_address;
                     if (address_offset > 127 || address_offset < -128)
                     {
-                        snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Tried to branch too far (from 0x%04x to 0x%04x)", current_instruction_address, word_value);
-                        add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
-                        return;
+                        // The label's already placed, so there's no need to wait for another pass
+                        assemble_long_branch(data, opcode, symbol_arg);
                     }
                     else
                     {
                         auto signed_byte = (int8_t)address_offset;
                         auto unsigned_byte = *((uint8_t*)&signed_byte);
+                        add_relocation(data, current_instruction_address + 1, relocation_kind::branch);
                         apply_machine_instruction(data, opcode->opcode, opcode, unsigned_byte);
                     }
                 }
                 else
                 {
+                    add_relocation(data, current_instruction_address + 1, relocation_kind::word);
                     apply_machine_instruction(data, opcode->opcode, opcode, word.bytes[1], word.bytes[0]);
                 }
                 break;
 
             case SYMBOL_NO_TYPE:
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Error resolving symbol %s", symbol_arg);
-                add_error(data, temp_buffer, assembler_status::SYMBOL_ERROR);
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Error resolving symbol %s", symbol_arg);
+                add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
                 break;
             }
         }
-        else if (opcode->argument_type == SYMBOL_ADDRESS_INST)
+        else
         {
-            // The following byte(s) will be resolved later
+            // The following byte(s) will be resolved later, or by the linker
             if (opcode->arg_byte_count == 1)
             {
                 apply_machine_instruction(data, opcode->opcode, opcode, 0);
@@ -819,8 +1326,8 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
             }
             else
             {
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Error handling opcode %s, which references %s", opcode->name, symbol_arg);
-                add_error(data, temp_buffer, assembler_status::INTERNAL_ERROR);
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Error handling opcode %s, which references %s", opcode->name, symbol_arg);
+                add_error(data, data->temp_buffer, assembler_status::INTERNAL_ERROR);
             }
         }
     }
@@ -847,8 +1354,8 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
         if ((opcode->argument_type == SYMBOL_WORD && (literal_arg > 65535 || literal_arg < -32768))
             || (opcode->argument_type == SYMBOL_BYTE && (literal_arg > 255 || literal_arg < -128)))
         {
-            snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Opcode %s cannot accommodate a value of %d", opcode->name, literal_arg);
-            add_error(data, temp_buffer, assembler_status::VALUE_OOB);
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Opcode %s cannot accommodate a value of %d", opcode->name, literal_arg);
+            add_error(data, data->temp_buffer, assembler_status::VALUE_OOB);
         }
         else if (opcode->argument_type == SYMBOL_WORD)
         {
@@ -875,194 +1382,1056 @@ void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, co
     }
 }
 
-void handle_indexed_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const register_index_t &index_register)
+void write_held_instruction(assembler_data_t *data, const peephole_instruction_t &instruction)
 {
-    // Prepare opcode
-    uint8_t opcode_value = opcode->opcode | index_register.index_register->code;
+    auto line_number = data->lineNumber;
+    data->lineNumber = instruction.line_number;
+    assemble_instruction(data, instruction.opcode, nullptr, instruction.argument);
+    data->lineNumber = line_number;
+}
 
-    // Prepare increment post-byte
-    int8_t increment_byte = index_register.increment_amount;
-    if (index_register.is_pre_increment)
+// Gives everything the peephole optimizer was holding an address. Called
+// before anything else takes an address, so the code comes out in order.
+// next is the instruction that's written straight after, when it's known.
+void write_held_instructions(assembler_data_t *data, const opcode_entry_t *next)
+{
+    // Only an ALU instruction is sure to set the condition codes again before
+    // a branch, or code after a label, could test the ones an add would have
+    if (next != nullptr && (next->opcode & 0xC0) == ALU_INST_BASE && !data->held_jump.has_value())
     {
-        increment_byte |= OP_STACK_INCREMENT_PRE;
+        forget_condition_codes(data->held_instructions);
     }
     else
     {
-        increment_byte &= ~OP_STACK_INCREMENT_PRE;
+        restore_condition_codes(data->held_instructions);
     }
 
-    apply_machine_instruction(data, opcode_value, opcode, increment_byte);
-}
+    for (auto &instruction : data->held_instructions)
+    {
+        write_held_instruction(data, instruction);
+    }
+    data->held_instructions.clear();
 
-void add_error(assembler_data_t* data, const std::string&error_string, assembler_status status, const char* filename)
-{
-    add_error(data, error_string.c_str(), status, filename);
+    if (data->held_jump.has_value())
+    {
+        auto jump = data->held_jump.value();
+        data->held_jump.reset();
+
+        auto line_number = data->lineNumber;
+        data->lineNumber = jump.line_number;
+        assemble_instruction(data, jump.opcode, jump.symbol.c_str(), 0);
+        data->lineNumber = line_number;
+    }
 }
 
-void add_error(assembler_data_t *data, const char *error_string, assembler_status status, const char *filename)
+// Returns false if the instruction isn't one the optimizer can do anything
+// with, or has a problem that assemble_instruction should report
+bool hold_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg)
 {
-    assembler_error_t error
+    symbol_type_t type;
+    symbol_signedness_t signedness;
+    uint16_t word_value;
+    uint8_t byte_value;
+    bool is_resolved = symbol_arg != nullptr &&
+        resolve_symbol(data->symbol_table, symbol_arg, &type, &signedness, &word_value, &byte_value) == SYMBOL_ASSIGNED;
+
+    if (opcode->opcode == OPCODE_JMP || IS_BRANCH_INST(opcode->opcode))
     {
-        status,
-        data->error_buffer_size,
-        data->lineNumber
-    };
+        if (symbol_arg == nullptr || is_resolved)
+        {
+            return false;
+        }
 
-    if (filename == nullptr)
-    {
-        filename = data->filename_stack.back().c_str();
+        data->held_jump = held_jump_t{ opcode, symbol_arg, data->lineNumber };
+        return true;
     }
 
-    int length = snprintf(&data->error_buffer[error.error_start], (size_t)ERROR_BUFFER_SIZE - data->error_buffer_size, "%s:%d - %s\n", filename, data->lineNumber, error_string);
-    data->errors.push_back(error);
-    data->error_buffer_size += length;
-}
+    if (!is_peephole_candidate(opcode))
+    {
+        return false;
+    }
 
-assembler_status apply_assembled_data_to_buffer(assembler_data_t *data, uint8_t *buffer)
-{
-    if (data->regions.size() == 0)
+    int argument = 0;
+    if (opcode->arg_byte_count == 0)
     {
-        return assembler_status::NOOUTPUT;
+        if (symbol_arg != nullptr || literal_arg != 0)
+        {
+            return false;
+        }
     }
+    else if (symbol_arg != nullptr)
+    {
+        // Only values that are already known, addresses have to stay put
+        if (!is_resolved || type != opcode->argument_type)
+        {
+            return false;
+        }
 
-    if (!data->execution_start.has_value())
+        argument = type == SYMBOL_BYTE ? byte_value : word_value;
+    }
+    else
     {
-        return assembler_status::UNINITIALIZED_VALUE;
+        if ((opcode->argument_type == SYMBOL_WORD && (literal_arg > 65535 || literal_arg < -32768))
+            || (opcode->argument_type == SYMBOL_BYTE && (literal_arg > 255 || literal_arg < -128)))
+        {
+            return false;
+        }
+
+        argument = literal_arg;
     }
 
-    for (auto region : data->regions)
+    data->held_instructions.push_back({ opcode, argument, data->lineNumber });
+    optimize_instruction_tail(data->held_instructions);
+    if (data->held_instructions.size() > MAX_HELD_INSTRUCTIONS)
     {
-        uint8_t *region_start = &buffer[region->start_location];
-        memcpy(region_start, region->data, region->data_length);
+        // Something after it might still test an add's condition codes
+        std::vector<peephole_instruction_t> oldest{ data->held_instructions.front() };
+        restore_condition_codes(oldest);
+        for (auto &instruction : oldest)
+        {
+            write_held_instruction(data, instruction);
+        }
+        data->held_instructions.erase(data->held_instructions.begin());
     }
 
-    return assembler_status::SUCCESS;
+    return true;
 }
 
-assembler_data_t data;
-void assemble(const char *filename, const char **search_paths, const char *output_file, assembler_output_type out_file_type, assembler_data_t **assembled_data)
+void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg)
 {
-    data.search_paths = search_paths;
-    data.lineNumber = 0;
-    data.symbol_references_count = 0;
-    data.current_org_address_valid = false;
+    if (in_unused_code(data))
+    {
+        return;
+    }
+    else if (symbol_arg != nullptr)
+    {
+        add_symbol_use(data, data->current_block, symbol_arg);
+    }
 
-    assembler_data = &data;
+    // A held jump is only dropped if the next thing is its label
+    if (data->held_jump.has_value())
+    {
+        write_held_instructions(data);
+    }
 
-    error_buffer[0] = 0;
-    data.error_buffer = error_buffer;
-    data.error_buffer_size = 0;
-    *assembled_data = assembler_data;
-    visitor = new assembly_line_visitor(assembler_data);
+    if (data->options.optimize && hold_instruction(data, opcode, symbol_arg, literal_arg))
+    {
+        return;
+    }
 
-    lineNumber = &assembler_data->lineNumber;
+    write_held_instructions(data, opcode);
+    assemble_instruction(data, opcode, symbol_arg, literal_arg);
+}
 
-    if (create_symbol_table(&data.symbol_table) != SYMBOL_TABLE_NOERROR)
+void handle_indexed_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const register_index_t &index_register)
+{
+    if (in_unused_code(data))
     {
-        add_error(&data, "Failed to create the symbol table", assembler_status::ALLOC_FAILED);
         return;
     }
 
-    handle_file(&data, filename);
+    write_held_instructions(data);
 
-    delete visitor;
-    visitor = nullptr;
+    // Prepare opcode
+    uint8_t opcode_value = opcode->opcode | index_register.index_register->code;
 
-    if (data.symbol_references_count > 0)
+    // Prepare increment post-byte
+    int8_t increment_byte = index_register.increment_amount;
+    if (index_register.is_pre_increment)
+    {
+        increment_byte |= OP_STACK_INCREMENT_PRE;
+    }
+    else
     {
-        char **symbol_buffers = new char*[data.symbol_references_count];
+        increment_byte &= ~OP_STACK_INCREMENT_PRE;
+    }
+
+    apply_machine_instruction(data, opcode_value, opcode, increment_byte);
+}
 
-        for (int i = 0; i < data.symbol_references_count; i++)
+// Bytes and words are numbers in an expression, labels and data are addresses
+rc_assembler::expression_status fold_expression(assembler_data_t *data, const pending_expression_t &pending,
+    rc_assembler::expression_value &value, std::vector<std::string> &unresolved, std::string &error)
+{
+    phase_timer timer(data, &assembler_timings::symbols);
+    auto lookup = [data](const std::string &name, int &symbol_value, bool &is_address)
+    {
+        symbol_type_t type;
+        symbol_signedness_t signedness;
+        uint16_t word_value;
+        uint8_t byte_value;
+        if (resolve_symbol(data->symbol_table, name.c_str(), &type, &signedness, &word_value, &byte_value) != SYMBOL_ASSIGNED)
         {
-            symbol_buffers[i] = new char[SYMBOL_MAX_LENGTH + 1];
+            return false;
         }
 
-        int symbol_count = data.symbol_references_count;
-        auto result = check_all_symbols_resolved(data.symbol_table, &symbol_count, symbol_buffers);
+        symbol_value = type == SYMBOL_BYTE ? byte_value : word_value;
+        is_address = type == SYMBOL_ADDRESS_INST || type == SYMBOL_ADDRESS_DATA;
+        return true;
+    };
 
-        if (result != SYMBOL_REFERENCE_RESOLVABLE)
-        {
-            for (int i = 0; i < symbol_count; i++)
-            {
-                snprintf(temp_buffer, ERROR_BUFFER_SIZE, "Unresolved symbol %s", symbol_buffers[i]);
-                add_error(&data, temp_buffer, assembler_status::SYMBOL_ERROR, filename);
-            }
-        }
+    return rc_assembler::evaluate_expression(pending.terms, lookup, value, unresolved, error);
+}
 
-        for (int i = 0; i < data.symbol_references_count; i++)
-        {
-            delete [] symbol_buffers[i];
-        }
+// Reported against the line the expression is on, which isn't the current
+// line once it's been waiting for a symbol
+void add_expression_error(assembler_data_t *data, const pending_expression_t &pending, const std::string &message, assembler_status status)
+{
+    auto line_number = data->lineNumber;
+    data->lineNumber = pending.line_number;
+    add_error(data, "The expression (" + pending.text + ") " + message, status, pending.filename.c_str());
+    data->lineNumber = line_number;
+}
 
-        delete [] symbol_buffers;
+// Only a single address, or a number that doesn't depend on one, can be
+// relocated by the linker
+bool is_relocatable_value(assembler_data_t *data, const pending_expression_t &pending, const rc_assembler::expression_value &value)
+{
+    if (data->options.relocatable && (!value.relocatable || value.address_count < 0 || value.address_count > 1))
+    {
+        add_expression_error(data, pending, "can't be relocated", assembler_status::SYMBOL_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
+bool is_single_address(const rc_assembler::expression_value &value)
+{
+    return value.relocatable && value.address_count == 1;
+}
+
+void patch_expression_operand(assembler_data_t *data, const pending_expression_t &pending, const rc_assembler::expression_value &value)
+{
+    if (!is_relocatable_value(data, pending, value))
+    {
+        return;
     }
 
-    if (data.errors.size() > 0)
+    auto region = find_region_containing(data, pending.location);
+    if (region == nullptr)
     {
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Failed to find a region containing an expression (should be at 0x%04x)", pending.location);
+        add_expression_error(data, pending, data->temp_buffer, assembler_status::INTERNAL_ERROR);
         return;
     }
 
-    if (out_file_type != assembler_output_type::none && out_file_type != assembler_output_type::error)
+    auto bytes = &region->data[pending.location - region->start_location];
+    auto operand = value.value;
+    if (pending.opcode->arg_byte_count == 1)
     {
-        std::string output_filename{};
-        if (output_file == nullptr)
+        if (is_single_address(value) && IS_BRANCH_INST(pending.opcode->opcode))
         {
-            std::filesystem::path infilepath(filename);
-            switch (out_file_type)
+            operand = value.value - (pending.location - 1);
+            if (operand > 127 || operand < -128)
             {
-            case assembler_output_type::binary:
-                output_filename = infilepath.stem().string() + ".rcexe";
-                break;
-
-            case assembler_output_type::summary:
-            default:
-                output_filename = infilepath.stem().string() + ".txt";
-                break;
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "branches too far (from 0x%04x to 0x%04x)", pending.location, value.value);
+                add_expression_error(data, pending, data->temp_buffer, assembler_status::SYMBOL_ERROR);
+                return;
             }
+
+            add_relocation(data, pending.location, relocation_kind::branch);
         }
-        else
+        else if (is_single_address(value) && data->options.relocatable)
         {
-            output_filename = output_file;
+            add_expression_error(data, pending, "is an address, which doesn't fit in a byte", assembler_status::VALUE_OOB);
+            return;
         }
-        
-        FILE* assembled_output = 0;
-#if defined(_MSC_VER)
-        assembled_output = fopen(output_filename.c_str(), "wb+");
-#else
-        assembled_output = fopen(output_filename.c_str(), "w+");
-#endif
-        if (assembled_output != 0)
+        else if (operand > 255 || operand < -128)
         {
-            if (out_file_type == assembler_output_type::summary)
-            {    
-                fprintf(assembled_output, "Execution start: 0x%04x\n", data.execution_start.value());
+            add_expression_error(data, pending, "comes to " + std::to_string(operand) + ", which doesn't fit in a byte", assembler_status::VALUE_OOB);
+            return;
+        }
 
-                fprintf(assembled_output, "Code:\n");
-                int i = 0;
-                auto output_line = [assembled_output, &i](assembled_region_t *region, int data_length)
-                {
-                    fprintf(assembled_output, "0x%04x: ", region->start_location + i);
-                    for (int j = 0; j < 4 && i < region->data_length; j++)
-                    {
-                        fprintf(assembled_output, "0x%02x ", region->data[i++]);
-                    }
-                    fprintf(assembled_output, "\n");
-                };
+        bytes[0] = (uint8_t)operand;
+    }
+    else
+    {
+        if (operand > 65535 || operand < -32768)
+        {
+            add_expression_error(data, pending, "comes to " + std::to_string(operand) + ", which doesn't fit in a word", assembler_status::VALUE_OOB);
+            return;
+        }
 
-                for (auto region : data.regions)
-                {
-                    if (region->executable)
-                    {
-                        for (i = 0; i < region->data_length && i < region->current_instruction_offset;)
-                        {
-                            output_line(region, region->data_length);
-                        }
-                    }
-                }
+        if (is_single_address(value))
+        {
+            add_relocation(data, pending.location, relocation_kind::word);
+        }
+
+        machine_word_t word;
+        word.uword = (uint16_t)operand;
+        bytes[0] = word.bytes[1];
+        bytes[1] = word.bytes[0];
+    }
+}
+
+void define_constant(assembler_data_t *data, const pending_expression_t &pending, const rc_assembler::expression_value &value)
+{
+    if (data->options.relocatable && (!value.relocatable || value.address_count != 0))
+    {
+        add_expression_error(data, pending, "depends on an address, so it can't be a constant in an object", assembler_status::SYMBOL_ERROR);
+        return;
+    }
+
+    auto constant = value.value;
+    bool is_byte = pending.type == SYMBOL_BYTE;
+    if (constant > (is_byte ? 255 : 65535) || constant < (is_byte ? -128 : -32768))
+    {
+        add_expression_error(data, pending, "comes to " + std::to_string(constant) + ", which doesn't fit in a " + (is_byte ? "byte" : "word"), assembler_status::VALUE_OOB);
+        return;
+    }
+
+    if (constant < 0)
+    {
+        constant += is_byte ? 256 : 65536;
+    }
+
+    auto line_number = data->lineNumber;
+    data->lineNumber = pending.line_number;
+    handle_symbol_def(data, pending.symbol.c_str(), constant, pending.type);
+    data->lineNumber = line_number;
+}
+
+void expression_resolution_callback(void *context, uint16_t, symbol_type_t, symbol_signedness_t, uint8_t, machine_word_t)
+{
+    auto pending = reinterpret_cast<pending_expression_t*>(context);
+    auto data = pending->data;
+    if (pending->done)
+    {
+        return;
+    }
+
+    // Called for each symbol it uses, and it's only done after the last
+    rc_assembler::expression_value value;
+    std::vector<std::string> unresolved;
+    std::string error;
+    auto status = fold_expression(data, *pending, value, unresolved, error);
+    if (status == rc_assembler::expression_status::unresolved)
+    {
+        return;
+    }
+    else if (pending->opcode == nullptr)
+    {
+        // Defining a symbol here would change the symbol table while it's
+        // going through its references
+        data->ready_definitions.push_back(pending);
+        return;
+    }
+
+    pending->done = true;
+    if (status == rc_assembler::expression_status::error)
+    {
+        add_expression_error(data, *pending, "can't be worked out, " + error, assembler_status::VALUE_OOB);
+    }
+    else
+    {
+        patch_expression_operand(data, *pending, value);
+    }
+}
+
+void define_ready_constants(assembler_data_t *data)
+{
+    while (!data->ready_definitions.empty())
+    {
+        auto pending = data->ready_definitions.back();
+        data->ready_definitions.pop_back();
+        if (pending->done)
+        {
+            continue;
+        }
+
+        pending->done = true;
+        rc_assembler::expression_value value;
+        std::vector<std::string> unresolved;
+        std::string error;
+        if (fold_expression(data, *pending, value, unresolved, error) == rc_assembler::expression_status::error)
+        {
+            add_expression_error(data, *pending, "can't be worked out, " + error, assembler_status::VALUE_OOB);
+        }
+        else
+        {
+            define_constant(data, *pending, value);
+        }
+    }
+}
+
+// Keeps the expression until every symbol it uses is defined
+void wait_for_symbols(assembler_data_t *data, pending_expression_t &&pending, const std::vector<std::string> &unresolved)
+{
+    data->pending_expressions.push_back(std::move(pending));
+    auto &waiting = data->pending_expressions.back();
+
+    phase_timer timer(data, &assembler_timings::symbols);
+    for (auto &name : unresolved)
+    {
+        auto add_ref_result = add_symbol_dependency(data->symbol_table, name.c_str(), expression_resolution_callback, &waiting);
+        if (add_ref_result != SYMBOL_REFERENCE_RESOLVABLE && add_ref_result != SYMBOL_REFERENCE_SUCCESS)
+        {
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Error trying to add a reference to symbol %s", name.c_str());
+            add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR);
+        }
+        note_symbol_reference(data, name.c_str());
+    }
+}
+
+// Parses an expression and works out what it can, returning false after
+// reporting an error
+bool start_expression(assembler_data_t *data, const std::string &text, pending_expression_t &pending,
+    rc_assembler::expression_value &value, std::vector<std::string> &unresolved)
+{
+    pending = { data, {}, text, 0, nullptr, {}, SYMBOL_NO_TYPE, current_filename(data), data->lineNumber, false };
+
+    std::string error;
+    if (!rc_assembler::parse_expression(text, pending.terms, error))
+    {
+        add_expression_error(data, pending, "can't be parsed, " + error, assembler_status::SYNTAX_ERROR);
+        return false;
+    }
+    else if (fold_expression(data, pending, value, unresolved, error) == rc_assembler::expression_status::error)
+    {
+        add_expression_error(data, pending, "can't be worked out, " + error, assembler_status::VALUE_OOB);
+        return false;
+    }
+
+    return true;
+}
+
+void add_expression_uses(assembler_data_t *data, const std::string &user, const pending_expression_t &pending)
+{
+    for (auto &term : pending.terms)
+    {
+        if (term.kind == rc_assembler::expression_term::term_kind::symbol)
+        {
+            add_symbol_use(data, user, term.symbol.c_str());
+        }
+    }
+}
+
+void handle_expression_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const std::string &expression)
+{
+    if (in_unused_code(data))
+    {
+        return;
+    }
+
+    pending_expression_t pending;
+    rc_assembler::expression_value value;
+    std::vector<std::string> unresolved;
+    if (!start_expression(data, expression, pending, value, unresolved))
+    {
+        return;
+    }
+
+    add_expression_uses(data, data->current_block, pending);
+
+    // A number is assembled like a literal, so the optimizer can still see it
+    if (unresolved.empty() && !is_single_address(value) && (!data->options.relocatable || (value.relocatable && value.address_count == 0)))
+    {
+        if ((opcode->arg_byte_count == 1 && (value.value < -128 || value.value > 255)) ||
+            (opcode->arg_byte_count == 2 && (value.value < -32768 || value.value > 65535)))
+        {
+            snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Opcode %s cannot accommodate a value of %d", opcode->name, value.value);
+            add_error(data, data->temp_buffer, assembler_status::VALUE_OOB);
+            return;
+        }
+
+        handle_instruction(data, opcode, nullptr, value.value);
+        return;
+    }
+
+    if (opcode->access_mode != IMMEDIATE_OPERANDS || (opcode->arg_byte_count != 1 && opcode->arg_byte_count != 2))
+    {
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Opcode %s can't take an address or a symbol in an expression", opcode->name);
+        add_error(data, data->temp_buffer, assembler_status::INVALID_ARGUMENT);
+        return;
+    }
+
+    // The operand is written as zeros, then filled in once it's known
+    write_held_instructions(data);
+    int current_instruction_address = get_current_instruction_address(data);
+    if (current_instruction_address < 0 || data->current_region == nullptr)
+    {
+        snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Not able to locate or allocate new instruction memory");
+        add_error(data, data->temp_buffer, assembler_status::INTERNAL_ERROR);
+        return;
+    }
+
+    if (opcode->arg_byte_count == 1)
+    {
+        apply_machine_instruction(data, opcode->opcode, opcode, 0);
+    }
+    else
+    {
+        apply_machine_instruction(data, opcode->opcode, opcode, 0, 0);
+    }
+
+    pending.location = (uint16_t)(current_instruction_address + 1);
+    pending.opcode = opcode;
+    if (unresolved.empty())
+    {
+        patch_expression_operand(data, pending, value);
+    }
+    else
+    {
+        wait_for_symbols(data, std::move(pending), unresolved);
+    }
+}
+
+void handle_constant_def(assembler_data_t *data, const rc_assembler::constant_def &def)
+{
+    if (is_unused_symbol(data, def.symbol.c_str()))
+    {
+        return;
+    }
+
+    pending_expression_t pending;
+    rc_assembler::expression_value value;
+    std::vector<std::string> unresolved;
+    if (!start_expression(data, def.value.text, pending, value, unresolved))
+    {
+        return;
+    }
+
+    add_expression_uses(data, symbol_key(def.symbol.c_str()), pending);
+    if (def.kind == rc_assembler::constant_kind::reserve)
+    {
+        // Everything after it is placed around it, so its size can't wait
+        if (!unresolved.empty())
+        {
+            add_expression_error(data, pending, "uses " + unresolved.front() + ", which has to be defined before the space is reserved", assembler_status::SYMBOL_ERROR);
+        }
+        else if (value.address_count != 0 || (data->options.relocatable && !value.relocatable) || value.value < 0 || value.value > 65535)
+        {
+            add_expression_error(data, pending, "isn't a size that can be reserved", assembler_status::VALUE_OOB);
+        }
+        else
+        {
+            reserve_data(data, def.symbol.c_str(), (uint16_t)value.value);
+        }
+
+        return;
+    }
+
+    pending.symbol = def.symbol;
+    pending.type = def.kind == rc_assembler::constant_kind::byte ? SYMBOL_BYTE : SYMBOL_WORD;
+    if (unresolved.empty())
+    {
+        define_constant(data, pending, value);
+    }
+    else
+    {
+        wait_for_symbols(data, std::move(pending), unresolved);
+    }
+}
+
+void add_error(assembler_data_t* data, const std::string&error_string, assembler_status status, const char* filename)
+{
+    add_error(data, error_string.c_str(), status, filename);
+}
+
+void add_error(assembler_data_t *data, const char *error_string, assembler_status status, const char *filename)
+{
+    assembler_error_t error
+    {
+        status,
+        data->error_buffer_size,
+        data->lineNumber
+    };
+
+    if (filename == nullptr)
+    {
+        filename = data->filename_stack.back().c_str();
+    }
+
+    int length = snprintf(&data->error_buffer[error.error_start], (size_t)ERROR_BUFFER_SIZE - data->error_buffer_size, "%s:%d - %s\n", filename, data->lineNumber, error_string);
+    data->errors.push_back(error);
+    // Once the buffer is full later errors are still counted, just not printed
+    data->error_buffer_size = std::min(data->error_buffer_size + std::max(length, 0), ERROR_BUFFER_SIZE);
+}
+
+assembler_status apply_assembled_data_to_buffer(assembler_data_t *data, uint8_t *buffer)
+{
+    if (data->regions.size() == 0)
+    {
+        return assembler_status::NOOUTPUT;
+    }
+
+    if (!data->execution_start.has_value())
+    {
+        return assembler_status::UNINITIALIZED_VALUE;
+    }
+
+    for (auto region : data->regions)
+    {
+        uint8_t *region_start = &buffer[region->start_location];
+        memcpy(region_start, region->data, region->data_length);
+    }
+
+    return assembler_status::SUCCESS;
+}
+
+void visit_assembled_regions(assembler_data_t *data, void (*visit)(void *context, uint16_t address, const uint8_t *bytes, uint16_t length), void *context)
+{
+    for (auto region : data->regions)
+    {
+        if (region->data != nullptr && region->data_length > 0)
+        {
+            visit(context, region->start_location, region->data, region->data_length);
+        }
+    }
+}
+
+assembler_result_t assemble_pass(const char *filename, const std::vector<char> *memory_source, const char **search_paths, include_cache *cache, const assembler_options &options,
+    const std::unordered_set<std::string> &unused_symbols, const std::set<int> &long_branches, bool relax_branches)
+{
+    assembler_result_t result(new assembler_data_t{});
+    auto data = result.get();
+    data->memory_source = memory_source;
+    data->search_paths = search_paths;
+    data->cache = cache;
+    data->options = options;
+    data->long_branches = long_branches;
+    data->relax_branches = relax_branches;
+    data->unused_symbols = unused_symbols;
+    data->track_symbol_uses = options.strip_unused && !options.relocatable && unused_symbols.empty();
+
+    if (create_symbol_table(&data->symbol_table) != SYMBOL_TABLE_NOERROR)
+    {
+        data->filename_stack.push_back(filename);
+        add_error(data, "Failed to create the symbol table", assembler_status::ALLOC_FAILED);
+        return result;
+    }
+
+    data->visitor.reset(new assembly_line_visitor(data));
+    data->macros.reset(new macro_handler(data, data->parser));
+    handle_file(data, filename);
+    data->macros.reset();
+    data->visitor.reset();
+    data->memory_source = nullptr;
+
+    // The linker only fills in a symbol, it can't work out an expression
+    if (options.relocatable)
+    {
+        for (auto &pending : data->pending_expressions)
+        {
+            if (!pending.done)
+            {
+                add_expression_error(data, pending, "uses symbols this object doesn't define", assembler_status::SYMBOL_ERROR);
+            }
+        }
+    }
+
+    // Symbols an object doesn't define are imports for the linker to find
+    if (data->symbol_references_count > 0 && !options.relocatable)
+    {
+        phase_timer timer(data, &assembler_timings::symbols);
+        char **symbol_buffers = new char*[data->symbol_references_count];
+
+        for (int i = 0; i < data->symbol_references_count; i++)
+        {
+            symbol_buffers[i] = new char[SYMBOL_MAX_LENGTH + 1];
+        }
+
+        int symbol_count = data->symbol_references_count;
+        auto resolved = check_all_symbols_resolved(data->symbol_table, &symbol_count, symbol_buffers);
+
+        if (resolved != SYMBOL_REFERENCE_RESOLVABLE)
+        {
+            // Each symbol is reported once for every line it was used on,
+            // rather than once for every reference at the end of the file
+            std::unordered_set<std::string> reported;
+            for (int i = 0; i < symbol_count; i++)
+            {
+                auto key = symbol_key(symbol_buffers[i]);
+                if (!reported.insert(key).second)
+                {
+                    continue;
+                }
+
+                snprintf(data->temp_buffer, ERROR_BUFFER_SIZE, "Unresolved symbol %s", symbol_buffers[i]);
+                auto lines = data->reference_lines.find(key);
+                if (lines == data->reference_lines.end())
+                {
+                    add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR, filename);
+                    continue;
+                }
+
+                for (auto &line : lines->second)
+                {
+                    data->lineNumber = line.line_number;
+                    add_error(data, data->temp_buffer, assembler_status::SYMBOL_ERROR, data->instruction_files[line.file].c_str());
+                }
+            }
+        }
+
+        for (int i = 0; i < data->symbol_references_count; i++)
+        {
+            delete [] symbol_buffers[i];
+        }
+
+        delete [] symbol_buffers;
+    }
+
+    return result;
+}
+
+// Branches are assembled short until a pass finds they can't reach, then the
+// source is assembled again with them long. Making a branch long can push
+// others out of range, so this repeats until every branch fits.
+assembler_result_t assemble_branch_passes(const char *filename, const std::vector<char> *memory_source, const char **search_paths, include_cache *cache, const assembler_options &options,
+    const std::unordered_set<std::string> &unused_symbols, assembler_timings &timings)
+{
+    std::set<int> long_branches;
+    for (int pass = 1; ; pass++)
+    {
+        // The last pass reports branches that are still too far as errors
+        auto result = assemble_pass(filename, memory_source, search_paths, cache, options, unused_symbols, long_branches, pass < MAX_ASSEMBLY_PASSES);
+        timings.parsing += result->timings.parsing;
+        timings.symbols += result->timings.symbols;
+        timings.regions += result->timings.regions;
+        timings.lines += result->timings.lines;
+        timings.passes++;
+        if (result->far_branches.empty())
+        {
+            result->timings = timings;
+            return result;
+        }
+
+        long_branches.insert(result->far_branches.begin(), result->far_branches.end());
+    }
+}
+
+namespace
+{
+    struct unused_symbol_finder
+    {
+        const std::unordered_set<std::string> &reachable;
+        std::unordered_set<std::string> &unused;
+    };
+} // namespace
+
+// Everything the code that isn't under a label can reach, through the
+// symbols used by the code under each label and by each data block and
+// constant, is kept. Branches and jumps use the labels they go to, and code
+// that doesn't end in one uses the label after it.
+std::unordered_set<std::string> find_unused_symbols(assembler_data_t *data)
+{
+    std::unordered_set<std::string> reachable{ "" };
+    std::vector<std::string> to_visit{ "" };
+    while (!to_visit.empty())
+    {
+        auto uses = data->symbol_uses.find(to_visit.back());
+        to_visit.pop_back();
+        if (uses == data->symbol_uses.end())
+        {
+            continue;
+        }
+
+        for (auto &used : uses->second)
+        {
+            if (reachable.insert(used).second)
+            {
+                to_visit.push_back(used);
+            }
+        }
+    }
+
+    std::unordered_set<std::string> unused;
+    unused_symbol_finder finder{ reachable, unused };
+    visit_symbols(data->symbol_table, [](void *context, const char *name, symbol_type_t, uint16_t, uint8_t)
+    {
+        auto finder = reinterpret_cast<unused_symbol_finder*>(context);
+        auto key = symbol_key(name);
+        if (finder->reachable.count(key) == 0)
+        {
+            finder->unused.insert(key);
+        }
+    }, &finder);
+
+    return unused;
+}
+
+// Stripping takes a pass to find what's used, then assembles the program
+// again leaving everything else out, so addresses close up over the gaps
+assembler_result_t assemble_passes(const char *filename, const std::vector<char> *memory_source, const char **search_paths, include_cache *cache, const assembler_options &options)
+{
+    assembler_timings timings;
+    auto result = assemble_branch_passes(filename, memory_source, search_paths, cache, options, {}, timings);
+    if (!result->track_symbol_uses || !result->errors.empty())
+    {
+        return result;
+    }
+
+    auto unused_symbols = find_unused_symbols(result.get());
+    if (unused_symbols.empty())
+    {
+        return result;
+    }
+
+    return assemble_branch_passes(filename, memory_source, search_paths, cache, options, unused_symbols, timings);
+}
+
+assembler_result_t assemble(const char *filename, const char **search_paths, include_cache *cache, const assembler_options &options)
+{
+    return assemble_passes(filename, nullptr, search_paths, cache, options);
+}
+
+assembler_result_t assemble_from_memory(const char *name, const char *source, size_t length, const char **search_paths, include_cache *cache, const assembler_options &options)
+{
+    std::vector<char> memory_source(source, source + length);
+    return assemble_passes(name, &memory_source, search_paths, cache, options);
+}
+
+namespace
+{
+    struct object_builder
+    {
+        assembler_data_t *data;
+        object_file_t &object;
+        std::map<std::string, uint16_t> import_indices{};
+
+        // Finds which section an address falls in. Regions can't overlap, so
+        // there's only ever one, and an address just past the end of a region
+        // (a label after its last instruction) belongs to it too.
+        int section_for_address(uint16_t address) const
+        {
+            int index = data->region_addresses.find(address);
+            if (index >= 0)
+            {
+                return index;
+            }
+
+            for (size_t i = 0; i < data->regions.size(); i++)
+            {
+                if (data->regions[i]->start_location + object.sections[i].length == address)
+                {
+                    return (int)i;
+                }
+            }
+
+            return -1;
+        }
+
+        void add_export(const char *name, symbol_type_t type, uint16_t word_value, uint8_t byte_value)
+        {
+            object_symbol_t symbol{ name, type, -1, static_cast<uint16_t>(type == SYMBOL_BYTE ? byte_value : word_value) };
+            if (type == SYMBOL_ADDRESS_INST || type == SYMBOL_ADDRESS_DATA)
+            {
+                symbol.section = section_for_address(word_value);
+                if (symbol.section >= 0)
+                {
+                    symbol.value = word_value - data->regions[symbol.section]->start_location;
+                }
+            }
+
+            object.exports.push_back(symbol);
+        }
+
+        void add_import(const char *name, uint16_t ref_location, symbol_type_t expected_type, symbol_signedness_t expected_signedness)
+        {
+            // Symbols are case insensitive, so one import covers every spelling
+            std::string key{ name };
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)tolower(c); });
+            auto found = import_indices.find(key);
+            if (found == import_indices.end())
+            {
+                found = import_indices.emplace(key, (uint16_t)object.imports.size()).first;
+                object.imports.push_back(name);
+            }
+
+            object_relocation_t relocation{};
+            if (expected_type == SYMBOL_ADDRESS_INST && expected_signedness == SIGNEDNESS_SIGNED)
+            {
+                relocation.kind = relocation_kind::branch;
+            }
+            else if (expected_type == SYMBOL_BYTE)
+            {
+                relocation.kind = relocation_kind::byte;
+            }
+
+            add_relocation(relocation, ref_location, -1, found->second);
+        }
+
+        void add_relocation(object_relocation_t relocation, uint16_t location, int target_section, uint16_t target)
+        {
+            auto section = section_for_address(location);
+            if (section < 0)
+            {
+                return;
+            }
+
+            relocation.section = section;
+            relocation.offset = location - data->regions[section]->start_location;
+            relocation.target_section = target_section;
+            relocation.target = target;
+            object.relocations.push_back(relocation);
+        }
+
+        void build()
+        {
+            for (auto region : data->regions)
+            {
+                object_section_t section{};
+                section.fixed = region->fixed;
+                section.address = region->start_location;
+                if (region->executable)
+                {
+                    section.kind = object_section_kind::code;
+                    section.length = region->current_instruction_offset;
+                    section.data.assign(region->data, region->data + section.length);
+                }
+                else if (region->data != nullptr && region->data_length > 0)
+                {
+                    section.kind = object_section_kind::data;
+                    section.length = region->data_length;
+                    section.data.assign(region->data, region->data + section.length);
+                }
+                else
+                {
+                    section.kind = object_section_kind::reserved;
+                    section.length = region->length;
+                }
+
+                object.sections.push_back(std::move(section));
+            }
+
+            if (data->execution_start.has_value())
+            {
+                object.entry_section = section_for_address(data->execution_start.value());
+                if (object.entry_section >= 0)
+                {
+                    object.entry_offset = data->execution_start.value() - data->regions[object.entry_section]->start_location;
+                }
+            }
+
+            visit_symbols(data->symbol_table, [](void *context, const char *name, symbol_type_t type, uint16_t word_value, uint8_t byte_value)
+            {
+                reinterpret_cast<object_builder*>(context)->add_export(name, type, word_value, byte_value);
+            }, this);
+
+            // Resolved addresses are stored as where they point to in this
+            // object's layout, as an offset into the section they point at
+            for (auto &record : data->relocations)
+            {
+                auto section = section_for_address(record.location);
+                if (section < 0)
+                {
+                    continue;
+                }
+
+                auto bytes = &data->regions[section]->data[record.location - data->regions[section]->start_location];
+                uint16_t target_address = record.kind == relocation_kind::branch
+                    ? (uint16_t)(record.location - 1 + (int8_t)bytes[0])
+                    : (uint16_t)((bytes[0] << 8) | bytes[1]);
+
+                auto target_section = section_for_address(target_address);
+                if (target_section < 0 || (record.kind == relocation_kind::branch && target_section == section))
+                {
+                    // Branches within a section move with it
+                    continue;
+                }
+
+                object_relocation_t relocation{};
+                relocation.kind = record.kind;
+                add_relocation(relocation, record.location, target_section, target_address - data->regions[target_section]->start_location);
+            }
+
+            visit_unresolved_references(data->symbol_table, [](void *context, const char *name, uint16_t ref_location, symbol_type_t expected_type, symbol_signedness_t expected_signedness)
+            {
+                reinterpret_cast<object_builder*>(context)->add_import(name, ref_location, expected_type, expected_signedness);
+            }, this);
+        }
+    };
+} // namespace
+
+assembler_status output_assembled_data(assembler_data_t *data, const char *source_filename, const char *output_file, assembler_output_type out_file_type)
+{
+    // Objects without code can still hold data and symbols for others to use
+    if (data->errors.size() > 0 || (!data->execution_start.has_value() && out_file_type != assembler_output_type::object))
+    {
+        return assembler_status::NOOUTPUT;
+    }
+
+    auto status = assembler_status::NOOUTPUT;
+    if (out_file_type != assembler_output_type::none && out_file_type != assembler_output_type::error)
+    {
+        std::string output_filename{};
+        if (output_file == nullptr)
+        {
+            std::filesystem::path infilepath(source_filename);
+            switch (out_file_type)
+            {
+            case assembler_output_type::binary:
+                output_filename = infilepath.stem().string() + ".rcexe";
+                break;
+
+            case assembler_output_type::object:
+                output_filename = infilepath.stem().string() + ".rcobj";
+                break;
+
+            case assembler_output_type::summary:
+            default:
+                output_filename = infilepath.stem().string() + ".txt";
+                break;
+            }
+        }
+        else
+        {
+            output_filename = output_file;
+        }
+        
+        if (out_file_type == assembler_output_type::object)
+        {
+            object_file_t object;
+            object_builder{ data, object }.build();
+            if (!write_object_file(object, output_filename.c_str()))
+            {
+                fprintf(stderr, "Couldn't write object file %s (errno: %d)\n", output_filename.c_str(), errno);
+                return assembler_status::IO_ERROR;
+            }
+
+            data->output_filename = output_filename;
+            return assembler_status::SUCCESS;
+        }
+
+        FILE* assembled_output = 0;
+#if defined(_MSC_VER)
+        assembled_output = fopen(output_filename.c_str(), "wb+");
+#else
+        assembled_output = fopen(output_filename.c_str(), "w+");
+#endif
+        if (assembled_output != 0)
+        {
+            if (out_file_type == assembler_output_type::summary)
+            {    
+                fprintf(assembled_output, "Execution start: 0x%04x\n", data->execution_start.value());
+
+                fprintf(assembled_output, "Code:\n");
+                int i = 0;
+                auto output_line = [assembled_output, &i](assembled_region_t *region, int data_length)
+                {
+                    fprintf(assembled_output, "0x%04x: ", region->start_location + i);
+                    for (int j = 0; j < 4 && i < region->data_length; j++)
+                    {
+                        fprintf(assembled_output, "0x%02x ", region->data[i++]);
+                    }
+                    fprintf(assembled_output, "\n");
+                };
+
+                for (auto region : data->regions)
+                {
+                    if (region->executable)
+                    {
+                        for (i = 0; i < region->data_length && i < region->current_instruction_offset;)
+                        {
+                            output_line(region, region->data_length);
+                        }
+                    }
+                }
 
                 const int max_data_print = 512;
                 fprintf(assembled_output, "\nData:\n");
-                for (auto region : data.regions)
+                for (auto region : data->regions)
                 {
                     if (!region->executable)
                     {
@@ -1087,16 +2456,18 @@ void assemble(const char *filename, const char **search_paths, const char *outpu
                 }
 
                 fprintf(assembled_output, "\nSymbols:\n");
-                output_symbols(assembled_output, data.symbol_table);
+                output_symbols(assembled_output, data->symbol_table);
+                status = assembler_status::SUCCESS;
             }
             else if (out_file_type == assembler_output_type::binary)
             {
-                auto file_size = executable_file_size(&data);
+                auto file_size = executable_file_size(data);
                 std::unique_ptr<uint8_t[]> file_buffer(new uint8_t[file_size]);
-                auto result = prepare_executable_file(&data, file_buffer.get());
+                auto result = prepare_executable_file(data, file_buffer.get());
                 if (result == assembler_status::SUCCESS)
                 {
                     fwrite(file_buffer.get(), 1, file_size, assembled_output);
+                    status = assembler_status::SUCCESS;
                 }
                 else
                 {
@@ -1105,16 +2476,14 @@ void assemble(const char *filename, const char **search_paths, const char *outpu
             }
 
             fclose(assembled_output);
-            data.output_filename = output_filename;
+            data->output_filename = output_filename;
         }
         else
         {
             fprintf(stderr, "Couldn't open assembler output file %s (errno: %d)\n", output_filename.c_str(), errno);
+            status = assembler_status::IO_ERROR;
         }
     }
 
-    if (data.symbol_table != 0)
-    {
-        dispose_symbol_table(data.symbol_table);
-    }
+    return status;
 }
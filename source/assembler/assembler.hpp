@@ -7,6 +7,8 @@
 
 #include <errno.h>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 enum class assembler_status
@@ -31,6 +33,39 @@ enum class assembler_output_type
     none,
     binary,
     summary,
+    // A relocatable .rcobj for rclink
+    object,
+};
+
+struct assembler_options
+{
+    // Leave symbols that aren't defined as imports, and record where
+    // addresses were used so the linker can move the code
+    bool relocatable = false;
+    // Run the peephole optimizer over instructions as they're assembled
+    bool optimize = false;
+    // Leave out the code under labels, .data, .reserve and constants that
+    // nothing reachable from the start of the program uses. Ignored for
+    // objects, whose symbols other objects might use.
+    bool strip_unused = false;
+    // Time each phase of assembly, for get_assembler_timings
+    bool measure_phases = false;
+};
+
+// Seconds spent in each phase of an assembly, added up over every pass. The
+// phases overlap, as symbols are resolved and regions grow while lines are
+// visited, so time is charged to whichever phase started first.
+struct assembler_timings
+{
+    // Reading source files and turning lines into assembly_lines
+    double parsing = 0;
+    // Defining, looking up and resolving symbols
+    double symbols = 0;
+    // Placing and growing regions
+    double regions = 0;
+    // Lines read from source files, not counting replayed includes
+    size_t lines = 0;
+    int passes = 0;
 };
 
 struct assembler_error_t
@@ -45,19 +80,47 @@ struct assembler_error_t
 #endif
 
 struct assembler_data_t;
+class include_cache;
+class debug_info_t;
+
+struct assembler_data_deleter
+{
+    void operator()(assembler_data_t *data) const;
+};
+
+// Owns everything from one assembly: regions, symbols and errors
+typedef std::unique_ptr<assembler_data_t, assembler_data_deleter> assembler_result_t;
+
+// All of the assembler's state lives in the result, so separate assemblies
+// can run at the same time on different threads. Included files are looked
+// up in and added to cache when one is given.
+assembler_result_t assemble(const char *filename, const char **search_paths, include_cache *cache = nullptr, const assembler_options &options = assembler_options{});
+// The same, for a source that's already in memory. name is only used in
+// errors, and includes are looked for the same way as for a file.
+assembler_result_t assemble_from_memory(const char *name, const char *source, size_t length, const char **search_paths, include_cache *cache = nullptr, const assembler_options &options = assembler_options{});
 
-extern assembler_data_t *assembler_data;
-extern char temp_buffer[ERROR_BUFFER_SIZE + 1];
-extern int *lineNumber;
-extern char *error_buffer;
+// Writes an assembled program out as an executable or a summary. Without an
+// output_file the name comes from source_filename with a new extension.
+assembler_status output_assembled_data(assembler_data_t *data, const char *source_filename, const char *output_file, assembler_output_type out_file_type);
 
-void assemble(const char *filename, const char **search_paths, const char *output_file, assembler_output_type out_file_type, assembler_data_t **assembled_data);
 assembler_status get_starting_executable_address(assembler_data_t *data, uint16_t *address);
 assembler_status apply_assembled_data_to_buffer(assembler_data_t *data, uint8_t *buffer);
+// Calls visit with every region that has data, with the same bytes
+// apply_assembled_data_to_buffer would copy to its address
+void visit_assembled_regions(assembler_data_t *data, void (*visit)(void *context, uint16_t address, const uint8_t *bytes, uint16_t length), void *context);
 int get_error_buffer_size(assembler_data_t *data);
 const char *get_error_buffer(assembler_data_t *data);
 const char *get_output_filename(assembler_data_t *data);
 
+// Only filled in when the assembly was run with measure_phases
+const assembler_timings &get_assembler_timings(assembler_data_t *data);
+
+// Canonical paths of the source file and everything it included
+const std::vector<std::string> &get_source_files(assembler_data_t *data);
+
+// Adds the line each instruction was assembled from, and every symbol
+void collect_debug_info(assembler_data_t *data, debug_info_t &info);
+
 // The buffer provided to prepare_executable_file must be at least big enough
 // to hold the number of bytes returned by executable_file_size
 uint16_t executable_file_size(assembler_data_t *data);
@@ -18,14 +18,28 @@ struct parser_error_message
 
 typedef boost::error_info<struct tag_assembler_error, parser_error_message> parser_error;
 
+struct parsed_file_t;
+
 void add_file_to_process(assembler_data_t *data, const char *included_file);
 void handle_file(assembler_data_t *data, const char *included_file);
 void handle_symbol_def(assembler_data_t *data, const char *name, int value, symbol_type_t type);
 void handle_org_directive(assembler_data_t *data, uint16_t address);
 void handle_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const char *symbol_arg, int literal_arg);
 void handle_indexed_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const register_index_t &index_register);
+// Expressions with symbols that aren't defined yet are finished when they are
+void handle_expression_instruction(assembler_data_t *data, const opcode_entry_t *opcode, const std::string &expression);
+void handle_constant_def(assembler_data_t *data, const rc_assembler::constant_def &def);
 void add_data(assembler_data_t* data, const std::string& name, const rc_assembler::byte_array& bytes);
 void reserve_data(assembler_data_t* data, const char* name, uint16_t size);
 void add_error(assembler_data_t *data, const char *error_string, assembler_status status, const char* filename = nullptr);
 void add_error(assembler_data_t* data, const std::string& error_string, assembler_status status, const char* filename = nullptr);
 std::string current_filename(assembler_data_t* data);
+int current_line_number(assembler_data_t* data);
+// How many files deep the assembler is, 1 for the file being assembled
+size_t current_file_depth(assembler_data_t* data);
+bool parse_assembly_line(assembler_data_t *data, const char *line_start, const char *line_end, parsed_file_t *parsed_file);
+void handle_parsed_line(assembler_data_t *data, const rc_assembler::line_options &line, parsed_file_t *parsed_file);
+// In the code under a label that's being left out, see assembler_options::strip_unused
+bool in_unused_code(assembler_data_t *data);
+// Gets the value of a byte or word symbol that's already been defined
+bool find_constant_symbol(assembler_data_t *data, const char *name, int &value);
@@ -1,11 +1,16 @@
 #include "assembler.hpp"
+#include "include_cache.hpp"
+#include "debug_info.hpp"
 #include "opcodes.h"
 
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <string>
 #include <iterator>
+#include <thread>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 
@@ -26,6 +31,10 @@ std::istream& operator>>(std::istream& in, assembler_output_type& file_type)
     {
         file_type = assembler_output_type::summary;
     }
+    else if (token == "object" || token == "o")
+    {
+        file_type = assembler_output_type::object;
+    }
     else if (token == "none" || token == "n")
     {
         file_type = assembler_output_type::none;
@@ -57,10 +66,125 @@ std::ostream& operator<<(std::ostream& out, const assembler_output_type& file_ty
     case assembler_output_type::summary:
         out << "summary";
         break;
+
+    case assembler_output_type::object:
+        out << "object";
+        break;
     }
     return out;
 }
 
+// A program and the stamps of every file it read the last time it was assembled
+struct watched_program
+{
+    std::string source_file;
+    std::map<std::string, source_stamp_t> dependencies{};
+};
+
+double milliseconds_since(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// Options that apply to every program being assembled
+struct assembly_settings
+{
+    assembler_output_type out_file_type = assembler_output_type::binary;
+    bool optimize = false;
+    bool strip_unused = false;
+    bool debug_info = false;
+};
+
+bool assemble_program(watched_program& program, const char** includes, include_cache* cache, const char* output_file, const assembly_settings& settings, bool show_time)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    auto out_file_type = settings.out_file_type;
+    assembler_options options{};
+    options.relocatable = out_file_type == assembler_output_type::object;
+    options.optimize = settings.optimize;
+    options.strip_unused = settings.strip_unused;
+    auto assembled_data = assemble(program.source_file.c_str(), includes, cache, options);
+
+    program.dependencies.clear();
+    for (auto& path : get_source_files(assembled_data.get()))
+    {
+        std::string canonical_path;
+        source_stamp_t stamp;
+        if (get_source_stamp(path.c_str(), canonical_path, stamp))
+        {
+            program.dependencies[canonical_path] = stamp;
+        }
+    }
+
+    // With nothing read, at least watch the source file itself so it can be created later
+    if (program.dependencies.empty())
+    {
+        program.dependencies[program.source_file] = source_stamp_t{};
+    }
+
+    if (get_error_buffer_size(assembled_data.get()) > 0)
+    {
+        std::cerr << get_error_buffer(assembled_data.get()) << std::endl;
+        return false;
+    }
+
+    auto output_status = output_assembled_data(assembled_data.get(), program.source_file.c_str(), output_file, out_file_type);
+    if (output_status == assembler_status::SUCCESS && settings.debug_info && out_file_type != assembler_output_type::object)
+    {
+        // Objects are moved by the linker, so only an executable's addresses mean anything
+        debug_info_t info;
+        collect_debug_info(assembled_data.get(), info);
+        auto debug_info_path = std::filesystem::path(get_output_filename(assembled_data.get())).replace_extension(".rcdbg").string();
+        if (!write_debug_info(info, debug_info_path.c_str()))
+        {
+            std::cerr << "Couldn't write debug info to " << debug_info_path << std::endl;
+            return false;
+        }
+    }
+
+    if (output_status == assembler_status::SUCCESS)
+    {
+        std::cout << "Program assembled successfully into " << get_output_filename(assembled_data.get());
+        if (show_time)
+        {
+            std::cout << " (" << milliseconds_since(start_time) << "ms)";
+        }
+        std::cout << std::endl;
+    }
+    else if (output_status == assembler_status::NOOUTPUT && out_file_type != assembler_output_type::none)
+    {
+        std::cerr << "Nothing to output, " << program.source_file << " has no code" << std::endl;
+        return false;
+    }
+    else if (output_status != assembler_status::NOOUTPUT)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool has_changed(const watched_program& program)
+{
+    for (auto& dependency : program.dependencies)
+    {
+        std::string canonical_path;
+        source_stamp_t stamp;
+        if (!get_source_stamp(dependency.first.c_str(), canonical_path, stamp))
+        {
+            // A file that's gone missing only counts once
+            stamp = source_stamp_t{};
+        }
+
+        if (!(stamp == dependency.second))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void usage(char** argv, po::options_description& options)
 {
     std::filesystem::path command_path{ argv[0] };
@@ -72,13 +196,18 @@ int main(int argc, char **argv)
 {
     std::string font_name{};
     po::options_description cli_options("Allowed options");
-    assembler_output_type outFileType = assembler_output_type::binary;
+    assembly_settings settings{};
     cli_options.add_options()
         ("help,?", "output the help message")
         ("include,I", po::value< std::vector < std::string>>(), "directories to include when assembling source")
-        ("source,S", po::value<std::string>()->required(), "assembly source file to run")
+        ("source,S", po::value<std::vector<std::string>>()->required(), "assembly source files to assemble")
         ("output-file,O", po::value<std::string>(), "a file into which assembled data is saved")
-        ("type,T", po::value<assembler_output_type>(&outFileType)->default_value(assembler_output_type::binary), "what type of file to output (binary or summary)")
+        ("type,T", po::value<assembler_output_type>(&settings.out_file_type)->default_value(assembler_output_type::binary), "what type of file to output (binary, summary or object)")
+        ("include-cache", po::value<std::string>(), "a directory to keep parsed include files in, shared between runs")
+        ("watch,W", "keep running, and reassemble programs when any file they include changes")
+        ("optimize", "remove pushes that are popped straight away, add constants together, and drop jumps to the next instruction")
+        ("strip", "leave out routines, data and constants that nothing reachable from the start of the program uses")
+        ("debug-info,g", "also write a .rcdbg file next to the output, mapping addresses to source lines and symbols")
         ;
 
     po::variables_map variables;
@@ -106,30 +235,75 @@ int main(int argc, char **argv)
 
     if (variables.count("source") > 0)
     {
-        auto& source_file = variables["source"].as<std::string>();
-        std::ifstream file_stream(source_file, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-        auto file_size = file_stream.tellg();
-        file_stream.seekg(0);
-        std::string file_contents(file_size, '\0');
-        file_stream.read(&file_contents[0], file_size);
-
-        assembler_data_t *assembled_data;
+        auto& source_files = variables["source"].as<std::vector<std::string>>();
         const char* output_file = nullptr;
         
         if (variables.count("output-file") > 0)
         {
+            if (source_files.size() > 1)
+            {
+                std::cerr << "An output file can only be given when assembling a single source file" << std::endl;
+                return -1;
+            }
+
             output_file = variables["output-file"].as<std::string>().c_str();
         }
 
-        assemble(variables["source"].as<std::string>().c_str(), includes, output_file, outFileType, &assembled_data);
-        if (get_error_buffer_size(assembler_data) > 0)
+        bool watch = variables.count("watch") > 0;
+        settings.optimize = variables.count("optimize") > 0;
+        settings.strip_unused = variables.count("strip") > 0;
+        settings.debug_info = variables.count("debug-info") > 0;
+        std::unique_ptr<include_cache> cache;
+        if (variables.count("include-cache") > 0)
+        {
+            cache.reset(new include_cache(variables["include-cache"].as<std::string>().c_str()));
+        }
+        else if (watch)
+        {
+            // Includes that haven't changed are replayed rather than parsed again
+            cache.reset(new include_cache());
+        }
+
+        std::vector<watched_program> programs;
+        bool all_succeeded = true;
+        for (auto& source_file : source_files)
         {
-            std::cerr << error_buffer << std::endl;
-            return -1;
+            programs.push_back(watched_program{ source_file });
+            all_succeeded = assemble_program(programs.back(), includes, cache.get(), output_file, settings, watch) && all_succeeded;
         }
-        else
+
+        if (!watch)
+        {
+            return all_succeeded ? 0 : -1;
+        }
+
+        std::cout << "Watching " << programs.size() << " program(s) for changes" << std::endl;
+        while (1)
         {
-            std::cout << "Program assembled successfully into " << get_output_filename(assembled_data) << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+            std::vector<watched_program*> changed_programs;
+            for (auto& program : programs)
+            {
+                if (has_changed(program))
+                {
+                    changed_programs.push_back(&program);
+                }
+            }
+
+            if (changed_programs.empty())
+            {
+                continue;
+            }
+
+            auto start_time = std::chrono::steady_clock::now();
+            for (auto program : changed_programs)
+            {
+                assemble_program(*program, includes, cache.get(), output_file, settings, true);
+            }
+
+            std::cout << "Reassembled " << changed_programs.size() << " of " << programs.size() << " program(s) in "
+                << milliseconds_since(start_time) << "ms" << std::endl;
         }
     }
     else
@@ -24,10 +24,10 @@
 // <hex byte literal>[\s+<hex byte literal>]*
 //
 // Instruction line
-// \s*<instruction>[\s+(<symbol>|<single-value literal>|<register index>)]
+// \s*<instruction>[\s+(<symbol>|<single-value literal>|<register index>|<expression>)]
 //
 // Byte/word definition
-// .<def directive>\s+<symbol>\s+<integer literal>
+// .<def directive>\s+<symbol>\s+(<integer literal>|<expression>)
 //
 // Data definition
 // .data\s+[<symbol>\s+](<quoted string>|<byte sequence>)
@@ -40,7 +40,7 @@
 // .endstruct
 //
 // Reservation
-// .reserve\s+<symbol>\s+<integer literal>
+// .reserve\s+<symbol>\s+(<integer literal>|<expression>)
 //
 // Include directive
 // .include\s+<quoted filename>
@@ -53,37 +53,33 @@
 // - post-increment/decrement
 // [\s*<register>\s*(+|-){1,2}\s*]
 //
+// Expression
+// Everything up to a comment, when it isn't just one literal or symbol. It's
+// parsed and folded by parse_expression as it's assembled, see expressions.hpp.
+//
 // Comment
 // ;<character>*
 
 // Macros
-// Minimum set of macros :
-//
-// -`set(w) <index register> \[<0:symbol or immediate>\] <1:symbol or immediate>`
-// - if value of <0> is 0:
-//   - push <1> to stack
-//   - pull to location of index register
-// - if value of 0 is not 0 :
-//   - push the index register to the stack
-//   - dup
-//   - push <0> to stack
-//   - add
-//   - pull index register
-//   - push <1>
-//   - pull to location of index register
-//   - pull the index register
+// Macro lines are picked out and expanded by macro_handler before a line
+// reaches line_rule, using index_macro_rule and macro_def_rule below.
+//
+// - `set(w) <index register> \[<0:symbol or immediate>\] <1:symbol or immediate>`
+//   stores <1> at the index register plus <0>
 // - `get(w) <index register> \[<symbol or immediate index>\]`
-// - if value is 0:
-//   - pull location at index register
-// - if value is not 0 :
-//   - pushes the index register to the stack
-//   - dup
-//   - push value
-//   - add
-//   - pull index register
-//   - push value at index register to stack
-//   - swap the value and original index register
-//   - pull to the index register
+//   pushes the value at the index register plus the index
+// - if the index is 0, a single indexed push or pull
+// - if it's small enough for the register's increment, a pre-incremented
+//   push or pull, then a post-decrement to put the register back
+// - otherwise the index is added to the register, with the original kept
+//   on the stack to restore it after
+//
+// User macros
+// .macro\s+<symbol>[\s+<parameter symbol>[\s*,\s*<parameter symbol>]*]
+// <lines, where parameters are replaced with the arguments>
+// .endmacro
+// Invoked with <macro name>[\s+<argument>[\s*,\s*<argument>]*]
+// Labels defined in a macro get a new name in each expansion.
 
 namespace rc_assembler
 {
@@ -123,15 +119,30 @@ namespace rc_assembler
                 | ('[' >> increment_rule >> ascii::no_case[register_parser] >> ']')[_val = phoenix::construct<register_index_t>(qi::_2, 1, qi::_1)]
                 | ('[' >> ascii::no_case[register_parser] >> increment_rule >> ']')[_val = phoenix::construct<register_index_t>(qi::_1, 0, qi::_2)];
 
-            instruction_argument_rule %= symbol_rule | hex_word_lit | hex_byte_lit | qi::int_ | indexed_register_argument_rule;
+            // A single value has to be all there is, or it's the start of an expression
+            end_of_value = qi::eoi | ';';
+            // A ';' in quotes is a character rather than a comment
+            expression_text %= qi::raw[qi::lexeme[+(('\'' >> -qi::lit('\\') >> qi::char_ >> '\'') | (qi::char_ - ';'))]];
+            expression_rule = expression_text[phoenix::at_c<0>(_val) = qi::_1];
+
+            plain_argument_rule %= symbol_rule | hex_word_lit | hex_byte_lit | qi::int_ | indexed_register_argument_rule;
+            instruction_argument_rule %= (plain_argument_rule >> &end_of_value) | expression_rule;
 
             comment %= ';' >> *qi::char_;
-            byte_def_rule %= ".defbyte" >> symbol_rule >> (hex_byte_lit | qi::uint_);
-            word_def_rule %= ".defword" >> symbol_rule >> (hex_word_lit | qi::uint_);
+            byte_def_rule %= ".defbyte" >> symbol_rule >> (hex_byte_lit | qi::uint_) >> &end_of_value;
+            word_def_rule %= ".defword" >> symbol_rule >> (hex_word_lit | qi::uint_) >> &end_of_value;
             data_def_rule %= ".data" >> -symbol_rule >> (byte_sequence | quoted_byte_string);
             bytes_rule %= byte_sequence;
             end_data_rule %= ".enddata" >> *qi::char_;
-            reservation_rule %= ".reserve" >> symbol_rule >> (hex_word_lit | qi::uint_);
+            reservation_rule %= ".reserve" >> symbol_rule >> (hex_word_lit | qi::uint_) >> &end_of_value;
+
+            constant_directive_parser
+                .add(".defbyte", constant_kind::byte)
+                (".defword", constant_kind::word)
+                (".reserve", constant_kind::reserve)
+                ;
+
+            constant_def_rule %= constant_directive_parser >> symbol_rule >> expression_rule;
             include_rule %= ".include" >> quoted_byte_string;
             label_def_rule %= symbol_rule >> ':';
             org_def_rule %= ".org" >> (hex_word_lit | qi::uint_);
@@ -150,6 +161,7 @@ namespace rc_assembler
                     | reservation_rule
                     | byte_def_rule
                     | word_def_rule
+                    | constant_def_rule
                     | data_def_rule
                     | bytes_rule
                     | end_data_rule
@@ -163,6 +175,18 @@ namespace rc_assembler
 
             line_rule %= (line_options_rule || comment);
 
+            index_macro_parser
+                .add("set", index_macro_kind::set)
+                ("setw", index_macro_kind::setw)
+                ("get", index_macro_kind::get)
+                ("getw", index_macro_kind::getw)
+                ;
+
+            macro_value_rule %= symbol_rule | hex_word_lit | hex_byte_lit | qi::int_;
+            index_macro_rule %= qi::lexeme[ascii::no_case[index_macro_parser] >> !(ascii::alnum | '_' | '.')]
+                >> ascii::no_case[register_parser] >> '[' >> macro_value_rule >> ']' >> -macro_value_rule;
+            macro_def_rule %= ".macro" >> symbol_rule >> -(symbol_rule % ',');
+
             opcode_parser.name("opcodes");
             int opcode_count = opcode_entry_count();
             for (int i = 0; i < opcode_count; i++)
@@ -197,6 +221,10 @@ namespace rc_assembler
 
         qi::rule<Iterator, int, ascii::space_type> increment_rule;
         qi::rule<Iterator, register_index_t(), ascii::space_type> indexed_register_argument_rule;
+        qi::rule<Iterator, ascii::space_type> end_of_value;
+        qi::rule<Iterator, std::string(), ascii::space_type> expression_text;
+        qi::rule<Iterator, expression(), ascii::space_type> expression_rule;
+        qi::rule<Iterator, instruction_argument(), ascii::space_type> plain_argument_rule;
         qi::rule<Iterator, instruction_argument(), ascii::space_type> instruction_argument_rule;
 
         qi::rule<Iterator, uint8_t(), ascii::space_type> hex_byte_lit;
@@ -209,6 +237,8 @@ namespace rc_assembler
         qi::rule<Iterator, opcode_entry_t*, ascii::space_type> opcode_rule;
         qi::rule<Iterator, byte_def(), ascii::space_type> byte_def_rule;
         qi::rule<Iterator, word_def(), ascii::space_type> word_def_rule;
+        qi::symbols<char, constant_kind> constant_directive_parser;
+        qi::rule<Iterator, constant_def(), ascii::space_type> constant_def_rule;
         qi::rule<Iterator, data_def(), ascii::space_type> data_def_rule;
         qi::rule<Iterator, byte_array(), ascii::space_type> bytes_rule;
         qi::rule<Iterator, end_data_def(), ascii::space_type> end_data_rule;
@@ -225,5 +255,10 @@ namespace rc_assembler
         qi::rule<Iterator, std::string(), ascii::space_type> comment;
 
         qi::rule<Iterator, assembly_line(), ascii::space_type> line_rule;
+
+        qi::symbols<char, index_macro_kind> index_macro_parser;
+        qi::rule<Iterator, instruction_argument(), ascii::space_type> macro_value_rule;
+        qi::rule<Iterator, index_macro(), ascii::space_type> index_macro_rule;
+        qi::rule<Iterator, macro_def(), ascii::space_type> macro_def_rule;
     };
 }
@@ -42,7 +42,7 @@ parser_state data_def_handler::end(parser_state state)
 			data_bytes.push_back(0);
 		}
 
-		add_data(assembler_data, name, data_bytes);
+		add_data(data, name, data_bytes);
 
 		data_bytes.clear();
 		name = "";
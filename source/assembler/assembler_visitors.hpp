@@ -49,21 +49,21 @@ private:
 class instruction_argument_visitor : public boost::static_visitor<>
 {
 public:
-    instruction_argument_visitor(const opcode_entry_t* opcode) : opcode(opcode) {}
+    instruction_argument_visitor(assembler_data_t* data, const opcode_entry_t* opcode) : data(data), opcode(opcode) {}
 
     void operator()(const register_index_t& register_index)
     {
-        handle_indexed_instruction(assembler_data, opcode, register_index);
+        handle_indexed_instruction(data, opcode, register_index);
     }
 
     void operator()(const uint8_t& value)
     {
-        handle_instruction(assembler_data, opcode, nullptr, value);
+        handle_instruction(data, opcode, nullptr, value);
     }
 
     void operator()(const uint16_t& value)
     {
-        handle_instruction(assembler_data, opcode, nullptr, value);
+        handle_instruction(data, opcode, nullptr, value);
     }
 
     void operator()(const int& value)
@@ -79,15 +79,21 @@ public:
             return;
         }
 
-        handle_instruction(assembler_data, opcode, nullptr, value);
+        handle_instruction(data, opcode, nullptr, value);
     }
 
     void operator()(const rc_assembler::symbol& symbol)
     {
-        handle_instruction(assembler_data, opcode, symbol.c_str(), 0);
+        handle_instruction(data, opcode, symbol.c_str(), 0);
+    }
+
+    void operator()(const rc_assembler::expression& expression)
+    {
+        handle_expression_instruction(data, opcode, expression.text);
     }
 
 private:
+    assembler_data_t* data;
     const opcode_entry_t* opcode;
 };
 
@@ -119,7 +125,7 @@ public:
                     }
                     else
                     {
-                        instruction_argument_visitor visitor(instruction.opcode);
+                        instruction_argument_visitor visitor(data, instruction.opcode);
                         boost::apply_visitor(visitor, instruction.argument.value());
                     }
                 }
@@ -130,7 +136,7 @@ public:
                 }
                 else
                 {
-                    handle_instruction(assembler_data, instruction.opcode, nullptr, 0);
+                    handle_instruction(data, instruction.opcode, nullptr, 0);
                 }
             }
             else
@@ -144,7 +150,7 @@ public:
     {
         if (verify_current_state(parser_state::normal))
         {
-            reserve_data(assembler_data, reservation.symbol.c_str(), reservation.size);
+            reserve_data(data, reservation.symbol.c_str(), reservation.size);
         }
     }
 
@@ -152,7 +158,7 @@ public:
     {
         if (verify_current_state(parser_state::normal))
         {
-            handle_symbol_def(assembler_data, byte.symbol.c_str(), byte.value, SYMBOL_BYTE);
+            handle_symbol_def(data, byte.symbol.c_str(), byte.value, SYMBOL_BYTE);
         }
     }
 
@@ -160,7 +166,15 @@ public:
     {
         if (verify_current_state(parser_state::normal))
         {
-            handle_symbol_def(assembler_data, word.symbol.c_str(), word.value, SYMBOL_WORD);
+            handle_symbol_def(data, word.symbol.c_str(), word.value, SYMBOL_WORD);
+        }
+    }
+
+    void operator()(const rc_assembler::constant_def& def)
+    {
+        if (verify_current_state(parser_state::normal))
+        {
+            handle_constant_def(data, def);
         }
     }
 
@@ -207,7 +221,7 @@ public:
     {
         if (verify_current_state(parser_state::normal))
         {
-            handle_org_directive(assembler_data, def.location);
+            handle_org_directive(data, def.location);
         }
     }
 
@@ -215,7 +229,7 @@ public:
     {
         if (verify_current_state(parser_state::normal))
         {
-            handle_symbol_def(assembler_data, def.label_name.c_str(), 0, SYMBOL_ADDRESS_INST);
+            handle_symbol_def(data, def.label_name.c_str(), 0, SYMBOL_ADDRESS_INST);
         }
     }
 
@@ -224,7 +238,7 @@ public:
         if (verify_current_state(parser_state::normal))
         {
             std::string string(def.included_file.begin(), def.included_file.end());
-            add_file_to_process(assembler_data, string.c_str());
+            add_file_to_process(data, string.c_str());
         }
     }
 
@@ -307,7 +321,7 @@ private:
             {
                 std::string("Parser in the wrong state"),
                 std::string(current_filename(data)),
-                *lineNumber,
+                current_line_number(data),
                 current_state,
                 expected_state
             };
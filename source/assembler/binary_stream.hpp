@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Byte streams for the assembler's own file formats, the include cache and
+// relocatable objects. Everything is stored little-endian, whatever the host is.
+class binary_writer
+{
+public:
+    void u8(uint8_t value) { buffer.push_back(value); }
+    void u16(uint16_t value) { u8((uint8_t)value); u8((uint8_t)(value >> 8)); }
+    void u32(uint32_t value) { u16((uint16_t)value); u16((uint16_t)(value >> 16)); }
+    void u64(uint64_t value) { u32((uint32_t)value); u32((uint32_t)(value >> 32)); }
+
+    template <typename Container>
+    void bytes(const Container &container)
+    {
+        u32((uint32_t)container.size());
+        buffer.insert(buffer.end(), container.begin(), container.end());
+    }
+
+    std::vector<uint8_t> buffer{};
+};
+
+class binary_reader
+{
+public:
+    binary_reader(const std::vector<uint8_t> &buffer) : buffer(buffer) {}
+
+    bool u8(uint8_t &value)
+    {
+        if (position >= buffer.size())
+        {
+            return false;
+        }
+
+        value = buffer[position++];
+        return true;
+    }
+
+    bool u16(uint16_t &value)
+    {
+        uint8_t low, high;
+        if (!u8(low) || !u8(high))
+        {
+            return false;
+        }
+
+        value = (uint16_t)(low | (high << 8));
+        return true;
+    }
+
+    bool u32(uint32_t &value)
+    {
+        uint16_t low, high;
+        if (!u16(low) || !u16(high))
+        {
+            return false;
+        }
+
+        value = low | ((uint32_t)high << 16);
+        return true;
+    }
+
+    bool u64(uint64_t &value)
+    {
+        uint32_t low, high;
+        if (!u32(low) || !u32(high))
+        {
+            return false;
+        }
+
+        value = low | ((uint64_t)high << 32);
+        return true;
+    }
+
+    template <typename Container>
+    bool bytes(Container &container)
+    {
+        uint32_t size;
+        if (!u32(size) || size > buffer.size() - position)
+        {
+            return false;
+        }
+
+        container.assign(buffer.begin() + position, buffer.begin() + position + size);
+        position += size;
+        return true;
+    }
+
+    bool at_end() const { return position == buffer.size(); }
+    size_t remaining() const { return buffer.size() - position; }
+
+private:
+    const std::vector<uint8_t> &buffer;
+    size_t position = 0;
+};
+
+inline bool read_binary_file(const char *path, std::vector<uint8_t> &buffer)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        buffer.insert(buffer.end(), chunk, chunk + read);
+    }
+
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    return !failed;
+}
+
+// Written to a temporary file and renamed into place, so anything reading the
+// file at the same time never sees half of it. Returns false if it couldn't be.
+inline bool write_binary_file_atomically(const std::string &path, const std::vector<uint8_t> &buffer)
+{
+    auto unique = std::chrono::steady_clock::now().time_since_epoch().count() ^ (long long)std::hash<std::thread::id>{}(std::this_thread::get_id());
+    auto temporary_path = path + "." + std::to_string((unsigned long long)unique) + ".tmp";
+
+    FILE *file = fopen(temporary_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    written = (fclose(file) == 0) && written;
+
+    std::error_code error;
+    if (written)
+    {
+        std::filesystem::rename(temporary_path, path, error);
+    }
+
+    if (!written || error)
+    {
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+
+    return true;
+}
+
+// 64-bit FNV-1a. Pass the hash so far to carry on from it.
+inline uint64_t hash_bytes(const void *bytes, size_t length, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    auto current = static_cast<const uint8_t*>(bytes);
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= current[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,161 @@
+#include "build_cache.hpp"
+#include "binary_stream.hpp"
+#include "memory.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <system_error>
+
+namespace
+{
+    // Bump whenever the layout below changes, or the assembler starts
+    // producing different code from the same source
+    const uint32_t BUILD_CACHE_VERSION = 2;
+    const char BUILD_CACHE_MAGIC[8] = { 'R', 'C', 'B', 'U', 'I', 'L', 'D', '!' };
+
+    uint64_t hash_string(const std::string &string, uint64_t hash)
+    {
+        // The terminator too, so "ab" "c" doesn't hash like "a" "bc"
+        return hash_bytes(string.c_str(), string.size() + 1, hash);
+    }
+
+    bool hash_file(const std::string &path, uint64_t &hash)
+    {
+        std::vector<uint8_t> contents;
+        if (!read_binary_file(path.c_str(), contents))
+        {
+            return false;
+        }
+
+        hash = hash_bytes(contents.data(), contents.size());
+        return true;
+    }
+} // namespace
+
+build_cache::build_cache(const char *cache_directory)
+    : cache_directory(cache_directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(cache_directory, error);
+}
+
+uint64_t build_cache::key(const char *source, size_t length, const char **search_paths, const assembler_options &options)
+{
+    uint64_t hash = hash_bytes(&BUILD_CACHE_VERSION, sizeof(BUILD_CACHE_VERSION));
+    hash = hash_bytes(source, length, hash);
+
+    // Includes are looked for relative to the working directory first, then
+    // in the search paths, so those decide which files a source gets
+    std::error_code error;
+    hash = hash_string(std::filesystem::current_path(error).string(), hash);
+    for (int i = 0; search_paths != nullptr && search_paths[i] != nullptr; i++)
+    {
+        hash = hash_string(search_paths[i], hash);
+    }
+
+    uint8_t flags[] = { options.relocatable, options.optimize, options.strip_unused };
+    return hash_bytes(flags, sizeof(flags), hash);
+}
+
+bool build_cache::find(uint64_t key, cached_build_t &build) const
+{
+    std::vector<uint8_t> buffer;
+    if (!read_binary_file(cache_file_path(key, ".rcbuild").c_str(), buffer))
+    {
+        return false;
+    }
+
+    // Anything that doesn't match exactly is treated as not cached
+    binary_reader reader(buffer);
+    std::vector<uint8_t> magic;
+    uint32_t version, count;
+    if (!reader.bytes(magic) || magic.size() != sizeof(BUILD_CACHE_MAGIC) || memcmp(magic.data(), BUILD_CACHE_MAGIC, sizeof(BUILD_CACHE_MAGIC)) != 0 ||
+        !reader.u32(version) || version != BUILD_CACHE_VERSION ||
+        !reader.u16(build.execution_start) ||
+        !reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::string path;
+        uint64_t cached_hash, hash;
+        if (!reader.bytes(path) || !reader.u64(cached_hash) || !hash_file(path, hash) || hash != cached_hash)
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    build.segments.resize(count);
+    for (auto &segment : build.segments)
+    {
+        if (!reader.u16(segment.address) || !reader.bytes(segment.bytes) || segment.address + segment.bytes.size() > DATA_SIZE)
+        {
+            return false;
+        }
+    }
+
+    std::string error;
+    return reader.at_end() && read_debug_info(cache_file_path(key, ".rcdbg").c_str(), build.debug_info, error);
+}
+
+void build_cache::store(uint64_t key, assembler_data_t *data, const debug_info_t &debug_info) const
+{
+    uint16_t execution_start;
+    if (get_starting_executable_address(data, &execution_start) != assembler_status::SUCCESS)
+    {
+        return;
+    }
+
+    binary_writer writer;
+    writer.bytes(std::string(BUILD_CACHE_MAGIC, sizeof(BUILD_CACHE_MAGIC)));
+    writer.u32(BUILD_CACHE_VERSION);
+    writer.u16(execution_start);
+
+    auto &source_files = get_source_files(data);
+    writer.u32((uint32_t)source_files.size());
+    for (auto &path : source_files)
+    {
+        uint64_t hash;
+        if (!hash_file(path, hash))
+        {
+            return;
+        }
+
+        writer.bytes(path);
+        writer.u64(hash);
+    }
+
+    std::vector<cached_segment_t> segments;
+    visit_assembled_regions(data, [](void *context, uint16_t address, const uint8_t *bytes, uint16_t length)
+    {
+        reinterpret_cast<std::vector<cached_segment_t>*>(context)->push_back({ address, std::vector<uint8_t>(bytes, bytes + length) });
+    }, &segments);
+
+    writer.u32((uint32_t)segments.size());
+    for (auto &segment : segments)
+    {
+        writer.u16(segment.address);
+        writer.bytes(segment.bytes);
+    }
+
+    // The debug info goes first, as a build is only found once it's in place
+    if (write_debug_info(debug_info, cache_file_path(key, ".rcdbg").c_str()))
+    {
+        write_binary_file_atomically(cache_file_path(key, ".rcbuild"), writer.buffer);
+    }
+}
+
+std::string build_cache::cache_file_path(uint64_t key, const char *extension) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)key, extension);
+    return (std::filesystem::path(cache_directory) / name).string();
+}
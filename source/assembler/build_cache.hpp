@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "assembler.hpp"
+#include "debug_info.hpp"
+
+// Bytes to copy into memory at an address
+struct cached_segment_t
+{
+    uint16_t address = 0;
+    std::vector<uint8_t> bytes{};
+};
+
+// A program as it was after assembling, ready to load
+struct cached_build_t
+{
+    uint16_t execution_start = 0;
+    std::vector<cached_segment_t> segments{};
+    debug_info_t debug_info{};
+};
+
+// Programs that have already been assembled, kept in a directory so a source
+// that hasn't changed can be run again without assembling it. Builds are found
+// by a hash of the source, the options and where includes are looked for, and
+// only used if every file it included still hashes the same.
+class build_cache
+{
+public:
+    build_cache(const char *cache_directory);
+
+    static uint64_t key(const char *source, size_t length, const char **search_paths, const assembler_options &options);
+
+    // Returns false if there's no build for the key, or its includes changed
+    bool find(uint64_t key, cached_build_t &build) const;
+    // Only call this for an assembly without errors
+    void store(uint64_t key, assembler_data_t *data, const debug_info_t &debug_info) const;
+
+private:
+    std::string cache_file_path(uint64_t key, const char *extension) const;
+
+    std::string cache_directory;
+};
@@ -0,0 +1,230 @@
+#include "debug_info.hpp"
+#include "binary_stream.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    // Bump whenever the layout changes
+    const uint32_t DEBUG_INFO_VERSION = 1;
+    const char DEBUG_INFO_MAGIC[5] = { 'R', 'C', 'D', 'B', 'G' };
+} // namespace
+
+void debug_info_t::add_line(uint16_t address, uint16_t length, const std::string &file, uint32_t line)
+{
+    // Lines come from the file being assembled, which is almost always the last one seen
+    uint16_t file_index;
+    auto found = std::find(files.rbegin(), files.rend(), file);
+    if (found != files.rend())
+    {
+        file_index = (uint16_t)(files.rend() - found - 1);
+    }
+    else
+    {
+        file_index = (uint16_t)files.size();
+        files.push_back(file);
+    }
+
+    if (!lines.empty())
+    {
+        auto &last = lines.back();
+        if (last.file == file_index && last.line == line && last.address + last.length == address)
+        {
+            last.length += length;
+            return;
+        }
+    }
+
+    lines.push_back({ address, length, file_index, line });
+}
+
+void debug_info_t::add_symbol(const char *name, symbol_type_t type, uint16_t value)
+{
+    symbols.push_back({ name, type, value });
+    if (type == SYMBOL_ADDRESS_INST)
+    {
+        // Labels are nearly always defined in address order, so this rarely moves anything
+        auto position = std::upper_bound(labels.begin(), labels.end(), value,
+            [this](uint16_t address, size_t index) { return address < symbols[index].value; });
+        labels.insert(position, symbols.size() - 1);
+    }
+}
+
+const debug_line_t *debug_info_t::find_line(uint16_t address) const
+{
+    auto next = std::upper_bound(lines.begin(), lines.end(), address,
+        [](uint16_t address, const debug_line_t &line) { return address < line.address; });
+    if (next == lines.begin())
+    {
+        return nullptr;
+    }
+
+    auto &line = *(next - 1);
+    return address < line.address + line.length ? &line : nullptr;
+}
+
+const debug_symbol_t *debug_info_t::find_label(uint16_t address) const
+{
+    auto next = std::upper_bound(labels.begin(), labels.end(), address,
+        [this](uint16_t address, size_t index) { return address < symbols[index].value; });
+    if (next == labels.begin())
+    {
+        return nullptr;
+    }
+
+    return &symbols[*(next - 1)];
+}
+
+std::string debug_info_t::describe(uint16_t address) const
+{
+    std::string description;
+    auto line = find_line(address);
+    if (line != nullptr)
+    {
+        description = files[line->file] + ":" + std::to_string(line->line);
+    }
+
+    auto label = find_label(address);
+    if (label != nullptr)
+    {
+        std::string location = label->name;
+        if (address != label->value)
+        {
+            location += "+" + std::to_string(address - label->value);
+        }
+
+        description += description.empty() ? location : " (" + location + ")";
+    }
+
+    return description;
+}
+
+bool write_debug_info(const debug_info_t &info, const char *path)
+{
+    binary_writer writer;
+    writer.bytes(std::string(DEBUG_INFO_MAGIC, sizeof(DEBUG_INFO_MAGIC)));
+    writer.u32(DEBUG_INFO_VERSION);
+
+    writer.u32((uint32_t)info.get_files().size());
+    for (auto &file : info.get_files())
+    {
+        writer.bytes(file);
+    }
+
+    writer.u32((uint32_t)info.get_lines().size());
+    for (auto &line : info.get_lines())
+    {
+        writer.u16(line.address);
+        writer.u16(line.length);
+        writer.u16(line.file);
+        writer.u32(line.line);
+    }
+
+    writer.u32((uint32_t)info.get_symbols().size());
+    for (auto &symbol : info.get_symbols())
+    {
+        writer.bytes(symbol.name);
+        writer.u8((uint8_t)symbol.type);
+        writer.u16(symbol.value);
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool written = fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) == writer.buffer.size();
+    return (fclose(file) == 0) && written;
+}
+
+bool read_debug_info(const char *path, debug_info_t &info, std::string &error)
+{
+    std::vector<uint8_t> buffer;
+    if (!read_binary_file(path, buffer))
+    {
+        error = "couldn't be read";
+        return false;
+    }
+
+    binary_reader reader(buffer);
+    std::vector<uint8_t> magic;
+    uint32_t version, count;
+    if (!reader.bytes(magic) || magic.size() != sizeof(DEBUG_INFO_MAGIC) || memcmp(magic.data(), DEBUG_INFO_MAGIC, sizeof(DEBUG_INFO_MAGIC)) != 0)
+    {
+        error = "isn't a debug info file";
+        return false;
+    }
+
+    if (!reader.u32(version) || version != DEBUG_INFO_VERSION)
+    {
+        error = "was made by a different version of the assembler";
+        return false;
+    }
+
+    error = "is truncated or corrupt";
+    info = debug_info_t{};
+
+    // Every entry takes at least a byte, which stops a corrupt count allocating the world
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    info.files.resize(count);
+    for (auto &file : info.files)
+    {
+        if (!reader.bytes(file))
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    info.lines.resize(count);
+    for (size_t i = 0; i < info.lines.size(); i++)
+    {
+        auto &line = info.lines[i];
+        if (!reader.u16(line.address) || !reader.u16(line.length) || !reader.u16(line.file) || !reader.u32(line.line))
+        {
+            return false;
+        }
+
+        // find_line relies on the lines being in order
+        if (line.file >= info.files.size() || (i > 0 && line.address < info.lines[i - 1].address))
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::string name;
+        uint8_t type;
+        uint16_t value;
+        if (!reader.bytes(name) || !reader.u8(type) || type > SYMBOL_ADDRESS_DATA || !reader.u16(value))
+        {
+            return false;
+        }
+
+        info.add_symbol(name.c_str(), (symbol_type_t)type, value);
+    }
+
+    if (!reader.at_end())
+    {
+        return false;
+    }
+
+    error.clear();
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "symbols.h"
+
+// Debug info (.rcdbg) is written next to an executable, and maps the
+// addresses of its code back to the source lines they were assembled from.
+//
+// Layout, all little-endian through binary_stream.hpp:
+// - magic "RCDBG", u32 version
+// - u32 file count, then per file: bytes name
+// - u32 line count, then per line: u16 address, u16 length, u16 file, u32 line
+// - u32 symbol count, then per symbol: bytes name, u8 type, u16 value
+
+// A run of code bytes that all came from one line
+struct debug_line_t
+{
+    uint16_t address = 0;
+    uint16_t length = 0;
+    uint16_t file = 0;
+    uint32_t line = 0;
+};
+
+struct debug_symbol_t
+{
+    std::string name{};
+    symbol_type_t type = SYMBOL_NO_TYPE;
+    uint16_t value = 0;
+};
+
+class debug_info_t
+{
+public:
+    // Lines have to be added in address order. Runs of one line that follow
+    // each other are joined together.
+    void add_line(uint16_t address, uint16_t length, const std::string &file, uint32_t line);
+    void add_symbol(const char *name, symbol_type_t type, uint16_t value);
+
+    // The line an address was assembled from, or nullptr if it isn't code
+    const debug_line_t *find_line(uint16_t address) const;
+    // The closest code label at or before an address, or nullptr if there isn't one
+    const debug_symbol_t *find_label(uint16_t address) const;
+    // Describes an address like "echo.asm:12 (print_string+3)", or just the
+    // label part for an address without a line
+    std::string describe(uint16_t address) const;
+
+    const std::vector<std::string> &get_files() const { return files; }
+    const std::vector<debug_line_t> &get_lines() const { return lines; }
+    const std::vector<debug_symbol_t> &get_symbols() const { return symbols; }
+    bool empty() const { return lines.empty() && symbols.empty(); }
+
+private:
+    friend bool read_debug_info(const char *path, debug_info_t &info, std::string &error);
+
+    std::vector<std::string> files{};
+    std::vector<debug_line_t> lines{};
+    // Every symbol, in the order they were defined
+    std::vector<debug_symbol_t> symbols{};
+    // Indices of the code labels in symbols, sorted by address for find_label
+    std::vector<size_t> labels{};
+};
+
+bool write_debug_info(const debug_info_t &info, const char *path);
+// On failure error says what was wrong with the file
+bool read_debug_info(const char *path, debug_info_t &info, std::string &error);
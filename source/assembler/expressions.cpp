@@ -0,0 +1,463 @@
+#include "expressions.hpp"
+
+#include <limits.h>
+#include <stdint.h>
+#include <algorithm>
+
+namespace
+{
+    using rc_assembler::expression_term;
+
+    bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    bool is_alpha(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // The characters of symbol_rule, without the brackets, which belong to
+    // the expression here. sizeof(name) is picked out on its own.
+    bool is_symbol_char(char c)
+    {
+        return is_alpha(c) || is_digit(c) || c == '.' || c == '_';
+    }
+
+    int hex_digit_value(char c)
+    {
+        if (is_digit(c))
+        {
+            return c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+
+        return -1;
+    }
+
+    // Recursive descent, writing out terms as each operand is finished
+    class expression_parser
+    {
+    public:
+        expression_parser(const std::string &text, std::vector<expression_term> &terms)
+            : position(text.data()), end(text.data() + text.size()), terms(terms)
+        {
+        }
+
+        bool parse(std::string &error)
+        {
+            bool parsed = parse_binary(0);
+            skip_spaces();
+            if (parsed && position != end)
+            {
+                parsed = fail("didn't expect " + std::string(position, end));
+            }
+
+            error = this->error;
+            return parsed;
+        }
+
+    private:
+        // |, &, shifts, + and -, * and /, from the lowest precedence up
+        static const int LEVEL_COUNT = 5;
+
+        void skip_spaces()
+        {
+            while (position != end && (*position == ' ' || *position == '\t' || *position == '\r'))
+            {
+                position++;
+            }
+        }
+
+        bool fail(const std::string &message)
+        {
+            error = message;
+            return false;
+        }
+
+        bool match_operator(int level, char &operation)
+        {
+            skip_spaces();
+            if (position == end)
+            {
+                return false;
+            }
+
+            char c = *position;
+            bool is_shift = (c == '<' || c == '>') && end - position > 1 && position[1] == c;
+            bool matched =
+                (level == 0 && c == '|') ||
+                (level == 1 && c == '&') ||
+                (level == 2 && is_shift) ||
+                (level == 3 && (c == '+' || c == '-')) ||
+                (level == 4 && (c == '*' || c == '/'));
+
+            if (matched)
+            {
+                operation = c;
+                position += is_shift ? 2 : 1;
+            }
+
+            return matched;
+        }
+
+        bool parse_binary(int level)
+        {
+            if (level == LEVEL_COUNT)
+            {
+                return parse_unary();
+            }
+
+            if (!parse_binary(level + 1))
+            {
+                return false;
+            }
+
+            char operation;
+            while (match_operator(level, operation))
+            {
+                if (!parse_binary(level + 1))
+                {
+                    return false;
+                }
+
+                add_operation(operation);
+            }
+
+            return true;
+        }
+
+        bool parse_unary()
+        {
+            skip_spaces();
+            if (position != end && *position == '+')
+            {
+                // As qi::int_ allows
+                position++;
+                return parse_unary();
+            }
+            else if (position != end && *position == '-')
+            {
+                position++;
+                if (!parse_unary())
+                {
+                    return false;
+                }
+
+                add_operation('n');
+                return true;
+            }
+
+            return parse_operand();
+        }
+
+        bool parse_operand()
+        {
+            skip_spaces();
+            if (position == end)
+            {
+                return fail("it ends where a value should be");
+            }
+            else if (*position == '(')
+            {
+                position++;
+                if (!parse_binary(0))
+                {
+                    return false;
+                }
+
+                skip_spaces();
+                if (position == end || *position != ')')
+                {
+                    return fail("a bracket isn't closed");
+                }
+
+                position++;
+                return true;
+            }
+            else if (is_digit(*position))
+            {
+                return parse_number();
+            }
+            else if (*position == '\'')
+            {
+                return parse_character();
+            }
+            else if (is_alpha(*position))
+            {
+                return parse_symbol();
+            }
+
+            return fail("didn't expect " + std::string(position, end));
+        }
+
+        bool parse_number()
+        {
+            int64_t value = 0;
+            int base = 10;
+            if (*position == '0' && end - position > 2 && (position[1] == 'x' || position[1] == 'X') && hex_digit_value(position[2]) >= 0)
+            {
+                base = 16;
+                position += 2;
+            }
+
+            auto number_start = position;
+            int digit;
+            while (position != end && (digit = hex_digit_value(*position)) >= 0 && digit < base)
+            {
+                value = value * base + digit;
+                if (value > INT_MAX)
+                {
+                    return fail(std::string(number_start, position + 1) + " is too big");
+                }
+
+                position++;
+            }
+
+            if (position != end && is_symbol_char(*position))
+            {
+                return fail(std::string(number_start, position + 1) + " isn't a number");
+            }
+
+            add_value((int)value);
+            return true;
+        }
+
+        // 'c', with the escapes quoted strings take
+        bool parse_character()
+        {
+            auto character_start = position++;
+            int value = -1;
+            if (position != end && *position == '\\' && end - position > 1)
+            {
+                switch (position[1])
+                {
+                case 'n': value = '\n'; break;
+                case 't': value = '\t'; break;
+                case '\\': value = '\\'; break;
+                case '"': value = '"'; break;
+                case '\'': value = '\''; break;
+                }
+
+                position += 2;
+            }
+            else if (position != end && *position != '\'')
+            {
+                value = (uint8_t)*position++;
+            }
+
+            if (value < 0 || position == end || *position != '\'')
+            {
+                return fail(std::string(character_start, std::min(position + 1, end)) + " isn't a character");
+            }
+
+            position++;
+            add_value(value);
+            return true;
+        }
+
+        bool parse_symbol()
+        {
+            auto symbol_start = position;
+            while (position != end && is_symbol_char(*position))
+            {
+                position++;
+            }
+
+            std::string symbol(symbol_start, position);
+            if (symbol == "sizeof")
+            {
+                // Named the way struct_def_handler defines it
+                skip_spaces();
+                if (position == end || *position != '(')
+                {
+                    return fail("sizeof needs a struct name in brackets");
+                }
+
+                position++;
+                skip_spaces();
+                auto name_start = position;
+                while (position != end && is_symbol_char(*position))
+                {
+                    position++;
+                }
+
+                auto name_end = position;
+                skip_spaces();
+                if (name_start == name_end || position == end || *position != ')')
+                {
+                    return fail("sizeof needs a struct name in brackets");
+                }
+
+                position++;
+                symbol = "sizeof(" + std::string(name_start, name_end) + ")";
+            }
+
+            expression_term term;
+            term.kind = expression_term::term_kind::symbol;
+            term.symbol = symbol;
+            terms.push_back(term);
+            return true;
+        }
+
+        void add_value(int value)
+        {
+            expression_term term;
+            term.kind = expression_term::term_kind::value;
+            term.value = value;
+            terms.push_back(term);
+        }
+
+        void add_operation(char operation)
+        {
+            expression_term term;
+            term.kind = expression_term::term_kind::operation;
+            term.operation = operation;
+            terms.push_back(term);
+        }
+
+        const char *position;
+        const char *end;
+        std::vector<expression_term> &terms;
+        std::string error{};
+    };
+} // namespace
+
+namespace rc_assembler
+{
+    bool parse_expression(const std::string &text, std::vector<expression_term> &terms, std::string &error)
+    {
+        terms.clear();
+        expression_parser parser(text, terms);
+        return parser.parse(error);
+    }
+
+    expression_status evaluate_expression(const std::vector<expression_term> &terms, const expression_symbol_lookup &lookup,
+        expression_value &result, std::vector<std::string> &unresolved, std::string &error)
+    {
+        std::vector<expression_value> stack;
+        for (auto &term : terms)
+        {
+            if (term.kind == expression_term::term_kind::value)
+            {
+                stack.push_back({ term.value, 0, true });
+                continue;
+            }
+            else if (term.kind == expression_term::term_kind::symbol)
+            {
+                int value = 0;
+                bool is_address = false;
+                if (!lookup(term.symbol, value, is_address))
+                {
+                    if (std::find(unresolved.begin(), unresolved.end(), term.symbol) == unresolved.end())
+                    {
+                        unresolved.push_back(term.symbol);
+                    }
+                }
+
+                stack.push_back({ value, is_address ? 1 : 0, true });
+                continue;
+            }
+
+            if (stack.empty() || (term.operation != 'n' && stack.size() < 2))
+            {
+                error = "it's missing a value";
+                return expression_status::error;
+            }
+
+            auto right = stack.back();
+            if (term.operation == 'n')
+            {
+                stack.back() = { -right.value, -right.address_count, right.relocatable };
+                continue;
+            }
+
+            stack.pop_back();
+            auto &left = stack.back();
+            int64_t value = 0;
+            bool relocatable = left.relocatable && right.relocatable;
+            int address_count = 0;
+            switch (term.operation)
+            {
+            case '+':
+                value = (int64_t)left.value + right.value;
+                address_count = left.address_count + right.address_count;
+                break;
+
+            case '-':
+                value = (int64_t)left.value - right.value;
+                address_count = left.address_count - right.address_count;
+                break;
+
+            default:
+                // Only symbols that aren't defined yet can make these fail,
+                // which is left until they are
+                if ((term.operation == '/' && right.value == 0) ||
+                    ((term.operation == '<' || term.operation == '>') && (right.value < 0 || right.value > 31)))
+                {
+                    if (unresolved.empty())
+                    {
+                        error = term.operation == '/' ? "it divides by zero" : "it shifts by " + std::to_string(right.value);
+                        return expression_status::error;
+                    }
+
+                    value = 0;
+                }
+                else if (term.operation == '*')
+                {
+                    value = (int64_t)left.value * right.value;
+                }
+                else if (term.operation == '/')
+                {
+                    // INT_MIN / -1 doesn't fit an int, and the range check catches it
+                    value = (int64_t)left.value / right.value;
+                }
+                else if (term.operation == '<')
+                {
+                    // Shifting a negative value left is undefined, an unsigned one isn't
+                    value = (int64_t)((uint64_t)(int64_t)left.value << right.value);
+                }
+                else if (term.operation == '>')
+                {
+                    value = left.value >> right.value;
+                }
+                else if (term.operation == '&')
+                {
+                    value = left.value & right.value;
+                }
+                else if (term.operation == '|')
+                {
+                    value = left.value | right.value;
+                }
+
+                relocatable = relocatable && left.address_count == 0 && right.address_count == 0;
+                break;
+            }
+
+            if (value > INT_MAX || value < INT_MIN)
+            {
+                error = "it's too big";
+                return expression_status::error;
+            }
+
+            left = { (int)value, address_count, relocatable };
+        }
+
+        if (stack.size() != 1)
+        {
+            error = "it's missing an operation";
+            return expression_status::error;
+        }
+
+        result = stack.back();
+        return unresolved.empty() ? expression_status::evaluated : expression_status::unresolved;
+    }
+} // namespace rc_assembler
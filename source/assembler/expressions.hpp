@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace rc_assembler
+{
+    // One step of an expression, in postfix order
+    struct expression_term
+    {
+        enum class term_kind
+        {
+            value,
+            symbol,
+            operation,
+        };
+
+        term_kind kind = term_kind::value;
+        int value = 0;
+        std::string symbol{};
+        // + - * / & | as themselves, < and > for the shifts, and n for negation
+        char operation = 0;
+    };
+
+    // What an expression came to. Addresses are counted so the result can be
+    // relocated: an address plus or minus constants is still one address,
+    // and the difference of two is a plain number. Anything else done to an
+    // address can't be relocated.
+    struct expression_value
+    {
+        int value = 0;
+        int address_count = 0;
+        bool relocatable = true;
+    };
+
+    enum class expression_status
+    {
+        evaluated,
+        // Some of the symbols aren't defined yet
+        unresolved,
+        error,
+    };
+
+    // Finds a symbol's value and whether it's an address, returning false if
+    // it isn't defined
+    typedef std::function<bool(const std::string &name, int &value, bool &is_address)> expression_symbol_lookup;
+
+    // Expressions are made of decimal and hex (0x) numbers, 'c' characters, symbols,
+    // sizeof(struct name), parentheses, negation and + - * / << >> & |, with
+    // the same precedence as C. On failure error says what was wrong.
+    bool parse_expression(const std::string &text, std::vector<expression_term> &terms, std::string &error);
+
+    // Symbols that aren't defined are added to unresolved, and count as 0
+    expression_status evaluate_expression(const std::vector<expression_term> &terms, const expression_symbol_lookup &lookup,
+        expression_value &result, std::vector<std::string> &unresolved, std::string &error);
+} // namespace rc_assembler
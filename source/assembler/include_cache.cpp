@@ -0,0 +1,536 @@
+#include "include_cache.hpp"
+#include "binary_stream.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include <boost/variant/static_visitor.hpp>
+
+namespace
+{
+    // Bump whenever parser_types.hpp or the layout below changes, so files
+    // cached by an older assembler are parsed again rather than misread
+    const uint32_t INCLUDE_CACHE_VERSION = 2;
+    const char INCLUDE_CACHE_MAGIC[8] = { 'R', 'C', 'I', 'N', 'C', 'L', 'U', 'D' };
+
+    // Written before each line, independent of the order of types in line_options
+    enum line_tag : uint8_t
+    {
+        TAG_INSTRUCTION,
+        TAG_RESERVATION,
+        TAG_BYTE_DEF,
+        TAG_BYTES,
+        TAG_WORD_DEF,
+        TAG_DATA_DEF,
+        TAG_END_DATA,
+        TAG_ORG,
+        TAG_LABEL,
+        TAG_INCLUDE,
+        TAG_STRUCT_DEF,
+        TAG_STRUCT_MEMBER,
+        TAG_END_STRUCT,
+        TAG_CONSTANT_DEF,
+    };
+
+    enum argument_tag : uint8_t
+    {
+        TAG_NO_ARGUMENT,
+        TAG_REGISTER_INDEX,
+        TAG_BYTE_VALUE,
+        TAG_WORD_VALUE,
+        TAG_INT_VALUE,
+        TAG_SYMBOL,
+        TAG_EXPRESSION,
+    };
+
+    class argument_writer : public boost::static_visitor<>
+    {
+    public:
+        argument_writer(binary_writer &writer) : writer(writer) {}
+
+        void operator()(const register_index_t &index)
+        {
+            writer.u8(TAG_REGISTER_INDEX);
+            writer.bytes(std::string(index.index_register->name));
+            writer.u8(index.is_pre_increment);
+            writer.u8((uint8_t)index.increment_amount);
+        }
+
+        void operator()(const uint8_t &value) { writer.u8(TAG_BYTE_VALUE); writer.u8(value); }
+        void operator()(const uint16_t &value) { writer.u8(TAG_WORD_VALUE); writer.u16(value); }
+        void operator()(const int &value) { writer.u8(TAG_INT_VALUE); writer.u32((uint32_t)value); }
+        void operator()(const rc_assembler::symbol &symbol) { writer.u8(TAG_SYMBOL); writer.bytes(symbol); }
+        void operator()(const rc_assembler::expression &expression) { writer.u8(TAG_EXPRESSION); writer.bytes(expression.text); }
+
+    private:
+        binary_writer &writer;
+    };
+
+    class line_writer : public boost::static_visitor<>
+    {
+    public:
+        line_writer(binary_writer &writer) : writer(writer) {}
+
+        void operator()(const rc_assembler::instruction_line &instruction)
+        {
+            writer.u8(TAG_INSTRUCTION);
+            writer.bytes(std::string(instruction.opcode->name));
+            if (instruction.argument.has_value())
+            {
+                argument_writer argument(writer);
+                boost::apply_visitor(argument, instruction.argument.value());
+            }
+            else
+            {
+                writer.u8(TAG_NO_ARGUMENT);
+            }
+        }
+
+        void operator()(const rc_assembler::reservation &reservation)
+        {
+            writer.u8(TAG_RESERVATION);
+            writer.bytes(reservation.symbol);
+            writer.u64(reservation.size);
+        }
+
+        void operator()(const rc_assembler::byte_def &def) { writer.u8(TAG_BYTE_DEF); writer.bytes(def.symbol); writer.u8(def.value); }
+        void operator()(const rc_assembler::byte_array &bytes) { writer.u8(TAG_BYTES); writer.bytes(bytes); }
+        void operator()(const rc_assembler::word_def &def) { writer.u8(TAG_WORD_DEF); writer.bytes(def.symbol); writer.u16(def.value); }
+
+        void operator()(const rc_assembler::data_def &def)
+        {
+            writer.u8(TAG_DATA_DEF);
+            writer.u8(def.symbol.has_value());
+            writer.bytes(def.symbol.value_or(""));
+            writer.bytes(def.bytes);
+        }
+
+        void operator()(const rc_assembler::end_data_def &def) { writer.u8(TAG_END_DATA); writer.bytes(def.contents); }
+        void operator()(const rc_assembler::org_def &def) { writer.u8(TAG_ORG); writer.u16(def.location); }
+        void operator()(const rc_assembler::label_def &def) { writer.u8(TAG_LABEL); writer.bytes(def.label_name); }
+        void operator()(const rc_assembler::include_def &def) { writer.u8(TAG_INCLUDE); writer.bytes(def.included_file); }
+        void operator()(const rc_assembler::struct_def &def) { writer.u8(TAG_STRUCT_DEF); writer.bytes(def.symbol); }
+        void operator()(const rc_assembler::struct_member_def &def) { writer.u8(TAG_STRUCT_MEMBER); writer.bytes(def.symbol); writer.u16(def.size); }
+        void operator()(const rc_assembler::end_struct_def &def) { writer.u8(TAG_END_STRUCT); writer.bytes(def.contents); }
+
+        void operator()(const rc_assembler::constant_def &def)
+        {
+            writer.u8(TAG_CONSTANT_DEF);
+            writer.u8((uint8_t)def.kind);
+            writer.bytes(def.symbol);
+            writer.bytes(def.value.text);
+        }
+
+    private:
+        binary_writer &writer;
+    };
+
+    bool read_argument(binary_reader &reader, std::optional<rc_assembler::instruction_argument> &argument)
+    {
+        uint8_t tag;
+        if (!reader.u8(tag))
+        {
+            return false;
+        }
+
+        switch (tag)
+        {
+        case TAG_NO_ARGUMENT:
+            return true;
+
+        case TAG_REGISTER_INDEX:
+        {
+            std::string name;
+            uint8_t is_pre_increment, increment_amount;
+            if (!reader.bytes(name) || !reader.u8(is_pre_increment) || !reader.u8(increment_amount))
+            {
+                return false;
+            }
+
+            auto index_register = get_register(name.c_str());
+            if (index_register == nullptr)
+            {
+                return false;
+            }
+
+            argument = register_index_t(index_register, is_pre_increment, (int8_t)increment_amount);
+            return true;
+        }
+
+        case TAG_BYTE_VALUE:
+        {
+            uint8_t value;
+            if (!reader.u8(value))
+            {
+                return false;
+            }
+
+            argument = value;
+            return true;
+        }
+
+        case TAG_WORD_VALUE:
+        {
+            uint16_t value;
+            if (!reader.u16(value))
+            {
+                return false;
+            }
+
+            argument = value;
+            return true;
+        }
+
+        case TAG_INT_VALUE:
+        {
+            uint32_t value;
+            if (!reader.u32(value))
+            {
+                return false;
+            }
+
+            argument = (int)value;
+            return true;
+        }
+
+        case TAG_SYMBOL:
+        {
+            rc_assembler::symbol symbol;
+            if (!reader.bytes(symbol))
+            {
+                return false;
+            }
+
+            argument = symbol;
+            return true;
+        }
+
+        case TAG_EXPRESSION:
+        {
+            rc_assembler::expression expression;
+            if (!reader.bytes(expression.text))
+            {
+                return false;
+            }
+
+            argument = expression;
+            return true;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    bool read_line(binary_reader &reader, rc_assembler::line_options &line)
+    {
+        uint8_t tag;
+        if (!reader.u8(tag))
+        {
+            return false;
+        }
+
+        switch (tag)
+        {
+        case TAG_INSTRUCTION:
+        {
+            rc_assembler::instruction_line instruction;
+            std::string name;
+            if (!reader.bytes(name) || !read_argument(reader, instruction.argument))
+            {
+                return false;
+            }
+
+            instruction.opcode = get_opcode_entry(name.c_str());
+            line = instruction;
+            return instruction.opcode != nullptr;
+        }
+
+        case TAG_RESERVATION:
+        {
+            rc_assembler::reservation reservation;
+            uint64_t size;
+            if (!reader.bytes(reservation.symbol) || !reader.u64(size))
+            {
+                return false;
+            }
+
+            reservation.size = (size_t)size;
+            line = reservation;
+            return true;
+        }
+
+        case TAG_BYTE_DEF:
+        {
+            rc_assembler::byte_def def;
+            bool ok = reader.bytes(def.symbol) && reader.u8(def.value);
+            line = def;
+            return ok;
+        }
+
+        case TAG_BYTES:
+        {
+            rc_assembler::byte_array bytes;
+            bool ok = reader.bytes(bytes);
+            line = bytes;
+            return ok;
+        }
+
+        case TAG_WORD_DEF:
+        {
+            rc_assembler::word_def def;
+            bool ok = reader.bytes(def.symbol) && reader.u16(def.value);
+            line = def;
+            return ok;
+        }
+
+        case TAG_DATA_DEF:
+        {
+            rc_assembler::data_def def;
+            uint8_t has_symbol;
+            std::string symbol;
+            if (!reader.u8(has_symbol) || !reader.bytes(symbol) || !reader.bytes(def.bytes))
+            {
+                return false;
+            }
+
+            if (has_symbol)
+            {
+                def.symbol = symbol;
+            }
+            line = def;
+            return true;
+        }
+
+        case TAG_END_DATA:
+        {
+            rc_assembler::end_data_def def;
+            bool ok = reader.bytes(def.contents);
+            line = def;
+            return ok;
+        }
+
+        case TAG_ORG:
+        {
+            rc_assembler::org_def def;
+            bool ok = reader.u16(def.location);
+            line = def;
+            return ok;
+        }
+
+        case TAG_LABEL:
+        {
+            rc_assembler::label_def def;
+            bool ok = reader.bytes(def.label_name);
+            line = def;
+            return ok;
+        }
+
+        case TAG_INCLUDE:
+        {
+            rc_assembler::include_def def;
+            bool ok = reader.bytes(def.included_file);
+            line = def;
+            return ok;
+        }
+
+        case TAG_STRUCT_DEF:
+        {
+            rc_assembler::struct_def def;
+            bool ok = reader.bytes(def.symbol);
+            line = def;
+            return ok;
+        }
+
+        case TAG_STRUCT_MEMBER:
+        {
+            rc_assembler::struct_member_def def;
+            bool ok = reader.bytes(def.symbol) && reader.u16(def.size);
+            line = def;
+            return ok;
+        }
+
+        case TAG_END_STRUCT:
+        {
+            rc_assembler::end_struct_def def;
+            bool ok = reader.bytes(def.contents);
+            line = def;
+            return ok;
+        }
+
+        case TAG_CONSTANT_DEF:
+        {
+            rc_assembler::constant_def def;
+            uint8_t kind;
+            if (!reader.u8(kind) || kind > (uint8_t)rc_assembler::constant_kind::reserve ||
+                !reader.bytes(def.symbol) || !reader.bytes(def.value.text))
+            {
+                return false;
+            }
+
+            def.kind = (rc_assembler::constant_kind)kind;
+            line = def;
+            return true;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+} // namespace
+
+bool get_source_stamp(const char *path, std::string &canonical_path, source_stamp_t &stamp)
+{
+    std::error_code error;
+    auto canonical = std::filesystem::canonical(path, error);
+    if (error)
+    {
+        return false;
+    }
+
+    auto modified = std::filesystem::last_write_time(canonical, error);
+    if (error)
+    {
+        return false;
+    }
+
+    auto size = std::filesystem::file_size(canonical, error);
+    if (error)
+    {
+        return false;
+    }
+
+    canonical_path = canonical.string();
+    stamp.modified = (int64_t)modified.time_since_epoch().count();
+    stamp.size = size;
+
+    return true;
+}
+
+include_cache::include_cache(const char *cache_directory)
+{
+    if (cache_directory != nullptr)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(cache_directory, error);
+        this->cache_directory = cache_directory;
+    }
+}
+
+std::shared_ptr<const parsed_file_t> include_cache::find(const std::string &canonical_path, const source_stamp_t &stamp)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = files.find(canonical_path);
+        if (it != files.end() && it->second->stamp == stamp)
+        {
+            return it->second;
+        }
+    }
+
+    if (cache_directory.empty())
+    {
+        return nullptr;
+    }
+
+    auto parsed_file = load(canonical_path, stamp);
+    if (parsed_file != nullptr)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        files[canonical_path] = parsed_file;
+    }
+
+    return parsed_file;
+}
+
+void include_cache::store(const std::string &canonical_path, std::shared_ptr<const parsed_file_t> parsed_file)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        files[canonical_path] = parsed_file;
+    }
+
+    if (!cache_directory.empty())
+    {
+        save(canonical_path, *parsed_file);
+    }
+}
+
+std::string include_cache::cache_file_path(const std::string &canonical_path) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rcinc", (unsigned long long)hash_bytes(canonical_path.data(), canonical_path.size()));
+    return (std::filesystem::path(cache_directory) / name).string();
+}
+
+std::shared_ptr<const parsed_file_t> include_cache::load(const std::string &canonical_path, const source_stamp_t &stamp) const
+{
+    std::vector<uint8_t> buffer;
+    if (!read_binary_file(cache_file_path(canonical_path).c_str(), buffer))
+    {
+        return nullptr;
+    }
+
+    // Anything that doesn't match exactly is treated as not cached
+    binary_reader reader(buffer);
+    std::vector<uint8_t> magic;
+    uint32_t version, line_count;
+    uint64_t modified, size;
+    std::string cached_path;
+    if (!reader.bytes(magic) || magic.size() != sizeof(INCLUDE_CACHE_MAGIC) || memcmp(magic.data(), INCLUDE_CACHE_MAGIC, sizeof(INCLUDE_CACHE_MAGIC)) != 0 ||
+        !reader.u32(version) || version != INCLUDE_CACHE_VERSION ||
+        !reader.bytes(cached_path) || cached_path != canonical_path ||
+        !reader.u64(modified) || (int64_t)modified != stamp.modified ||
+        !reader.u64(size) || size != stamp.size ||
+        !reader.u32(line_count))
+    {
+        return nullptr;
+    }
+
+    auto parsed_file = std::make_shared<parsed_file_t>();
+    parsed_file->stamp = stamp;
+    parsed_file->lines.reserve(std::min<size_t>(line_count, buffer.size()));
+    for (uint32_t i = 0; i < line_count; i++)
+    {
+        uint32_t line_number;
+        rc_assembler::line_options line;
+        if (!reader.u32(line_number) || !read_line(reader, line))
+        {
+            return nullptr;
+        }
+
+        parsed_file->lines.push_back({ (int)line_number, std::move(line) });
+    }
+
+    if (!reader.at_end())
+    {
+        return nullptr;
+    }
+
+    return parsed_file;
+}
+
+void include_cache::save(const std::string &canonical_path, const parsed_file_t &parsed_file) const
+{
+    binary_writer writer;
+    writer.bytes(std::string(INCLUDE_CACHE_MAGIC, sizeof(INCLUDE_CACHE_MAGIC)));
+    writer.u32(INCLUDE_CACHE_VERSION);
+    writer.bytes(canonical_path);
+    writer.u64((uint64_t)parsed_file.stamp.modified);
+    writer.u64(parsed_file.stamp.size);
+    writer.u32((uint32_t)parsed_file.lines.size());
+
+    line_writer line(writer);
+    for (auto &parsed_line : parsed_file.lines)
+    {
+        writer.u32((uint32_t)parsed_line.line_number);
+        boost::apply_visitor(line, parsed_line.line);
+    }
+
+    // Other assemblers may be reading the cache at the same time
+    write_binary_file_atomically(cache_file_path(canonical_path), writer.buffer);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "parser_types.hpp"
+
+// Identifies one version of a source file
+struct source_stamp_t
+{
+    int64_t modified = 0;
+    uint64_t size = 0;
+
+    bool operator==(const source_stamp_t &other) const { return modified == other.modified && size == other.size; }
+};
+
+// A line of an include file that parsed to something other than a comment
+struct parsed_line_t
+{
+    int line_number;
+    rc_assembler::line_options line;
+};
+
+struct parsed_file_t
+{
+    source_stamp_t stamp{};
+    std::vector<parsed_line_t> lines{};
+};
+
+// Include files that have already been parsed, so a file shared by many
+// programs is only parsed once. One cache can be shared by assemblies on
+// different threads. Given a directory, parsed files are saved there too,
+// for assembler runs that come later.
+class include_cache
+{
+public:
+    include_cache(const char *cache_directory = nullptr);
+
+    // Returns nothing if the file isn't cached or has changed since it was
+    std::shared_ptr<const parsed_file_t> find(const std::string &canonical_path, const source_stamp_t &stamp);
+    void store(const std::string &canonical_path, std::shared_ptr<const parsed_file_t> parsed_file);
+
+private:
+    std::string cache_file_path(const std::string &canonical_path) const;
+    std::shared_ptr<const parsed_file_t> load(const std::string &canonical_path, const source_stamp_t &stamp) const;
+    void save(const std::string &canonical_path, const parsed_file_t &parsed_file) const;
+
+    std::mutex lock;
+    std::map<std::string, std::shared_ptr<const parsed_file_t>> files;
+    std::string cache_directory;
+};
+
+// Gets the canonical path and stamp used to look a file up in the cache
+bool get_source_stamp(const char *path, std::string &canonical_path, source_stamp_t &stamp);
@@ -0,0 +1,350 @@
+#include "line_lexer.hpp"
+
+#include <limits.h>
+#include <string.h>
+
+namespace
+{
+    // The same characters as ascii::space, which the grammar skips
+    bool is_space(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    bool is_alpha(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Characters after the first in symbol_rule
+    bool is_symbol_char(char c)
+    {
+        return is_alpha(c) || is_digit(c) || c == '.' || c == '(' || c == ')' || c == '_';
+    }
+
+    int hex_digit_value(char c)
+    {
+        if (is_digit(c))
+        {
+            return c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+
+        return -1;
+    }
+
+    char to_lower(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    void skip_spaces(const char *&position, const char *last)
+    {
+        while (position != last && is_space(*position))
+        {
+            position++;
+        }
+    }
+
+    // Matches increment_rule, returning 0 if there isn't one
+    int lex_increment(const char *&position, const char *last)
+    {
+        if (position == last || (*position != '+' && *position != '-'))
+        {
+            return 0;
+        }
+
+        int direction = *position == '+' ? 1 : -1;
+        position++;
+        if (position != last && *position == position[-1])
+        {
+            position++;
+            return direction * 2;
+        }
+
+        return direction;
+    }
+
+    // The comment, if any, that ends a line
+    rc_assembler::lex_result lex_comment(const char *position, const char *last, rc_assembler::assembly_line &line)
+    {
+        if (position == last)
+        {
+            return rc_assembler::lex_result::parsed;
+        }
+        else if (*position != ';')
+        {
+            return rc_assembler::lex_result::unhandled;
+        }
+
+        // The grammar's skipper drops the spaces from comments
+        std::string comment;
+        comment.reserve(last - position);
+        for (position++; position != last; position++)
+        {
+            if (*position & 0x80)
+            {
+                return rc_assembler::lex_result::unhandled;
+            }
+            else if (!is_space(*position))
+            {
+                comment.push_back(*position);
+            }
+        }
+
+        line.comment = std::move(comment);
+        return rc_assembler::lex_result::parsed;
+    }
+} // namespace
+
+namespace rc_assembler
+{
+    line_lexer::line_lexer()
+    {
+        // Like the grammar's symbol tables, the first entry with a name wins
+        int opcode_count = opcode_entry_count();
+        for (int i = 0; i < opcode_count; i++)
+        {
+            opcode_entry_t *opcode = get_opcode_entry_by_index(i);
+            if (opcode != nullptr)
+            {
+                opcodes.emplace(opcode->name, opcode);
+            }
+        }
+
+        int register_entry_count = register_count();
+        for (int i = 0; i < register_entry_count; i++)
+        {
+            registers.push_back(get_register_by_index(i));
+        }
+    }
+
+    lex_result line_lexer::lex_line(const char *first, const char *last, assembly_line &line) const
+    {
+        line = assembly_line{};
+
+        auto position = first;
+        skip_spaces(position, last);
+        if (position == last)
+        {
+            // Neither a line nor a comment, which the grammar doesn't accept
+            return lex_result::failed;
+        }
+        else if (*position == ';')
+        {
+            return lex_comment(position, last, line);
+        }
+        else if (!is_alpha(*position))
+        {
+            return lex_result::unhandled;
+        }
+
+        auto token_start = position;
+        while (position != last && is_symbol_char(*position))
+        {
+            position++;
+        }
+
+        auto token_end = position;
+        for (auto c = token_start; c != token_end; c++)
+        {
+            // The grammar can match an opcode up to a bracket, like add(
+            if (*c == '(' || *c == ')')
+            {
+                return lex_result::unhandled;
+            }
+        }
+
+        skip_spaces(position, last);
+        auto opcode = find_opcode(token_start, token_end);
+        if (opcode != nullptr)
+        {
+            instruction_line instruction;
+            instruction.opcode = opcode;
+            if (position != last && *position != ';')
+            {
+                instruction_argument argument;
+                if (!lex_argument(position, last, argument))
+                {
+                    return lex_result::unhandled;
+                }
+
+                instruction.argument = std::move(argument);
+                skip_spaces(position, last);
+            }
+
+            line.line_options = std::move(instruction);
+        }
+        else
+        {
+            if (position == last || *position != ':')
+            {
+                return lex_result::unhandled;
+            }
+
+            position++;
+            skip_spaces(position, last);
+            line.line_options = label_def{ symbol(token_start, token_end) };
+        }
+
+        return lex_comment(position, last, line);
+    }
+
+    const opcode_entry_t *line_lexer::find_opcode(const char *first, const char *last) const
+    {
+        std::string name(first, last);
+        for (auto &c : name)
+        {
+            c = to_lower(c);
+        }
+
+        auto found = opcodes.find(name);
+        return found != opcodes.end() ? found->second : nullptr;
+    }
+
+    // Tries the alternatives of instruction_argument_rule in the same order
+    bool line_lexer::lex_argument(const char *&position, const char *last, instruction_argument &argument) const
+    {
+        char c = *position;
+        if (is_alpha(c))
+        {
+            auto symbol_start = position;
+            while (position != last && is_symbol_char(*position))
+            {
+                position++;
+            }
+
+            argument = symbol(symbol_start, position);
+            return true;
+        }
+        else if (c == '0' && last - position > 2 && (position[1] == 'x' || position[1] == 'X'))
+        {
+            // hex_word_lit takes at most four digits, leaving any more behind
+            auto digits = position + 2;
+            auto digits_end = digits;
+            int value = 0;
+            while (digits_end != last && digits_end - digits < 4 && hex_digit_value(*digits_end) >= 0)
+            {
+                value = value * 16 + hex_digit_value(*digits_end);
+                digits_end++;
+            }
+
+            if (digits_end == digits)
+            {
+                return false;
+            }
+
+            position = digits_end;
+            argument = (uint16_t)value;
+            return true;
+        }
+        else if (c == '+' || c == '-' || is_digit(c))
+        {
+            auto digit = position + ((c == '+' || c == '-') ? 1 : 0);
+            if (digit == last || !is_digit(*digit))
+            {
+                return false;
+            }
+
+            // int_ fails rather than wrapping
+            int64_t value = 0;
+            for (; digit != last && is_digit(*digit); digit++)
+            {
+                value = value * 10 + (*digit - '0');
+                if (value > (int64_t)INT_MAX + 1)
+                {
+                    return false;
+                }
+            }
+
+            value = c == '-' ? -value : value;
+            if (value > INT_MAX)
+            {
+                return false;
+            }
+
+            position = digit;
+            argument = (int)value;
+            return true;
+        }
+        else if (c == '[')
+        {
+            register_index_t index;
+            if (!lex_register_index(position, last, index))
+            {
+                return false;
+            }
+
+            argument = index;
+            return true;
+        }
+
+        return false;
+    }
+
+    // [register], [increment register] or [register increment]
+    bool line_lexer::lex_register_index(const char *&position, const char *last, register_index_t &index) const
+    {
+        auto current = position + 1;
+        skip_spaces(current, last);
+        int pre_increment = lex_increment(current, last);
+        skip_spaces(current, last);
+
+        // The longest name that matches, as qi::symbols would find
+        register_argument_t *index_register = nullptr;
+        size_t matched_length = 0;
+        for (auto candidate : registers)
+        {
+            size_t length = strlen(candidate->name);
+            if (length <= matched_length || (size_t)(last - current) < length)
+            {
+                continue;
+            }
+
+            size_t i = 0;
+            while (i < length && to_lower(current[i]) == candidate->name[i])
+            {
+                i++;
+            }
+
+            if (i == length)
+            {
+                index_register = candidate;
+                matched_length = length;
+            }
+        }
+
+        if (index_register == nullptr)
+        {
+            return false;
+        }
+
+        current += matched_length;
+        skip_spaces(current, last);
+        int post_increment = pre_increment == 0 ? lex_increment(current, last) : 0;
+        skip_spaces(current, last);
+        if (current == last || *current != ']')
+        {
+            return false;
+        }
+
+        position = current + 1;
+        index.index_register = index_register;
+        index.is_pre_increment = pre_increment != 0 ? 1 : 0;
+        index.increment_amount = pre_increment != 0 ? pre_increment : post_increment;
+
+        return true;
+    }
+} // namespace rc_assembler
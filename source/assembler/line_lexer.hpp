@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser_types.hpp"
+
+namespace rc_assembler
+{
+    enum class lex_result
+    {
+        // line holds the parsed line
+        parsed,
+        // The grammar would reject the line too
+        failed,
+        // Not a shape the lexer knows, so it's up to the grammar
+        unhandled,
+    };
+
+    // Picks apart the lines most of a program is made of without going through
+    // assembler_grammar, which tries every alternative of line_options in turn:
+    // - a label, `name:`
+    // - an instruction with an optional symbol, literal or register index
+    // - a comment on its own, or after either of those
+    // - a line with only spaces on it
+    // Anything else, like directives, data and lines the grammar would only
+    // partly match, is left unhandled. Whatever is parsed is the same
+    // assembly_line the grammar would produce.
+    class line_lexer
+    {
+    public:
+        line_lexer();
+
+        lex_result lex_line(const char *first, const char *last, assembly_line &line) const;
+
+    private:
+        const opcode_entry_t *find_opcode(const char *first, const char *last) const;
+        bool lex_argument(const char *&position, const char *last, instruction_argument &argument) const;
+        bool lex_register_index(const char *&position, const char *last, register_index_t &index) const;
+
+        // Keyed by the names in the opcode table, which are all lower case
+        std::unordered_map<std::string, opcode_entry_t*> opcodes;
+        std::vector<register_argument_t*> registers;
+    };
+} // namespace rc_assembler
@@ -0,0 +1,604 @@
+#include "macros.hpp"
+#include "assembler_parser.hpp"
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+
+namespace
+{
+    // Stops a macro that invokes itself from going on forever
+    const int MAX_EXPANSION_DEPTH = 64;
+    // The most an indexed push or pull can move its register by, either way
+    const int MAX_INDEX_INCREMENT = 63;
+
+    bool is_identifier_char(char c)
+    {
+        return isalnum((unsigned char)c) || c == '_';
+    }
+
+    const char* skip_space(const char* position, const char* end)
+    {
+        while (position < end && isspace((unsigned char)*position))
+        {
+            position++;
+        }
+
+        return position;
+    }
+
+    const char* identifier_end(const char* position, const char* end)
+    {
+        while (position < end && is_identifier_char(*position))
+        {
+            position++;
+        }
+
+        return position;
+    }
+
+    // Where the comment on a line starts, or end if there isn't one
+    const char* find_comment(const char* position, const char* end)
+    {
+        bool quoted = false;
+        for (; position < end; position++)
+        {
+            if (quoted && *position == '\\' && position + 1 < end)
+            {
+                position++;
+            }
+            else if (*position == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (!quoted && *position == ';')
+            {
+                break;
+            }
+        }
+
+        return position;
+    }
+
+    bool is_directive(const char* position, const char* end, const char* directive)
+    {
+        size_t length = strlen(directive);
+        return (size_t)(end - position) >= length && strncmp(position, directive, length) == 0 &&
+            (position + length == end || !is_identifier_char(position[length]));
+    }
+
+    std::string lowercase(const char* start, const char* end)
+    {
+        std::string lowered(start, end);
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return (char)tolower(c); });
+        return lowered;
+    }
+
+    std::string trim(const char* start, const char* end)
+    {
+        start = skip_space(start, end);
+        while (end > start && isspace((unsigned char)end[-1]))
+        {
+            end--;
+        }
+
+        return std::string(start, end);
+    }
+} // namespace
+
+macro_handler::macro_handler(assembler_data_t* data, const rc_assembler::assembler_grammar<const char*>& parser) : data(data), parser(parser)
+{
+
+}
+
+macro_line_result macro_handler::handle_line(const char* line_start, const char* line_end, parsed_file_t* parsed_file)
+{
+    auto position = skip_space(line_start, line_end);
+    if (defining)
+    {
+        if (is_directive(position, line_end, ".endmacro"))
+        {
+            end_definition();
+        }
+        else if (is_directive(position, line_end, ".macro"))
+        {
+            add_error(data, "Macro " + defining_name + " can't define another macro inside it", assembler_status::SYNTAX_ERROR);
+            return macro_line_result::error;
+        }
+        else
+        {
+            defining_lines.emplace_back(line_start, line_end);
+        }
+
+        return macro_line_result::handled;
+    }
+
+    if (position == line_end)
+    {
+        return macro_line_result::not_macro;
+    }
+
+    if (*position == '.')
+    {
+        if (is_directive(position, line_end, ".macro"))
+        {
+            return begin_definition(position, line_end);
+        }
+        else if (is_directive(position, line_end, ".endmacro"))
+        {
+            add_error(data, ".endmacro without a .macro before it", assembler_status::SYNTAX_ERROR);
+            return macro_line_result::error;
+        }
+
+        return macro_line_result::not_macro;
+    }
+
+    if (!isalpha((unsigned char)*position))
+    {
+        return macro_line_result::not_macro;
+    }
+
+    auto name_end = identifier_end(position, line_end);
+    size_t name_length = name_end - position;
+    if ((name_length == 3 || (name_length == 4 && tolower((unsigned char)position[3]) == 'w')) &&
+        (strncasecmp(position, "set", 3) == 0 || strncasecmp(position, "get", 3) == 0))
+    {
+        return expand_index_macro(position, line_end, parsed_file);
+    }
+
+    // Anything else that isn't followed by a space could still be a label
+    if (macros.empty() || (name_end < line_end && !isspace((unsigned char)*name_end) && *name_end != ';'))
+    {
+        return macro_line_result::not_macro;
+    }
+
+    auto macro = macros.find(lowercase(position, name_end));
+    if (macro == macros.end())
+    {
+        return macro_line_result::not_macro;
+    }
+
+    return expand_macro(macro->second, name_end, line_end);
+}
+
+void macro_handler::end_file()
+{
+    if (defining && defining_file_depth == current_file_depth(data))
+    {
+        add_error(data, "Macro " + defining_name + " isn't finished with .endmacro", assembler_status::SYNTAX_ERROR);
+        defining = false;
+        defining_lines.clear();
+    }
+}
+
+macro_line_result macro_handler::begin_definition(const char* line_start, const char* line_end)
+{
+    char message[ERROR_BUFFER_SIZE];
+    rc_assembler::macro_def def;
+    auto first = line_start;
+    auto last = find_comment(line_start, line_end);
+    if (!rc_assembler::qi::phrase_parse(first, last, parser.macro_def_rule, rc_assembler::ascii::space, def) || first != last)
+    {
+        add_error(data, "Badly formed macro definition: " + std::string(line_start, line_end), assembler_status::SYNTAX_ERROR);
+        return macro_line_result::error;
+    }
+
+    auto name = lowercase(def.name.data(), def.name.data() + def.name.size());
+    const char* problem = nullptr;
+    if (identifier_end(def.name.data(), def.name.data() + def.name.size()) != def.name.data() + def.name.size())
+    {
+        problem = "can only have letters, digits and underscores in its name";
+    }
+    else if (get_opcode_entry(name.c_str()) != nullptr || name == "set" || name == "setw" || name == "get" || name == "getw")
+    {
+        problem = "has the same name as an instruction";
+    }
+    else if (macros.find(name) != macros.end())
+    {
+        problem = "is already defined";
+    }
+
+    defining_parameters.clear();
+    for (auto& parameter : def.parameters)
+    {
+        auto parameter_name = lowercase(parameter.data(), parameter.data() + parameter.size());
+        if (std::find(defining_parameters.begin(), defining_parameters.end(), parameter_name) != defining_parameters.end())
+        {
+            problem = "has two parameters with the same name";
+        }
+        defining_parameters.push_back(parameter_name);
+    }
+
+    // A bad definition still has its body skipped, so it's only reported once
+    defining = true;
+    defining_is_valid = problem == nullptr;
+    defining_file_depth = current_file_depth(data);
+    defining_name = def.name;
+    defining_lines.clear();
+
+    if (problem != nullptr)
+    {
+        snprintf(message, sizeof(message), "Macro %s %s", def.name.c_str(), problem);
+        add_error(data, message, assembler_status::SYNTAX_ERROR);
+        return macro_line_result::error;
+    }
+
+    return macro_line_result::handled;
+}
+
+void macro_handler::end_definition()
+{
+    if (!defining_is_valid)
+    {
+        defining = false;
+        defining_lines.clear();
+        return;
+    }
+
+    macro_t macro;
+    macro.name = defining_name;
+    macro.parameter_count = defining_parameters.size();
+
+    // Labels defined in the body are renamed in every expansion, so a macro
+    // can be used more than once
+    std::unordered_set<std::string> labels;
+    for (auto& line : defining_lines)
+    {
+        const char* end = line.data() + line.size();
+        auto position = skip_space(line.data(), end);
+        if (position < end && isalpha((unsigned char)*position))
+        {
+            auto name_end = identifier_end(position, end);
+            auto after = skip_space(name_end, end);
+            auto name = lowercase(position, name_end);
+            if (after < end && *after == ':' && std::find(defining_parameters.begin(), defining_parameters.end(), name) == defining_parameters.end())
+            {
+                labels.insert(name);
+            }
+        }
+    }
+
+    macro.has_local_labels = !labels.empty();
+    for (auto& line : defining_lines)
+    {
+        std::vector<macro_piece_t> pieces;
+        std::string text;
+        auto flush = [&]()
+        {
+            if (!text.empty())
+            {
+                pieces.push_back({ macro_piece_t::piece_kind::text, std::move(text), 0 });
+                text.clear();
+            }
+        };
+
+        const char* start = line.data();
+        const char* end = start + line.size();
+        auto position = start;
+        while (position < end && *position != ';')
+        {
+            const char* token_end = position + 1;
+            if (*position == '"')
+            {
+                while (token_end < end && *token_end != '"')
+                {
+                    token_end += (*token_end == '\\' && token_end + 1 < end) ? 2 : 1;
+                }
+                token_end = std::min(token_end + 1, end);
+            }
+            else if (isdigit((unsigned char)*position))
+            {
+                token_end = identifier_end(position, end);
+            }
+            else if (isalpha((unsigned char)*position))
+            {
+                token_end = identifier_end(position, end);
+
+                // Directives and struct members come after a '.', and are left alone
+                if (position == start || position[-1] != '.')
+                {
+                    auto name = lowercase(position, token_end);
+                    auto parameter = std::find(defining_parameters.begin(), defining_parameters.end(), name);
+                    if (parameter != defining_parameters.end())
+                    {
+                        flush();
+                        pieces.push_back({ macro_piece_t::piece_kind::parameter, std::string(), (size_t)(parameter - defining_parameters.begin()) });
+                        position = token_end;
+                        continue;
+                    }
+                    else if (labels.count(name) > 0)
+                    {
+                        flush();
+                        pieces.push_back({ macro_piece_t::piece_kind::local_label, std::string(position, token_end), 0 });
+                        position = token_end;
+                        continue;
+                    }
+                }
+            }
+
+            text.append(position, token_end);
+            position = token_end;
+        }
+
+        flush();
+        if (!pieces.empty())
+        {
+            macro.lines.push_back(std::move(pieces));
+        }
+    }
+
+    macros.emplace(lowercase(defining_name.data(), defining_name.data() + defining_name.size()), std::move(macro));
+    defining = false;
+    defining_lines.clear();
+}
+
+macro_line_result macro_handler::expand_macro(const macro_t& macro, const char* arguments_start, const char* line_end)
+{
+    char message[ERROR_BUFFER_SIZE];
+    // Arguments are split on commas, except inside brackets or strings
+    std::vector<std::string> arguments;
+    auto arguments_end = find_comment(arguments_start, line_end);
+    auto argument_start = skip_space(arguments_start, arguments_end);
+    if (argument_start < arguments_end)
+    {
+        int bracket_depth = 0;
+        bool quoted = false;
+        for (auto position = argument_start; ; position++)
+        {
+            if (position == arguments_end || (*position == ',' && bracket_depth == 0 && !quoted))
+            {
+                arguments.push_back(trim(argument_start, position));
+                if (arguments.back().empty())
+                {
+                    snprintf(message, sizeof(message), "Macro %s was given an empty argument", macro.name.c_str());
+                    add_error(data, message, assembler_status::SYNTAX_ERROR);
+                    return macro_line_result::error;
+                }
+
+                if (position == arguments_end)
+                {
+                    break;
+                }
+
+                argument_start = position + 1;
+            }
+            else if (quoted && *position == '\\' && position + 1 < arguments_end)
+            {
+                position++;
+            }
+            else if (*position == '"')
+            {
+                quoted = !quoted;
+            }
+            else if (!quoted && (*position == '[' || *position == '('))
+            {
+                bracket_depth++;
+            }
+            else if (!quoted && (*position == ']' || *position == ')'))
+            {
+                bracket_depth--;
+            }
+        }
+    }
+
+    if (arguments.size() != macro.parameter_count)
+    {
+        snprintf(message, sizeof(message), "Macro %s takes %d argument(s), but was given %d", macro.name.c_str(), (int)macro.parameter_count, (int)arguments.size());
+        add_error(data, message, assembler_status::SYNTAX_ERROR);
+        return macro_line_result::error;
+    }
+
+    if (expansion_depth >= MAX_EXPANSION_DEPTH)
+    {
+        snprintf(message, sizeof(message), "Macros are nested too deeply expanding %s, does it use itself?", macro.name.c_str());
+        add_error(data, message, assembler_status::SYNTAX_ERROR);
+        return macro_line_result::error;
+    }
+
+    std::string label_suffix;
+    if (macro.has_local_labels)
+    {
+        label_suffix = "._" + std::to_string(++expansion_count);
+    }
+
+    expansion_depth++;
+    std::string line;
+    for (auto& pieces : macro.lines)
+    {
+        line.clear();
+        for (auto& piece : pieces)
+        {
+            switch (piece.kind)
+            {
+            case macro_piece_t::piece_kind::text:
+                line += piece.text;
+                break;
+
+            case macro_piece_t::piece_kind::parameter:
+                line += arguments[piece.parameter];
+                break;
+
+            case macro_piece_t::piece_kind::local_label:
+                line += piece.text;
+                line += label_suffix;
+                break;
+            }
+        }
+
+        // Expanded lines aren't cached, the macro could be different next time
+        parse_assembly_line(data, line.data(), line.data() + line.size(), nullptr);
+    }
+    expansion_depth--;
+
+    return macro_line_result::handled;
+}
+
+bool macro_handler::constant_offset(const rc_assembler::instruction_argument& offset, int& value, bool& used_symbol)
+{
+    if (auto byte_value = boost::get<uint8_t>(&offset))
+    {
+        value = *byte_value;
+    }
+    else if (auto word_value = boost::get<uint16_t>(&offset))
+    {
+        value = *word_value;
+    }
+    else if (auto int_value = boost::get<int>(&offset))
+    {
+        value = *int_value;
+    }
+    else if (auto symbol = boost::get<rc_assembler::symbol>(&offset))
+    {
+        if (!find_constant_symbol(data, symbol->c_str(), value))
+        {
+            return false;
+        }
+
+        used_symbol = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+macro_line_result macro_handler::expand_index_macro(const char* line_start, const char* line_end, parsed_file_t* parsed_file)
+{
+    char message[ERROR_BUFFER_SIZE];
+    rc_assembler::index_macro macro;
+    auto first = line_start;
+    auto last = find_comment(line_start, line_end);
+    if (!rc_assembler::qi::phrase_parse(first, last, parser.index_macro_rule, rc_assembler::ascii::space, macro) || first != last)
+    {
+        // Could be a label called set or get, the grammar can sort it out
+        return macro_line_result::not_macro;
+    }
+
+    if (in_unused_code(data))
+    {
+        // Nothing it expands to would be assembled, and the symbols it uses
+        // might not be defined. The line still isn't cached as expanded.
+        return macro_line_result::handled;
+    }
+
+    bool is_set = macro.kind == rc_assembler::index_macro_kind::set || macro.kind == rc_assembler::index_macro_kind::setw;
+    bool is_wide = macro.kind == rc_assembler::index_macro_kind::setw || macro.kind == rc_assembler::index_macro_kind::getw;
+    if (is_set != macro.value.has_value())
+    {
+        add_error(data, is_set ? "set needs a value to store" : "get doesn't take a value, only an index", assembler_status::SYNTAX_ERROR);
+        return macro_line_result::error;
+    }
+
+    bool is_x = macro.index_register->code == OP_STACK_AND_X;
+    int offset = 0;
+    bool used_symbol = false;
+    bool is_constant = constant_offset(macro.offset, offset, used_symbol);
+    if (!is_x && !is_constant)
+    {
+        // A forward reference could turn out to be a word, which pushi can't take
+        add_error(data, "An index into dp has to be a number or a symbol defined before it's used", assembler_status::SYMBOL_ERROR);
+        return macro_line_result::error;
+    }
+    else if (!is_x && (offset < -128 || offset > 255))
+    {
+        snprintf(message, sizeof(message), "Index %d is too big to add to dp", offset);
+        add_error(data, message, assembler_status::VALUE_OOB);
+        return macro_line_result::error;
+    }
+
+    std::vector<rc_assembler::instruction_line> lines;
+    auto add = [&lines](const char* name, std::optional<rc_assembler::instruction_argument> argument = std::nullopt)
+    {
+        lines.push_back({ get_opcode_entry(name), argument });
+    };
+    auto indexed = [&macro](bool is_pre_increment, int amount)
+    {
+        return rc_assembler::instruction_argument(register_index_t(macro.index_register, is_pre_increment, (int8_t)amount));
+    };
+
+    const char* value_push = is_wide ? "pushiw" : "pushi";
+    const char* indexed_pull = is_wide ? "pullw" : "pull";
+    const char* indexed_push = is_wide ? "pushw" : "push";
+    if (is_constant && offset == 0)
+    {
+        if (is_set)
+        {
+            add(value_push, macro.value);
+            add(indexed_pull, indexed(false, 0));
+        }
+        else
+        {
+            add(indexed_push, indexed(false, 0));
+        }
+    }
+    else if (is_constant && offset >= -MAX_INDEX_INCREMENT && offset <= MAX_INDEX_INCREMENT)
+    {
+        if (is_set)
+        {
+            add(value_push, macro.value);
+            add(indexed_pull, indexed(true, offset));
+        }
+        else
+        {
+            add(indexed_push, indexed(true, offset));
+        }
+
+        // Moving the register back costs a byte read, but no arithmetic
+        add("push", indexed(false, -offset));
+        add("pop");
+    }
+    else
+    {
+        // Symbols that aren't defined yet are left for the assembler to resolve
+        auto offset_argument = is_constant ? rc_assembler::instruction_argument(offset) : macro.offset;
+        const char* register_push = is_x ? "pushx" : "pushdp";
+        const char* register_pull = is_x ? "pullx" : "pulldp";
+        const char* offset_push = is_x ? "pushiw" : "pushi";
+        const char* add_offset = is_x ? "addw" : "add";
+        if (is_set)
+        {
+            add(register_push);
+            add(is_x ? "dupw" : "dup");
+            add(offset_push, offset_argument);
+            add(add_offset);
+            add(register_pull);
+            add(value_push, macro.value);
+            add(indexed_pull, indexed(false, 0));
+            add(register_pull);
+        }
+        else if (is_wide == is_x)
+        {
+            // The value and the saved register are the same size, so they can be swapped
+            add(register_push);
+            add(is_x ? "dupw" : "dup");
+            add(offset_push, offset_argument);
+            add(add_offset);
+            add(register_pull);
+            add(indexed_push, indexed(false, 0));
+            add(is_x ? "swapw" : "swap");
+            add(register_pull);
+        }
+        else
+        {
+            add(register_push);
+            add(offset_push, offset_argument);
+            add(add_offset);
+            add(register_pull);
+            add(indexed_push, indexed(false, 0));
+            add(register_push);
+            add(offset_push, offset_argument);
+            add(is_x ? "subw" : "sub");
+            add(register_pull);
+        }
+    }
+
+    for (auto& line : lines)
+    {
+        handle_parsed_line(data, line, parsed_file);
+    }
+
+    return used_symbol ? macro_line_result::handled : macro_line_result::expanded;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "parser_types.hpp"
+#include "assembler_internal.hpp"
+
+struct parsed_file_t;
+
+namespace rc_assembler
+{
+    template<typename Iterator> struct assembler_grammar;
+}
+
+enum class macro_line_result
+{
+    // Not a macro line, so it's up to the grammar
+    not_macro,
+    // Expanded into lines that only depend on the line itself
+    expanded,
+    // Part of a definition, or expanded using a macro or symbol defined
+    // somewhere else, so the include cache can't replay it
+    handled,
+    error,
+};
+
+// Picks macro definitions and invocations out of the source before it's
+// parsed, and expands them into the lines they stand for. Definitions are
+// split into text and parameters once, so an expansion only has to join
+// the pieces back together.
+class macro_handler
+{
+public:
+    macro_handler(assembler_data_t* data, const rc_assembler::assembler_grammar<const char*>& parser);
+
+    macro_line_result handle_line(const char* line_start, const char* line_end, parsed_file_t* parsed_file);
+    // Reports a definition that the file being closed didn't finish
+    void end_file();
+
+private:
+    struct macro_piece_t
+    {
+        enum class piece_kind
+        {
+            text,
+            parameter,
+            local_label,
+        };
+
+        piece_kind kind;
+        std::string text;
+        size_t parameter;
+    };
+
+    struct macro_t
+    {
+        std::string name{};
+        size_t parameter_count = 0;
+        bool has_local_labels = false;
+        std::vector<std::vector<macro_piece_t>> lines{};
+    };
+
+    macro_line_result begin_definition(const char* line_start, const char* line_end);
+    void end_definition();
+    macro_line_result expand_index_macro(const char* line_start, const char* line_end, parsed_file_t* parsed_file);
+    macro_line_result expand_macro(const macro_t& macro, const char* arguments_start, const char* line_end);
+    bool constant_offset(const rc_assembler::instruction_argument& offset, int& value, bool& used_symbol);
+
+    assembler_data_t* data;
+    const rc_assembler::assembler_grammar<const char*>& parser;
+    std::unordered_map<std::string, macro_t> macros{};
+
+    // The definition being recorded, if there is one
+    bool defining = false;
+    bool defining_is_valid = false;
+    size_t defining_file_depth = 0;
+    std::string defining_name{};
+    std::vector<std::string> defining_parameters{};
+    std::vector<std::string> defining_lines{};
+
+    int expansion_depth = 0;
+    int expansion_count = 0;
+};
@@ -0,0 +1,197 @@
+#include "object_file.hpp"
+#include "binary_stream.hpp"
+
+#include <string.h>
+
+namespace
+{
+    // Bump whenever the layout changes
+    const uint32_t OBJECT_FILE_VERSION = 1;
+    const char OBJECT_FILE_MAGIC[5] = { 'R', 'C', 'O', 'B', 'J' };
+} // namespace
+
+bool write_object_file(const object_file_t &object, const char *path)
+{
+    binary_writer writer;
+    writer.bytes(std::string(OBJECT_FILE_MAGIC, sizeof(OBJECT_FILE_MAGIC)));
+    writer.u32(OBJECT_FILE_VERSION);
+    writer.u32((uint32_t)object.entry_section);
+    writer.u16(object.entry_offset);
+
+    writer.u32((uint32_t)object.sections.size());
+    for (auto &section : object.sections)
+    {
+        writer.u8((uint8_t)section.kind);
+        writer.u8(section.fixed);
+        writer.u16(section.address);
+        writer.u16(section.length);
+        writer.bytes(section.data);
+    }
+
+    writer.u32((uint32_t)object.exports.size());
+    for (auto &symbol : object.exports)
+    {
+        writer.bytes(symbol.name);
+        writer.u8((uint8_t)symbol.type);
+        writer.u32((uint32_t)symbol.section);
+        writer.u16(symbol.value);
+    }
+
+    writer.u32((uint32_t)object.imports.size());
+    for (auto &name : object.imports)
+    {
+        writer.bytes(name);
+    }
+
+    writer.u32((uint32_t)object.relocations.size());
+    for (auto &relocation : object.relocations)
+    {
+        writer.u8((uint8_t)relocation.kind);
+        writer.u32(relocation.section);
+        writer.u16(relocation.offset);
+        writer.u32((uint32_t)relocation.target_section);
+        writer.u16(relocation.target);
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool written = fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) == writer.buffer.size();
+    return (fclose(file) == 0) && written;
+}
+
+bool read_object_file(const char *path, object_file_t &object, std::string &error)
+{
+    std::vector<uint8_t> buffer;
+    if (!read_binary_file(path, buffer))
+    {
+        error = "couldn't be read";
+        return false;
+    }
+
+    binary_reader reader(buffer);
+    std::vector<uint8_t> magic;
+    uint32_t version, entry_section, count;
+    if (!reader.bytes(magic) || magic.size() != sizeof(OBJECT_FILE_MAGIC) || memcmp(magic.data(), OBJECT_FILE_MAGIC, sizeof(OBJECT_FILE_MAGIC)) != 0)
+    {
+        error = "isn't an object file";
+        return false;
+    }
+
+    if (!reader.u32(version) || version != OBJECT_FILE_VERSION)
+    {
+        error = "was made by a different version of the assembler";
+        return false;
+    }
+
+    error = "is truncated or corrupt";
+    if (!reader.u32(entry_section) || !reader.u16(object.entry_offset) || !reader.u32(count))
+    {
+        return false;
+    }
+
+    object.entry_section = (int32_t)entry_section;
+
+    // Every entry takes at least a byte, which stops a corrupt count allocating the world
+    if (count > reader.remaining())
+    {
+        return false;
+    }
+
+    object.sections.resize(count);
+    for (auto &section : object.sections)
+    {
+        uint8_t kind, fixed;
+        if (!reader.u8(kind) || kind > (uint8_t)object_section_kind::reserved || !reader.u8(fixed) ||
+            !reader.u16(section.address) || !reader.u16(section.length) || !reader.bytes(section.data))
+        {
+            return false;
+        }
+
+        section.kind = (object_section_kind)kind;
+        section.fixed = fixed != 0;
+        size_t expected_size = section.kind == object_section_kind::reserved ? 0 : section.length;
+        if (section.data.size() != expected_size)
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    object.exports.resize(count);
+    for (auto &symbol : object.exports)
+    {
+        uint8_t type;
+        uint32_t section;
+        if (!reader.bytes(symbol.name) || !reader.u8(type) || !reader.u32(section) || !reader.u16(symbol.value))
+        {
+            return false;
+        }
+
+        symbol.type = (symbol_type_t)type;
+        symbol.section = (int32_t)section;
+        if (symbol.section >= (int)object.sections.size())
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    object.imports.resize(count);
+    for (auto &name : object.imports)
+    {
+        if (!reader.bytes(name))
+        {
+            return false;
+        }
+    }
+
+    if (!reader.u32(count) || count > reader.remaining())
+    {
+        return false;
+    }
+
+    object.relocations.resize(count);
+    for (auto &relocation : object.relocations)
+    {
+        uint8_t kind;
+        uint32_t target_section;
+        if (!reader.u8(kind) || kind > (uint8_t)relocation_kind::branch || !reader.u32(relocation.section) ||
+            !reader.u16(relocation.offset) || !reader.u32(target_section) || !reader.u16(relocation.target))
+        {
+            return false;
+        }
+
+        relocation.kind = (relocation_kind)kind;
+        relocation.target_section = (int32_t)target_section;
+
+        // Everything a relocation points at has to exist, so the linker can trust it
+        size_t patch_size = relocation.kind == relocation_kind::word ? 2 : 1;
+        if (relocation.section >= object.sections.size() ||
+            relocation.offset + patch_size > object.sections[relocation.section].data.size() ||
+            relocation.target_section >= (int)object.sections.size() ||
+            (relocation.target_section < 0 && relocation.target >= object.imports.size()))
+        {
+            return false;
+        }
+    }
+
+    if (!reader.at_end() || object.entry_section >= (int)object.sections.size())
+    {
+        return false;
+    }
+
+    error.clear();
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "symbols.h"
+
+// A relocatable object (.rcobj) is one source file assembled on its own.
+// rclink places its sections, resolves its imports against the exports of
+// the other objects, and patches the relocations to make an executable.
+//
+// Layout, all little-endian through binary_stream.hpp:
+// - magic "RCOBJ", u32 version
+// - i32 entry section (-1 for none), u16 entry offset
+// - u32 section count, then per section: u8 kind, u8 fixed, u16 address, u16 length, bytes data
+// - u32 export count, then per export: bytes name, u8 type, i32 section (-1 for constants), u16 value
+// - u32 import count, then per import: bytes name
+// - u32 relocation count, then per relocation: u8 kind, u32 section, u16 offset, i32 target section (-1 for imports), u16 target
+
+enum class object_section_kind : uint8_t
+{
+    code,
+    data,
+    // Address space from .reserve, with no contents
+    reserved,
+};
+
+struct object_section_t
+{
+    object_section_kind kind = object_section_kind::code;
+    // Placed with .org, so the linker has to keep it at address
+    bool fixed = false;
+    // Where the assembler put the section
+    uint16_t address = 0;
+    uint16_t length = 0;
+    // length bytes, except for reserved sections which have none
+    std::vector<uint8_t> data{};
+};
+
+struct object_symbol_t
+{
+    std::string name{};
+    symbol_type_t type = SYMBOL_NO_TYPE;
+    // Addresses are an offset into a section, constants have no section
+    int section = -1;
+    uint16_t value = 0;
+};
+
+enum class relocation_kind : uint8_t
+{
+    // A big-endian address
+    word,
+    // A byte sized constant
+    byte,
+    // The signed offset of a branch, from the branch opcode's address
+    branch,
+};
+
+struct object_relocation_t
+{
+    relocation_kind kind = relocation_kind::word;
+    // Where the bytes to patch are
+    uint32_t section = 0;
+    uint16_t offset = 0;
+    // What they refer to, an offset in another section or an import
+    int target_section = -1;
+    uint16_t target = 0;
+};
+
+struct object_file_t
+{
+    int entry_section = -1;
+    uint16_t entry_offset = 0;
+    std::vector<object_section_t> sections{};
+    std::vector<object_symbol_t> exports{};
+    std::vector<std::string> imports{};
+    std::vector<object_relocation_t> relocations{};
+};
+
+bool write_object_file(const object_file_t &object, const char *path);
+// On failure error says what was wrong with the file
+bool read_object_file(const char *path, object_file_t &object, std::string &error);
@@ -44,7 +44,15 @@ namespace rc_assembler
 
     typedef std::vector<char> byte_array;
     typedef std::string symbol;
-    typedef boost::variant<register_index_t, uint8_t, uint16_t, int, symbol> instruction_argument;
+
+    // Anything more than a single literal or symbol, kept as written and
+    // parsed by parse_expression when it's assembled
+    struct expression
+    {
+        std::string text{};
+    };
+
+    typedef boost::variant<register_index_t, uint8_t, uint16_t, int, symbol, expression> instruction_argument;
 
     struct instruction_line
     {
@@ -80,6 +88,21 @@ namespace rc_assembler
         uint16_t value = 0;
     };
 
+    enum class constant_kind
+    {
+        byte,
+        word,
+        reserve,
+    };
+
+    // .defbyte, .defword or .reserve with an expression for the value
+    struct constant_def
+    {
+        constant_kind kind = constant_kind::word;
+        symbol symbol{};
+        expression value{};
+    };
+
     struct data_def
     {
         std::optional<symbol> symbol{};
@@ -112,6 +135,30 @@ namespace rc_assembler
         std::string contents{};
     };;
 
+    // The built in set/get macros, which are expanded before the line is visited
+    enum class index_macro_kind
+    {
+        set,
+        setw,
+        get,
+        getw,
+    };
+
+    struct index_macro
+    {
+        index_macro_kind kind = index_macro_kind::get;
+        register_argument_t* index_register = nullptr;
+        instruction_argument offset{};
+        // What set stores, get doesn't take one
+        std::optional<instruction_argument> value{};
+    };
+
+    struct macro_def
+    {
+        symbol name{};
+        std::vector<symbol> parameters{};
+    };
+
     typedef boost::variant
     <
         instruction_line, 
@@ -126,7 +173,8 @@ namespace rc_assembler
         include_def,
         struct_def,
         struct_member_def,
-        end_struct_def
+        end_struct_def,
+        constant_def
     > line_options;
     
     struct assembly_line
@@ -165,6 +213,18 @@ BOOST_FUSION_ADAPT_STRUCT(
     (uint16_t, value)
 )
 
+BOOST_FUSION_ADAPT_STRUCT(
+    rc_assembler::expression,
+    (std::string, text)
+)
+
+BOOST_FUSION_ADAPT_STRUCT(
+    rc_assembler::constant_def,
+    (rc_assembler::constant_kind, kind),
+    (rc_assembler::symbol, symbol),
+    (rc_assembler::expression, value)
+)
+
 BOOST_FUSION_ADAPT_STRUCT(
     rc_assembler::label_def,
     (rc_assembler::symbol, label_name)
@@ -202,6 +262,20 @@ BOOST_FUSION_ADAPT_STRUCT(
     (std::string, contents)
 )
 
+BOOST_FUSION_ADAPT_STRUCT(
+    rc_assembler::index_macro,
+    (rc_assembler::index_macro_kind, kind),
+    (register_argument_t*, index_register),
+    (rc_assembler::instruction_argument, offset),
+    (std::optional<rc_assembler::instruction_argument>, value)
+)
+
+BOOST_FUSION_ADAPT_STRUCT(
+    rc_assembler::macro_def,
+    (rc_assembler::symbol, name),
+    (std::vector<rc_assembler::symbol>, parameters)
+)
+
 BOOST_FUSION_ADAPT_STRUCT(
     rc_assembler::assembly_line,
     (std::optional<rc_assembler::line_options>, line_options),
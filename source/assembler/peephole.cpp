@@ -0,0 +1,148 @@
+#include "peephole.hpp"
+
+namespace
+{
+    struct cancelling_pair_t
+    {
+        uint8_t push;
+        uint8_t pull;
+    };
+
+    // A push followed by one of these leaves the stack and registers as they were
+    const cancelling_pair_t cancelling_pairs[] =
+    {
+        { OPCODE_DUP,                       OPCODE_POP },
+        { OPCODE_DUP + OPCODE_SIZE_BIT,     OPCODE_POP + OPCODE_SIZE_BIT },
+        { OPCODE_PUSHI,                     OPCODE_POP },
+        { OPCODE_PUSHI + OPCODE_SIZE_BIT,   OPCODE_POP + OPCODE_SIZE_BIT },
+        { OPCODE_PUSHX,                     OPCODE_PULLX },
+        { OPCODE_PUSHX,                     OPCODE_POP + OPCODE_SIZE_BIT },
+        { OPCODE_PUSHDP,                    OPCODE_PULLDP },
+        { OPCODE_PUSHDP,                    OPCODE_POP },
+    };
+
+    bool is_cancelling_pair(uint8_t push, uint8_t pull)
+    {
+        for (auto &pair : cancelling_pairs)
+        {
+            if (pair.push == push && pair.pull == pull)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool is_add(const peephole_instruction_t &instruction)
+    {
+        return (instruction.opcode->opcode & ~OPCODE_SIZE_BIT) == OPCODE_ADD;
+    }
+
+    // Tries each pattern once against the end of the instructions
+    bool optimize_tail_once(std::vector<peephole_instruction_t> &instructions)
+    {
+        auto count = instructions.size();
+        if (count >= 2)
+        {
+            auto &first = instructions[count - 2];
+            auto &second = instructions[count - 1];
+            if (!first.sets_condition_codes && is_cancelling_pair(first.opcode->opcode, second.opcode->opcode))
+            {
+                instructions.resize(count - 2);
+                return true;
+            }
+        }
+
+        if (count >= 3)
+        {
+            auto &first = instructions[count - 3];
+            auto &second = instructions[count - 2];
+            auto &add = instructions[count - 1];
+            auto size_bit = add.opcode->opcode & OPCODE_SIZE_BIT;
+            if (is_add(add)
+                && first.opcode->opcode == (OPCODE_PUSHI | size_bit)
+                && second.opcode->opcode == (OPCODE_PUSHI | size_bit))
+            {
+                first.argument = (first.argument + second.argument) & (size_bit ? 0xffff : 0xff);
+                first.sets_condition_codes = true;
+                first.folded_addend = second.argument;
+                instructions.resize(count - 2);
+                return true;
+            }
+        }
+
+        return false;
+    }
+} // namespace
+
+void optimize_instruction_tail(std::vector<peephole_instruction_t> &instructions)
+{
+    // A new add sets the condition codes, so earlier folds don't need theirs
+    if (!instructions.empty() && is_add(instructions.back()))
+    {
+        for (size_t i = 0; i + 1 < instructions.size(); i++)
+        {
+            instructions[i].sets_condition_codes = false;
+        }
+    }
+
+    // Each change can leave a new match behind it, like pushi 1, dup, pop, pushi 2, add
+    while (optimize_tail_once(instructions))
+    {
+    }
+}
+
+void restore_condition_codes(std::vector<peephole_instruction_t> &instructions)
+{
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        auto &folded = instructions[i];
+        if (!folded.sets_condition_codes)
+        {
+            continue;
+        }
+
+        // The same values and condition codes as the add it came from
+        auto mask = (folded.opcode->opcode & OPCODE_SIZE_BIT) ? 0xffff : 0xff;
+        auto second = folded;
+        second.argument = folded.folded_addend & mask;
+        second.sets_condition_codes = false;
+        folded.argument = (folded.argument - folded.folded_addend) & mask;
+        folded.sets_condition_codes = false;
+
+        auto add = second;
+        add.opcode = get_opcode_entry_from_opcode(OPCODE_ADD | (folded.opcode->opcode & OPCODE_SIZE_BIT));
+        add.argument = 0;
+        instructions.insert(instructions.begin() + i + 1, { second, add });
+        i += 2;
+    }
+}
+
+void forget_condition_codes(std::vector<peephole_instruction_t> &instructions)
+{
+    for (auto &instruction : instructions)
+    {
+        instruction.sets_condition_codes = false;
+    }
+}
+
+bool is_peephole_candidate(const opcode_entry_t *opcode)
+{
+    auto base_opcode = opcode->opcode & ~OPCODE_SIZE_BIT;
+    switch (base_opcode)
+    {
+    case OPCODE_DUP:
+    case OPCODE_POP:
+    case OPCODE_PUSHI:
+    case OPCODE_ADD:
+    case OPCODE_PUSHDP:
+    case OPCODE_PULLDP:
+    case OPCODE_PUSHX & ~OPCODE_SIZE_BIT:
+    case OPCODE_PULLX & ~OPCODE_SIZE_BIT:
+        return true;
+
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "opcodes.h"
+
+// An instruction held back from the code so the peephole optimizer can still
+// change it. Only instructions whose bytes don't depend on a symbol's address
+// are held, so they can be moved or dropped without anything to fix up.
+struct peephole_instruction_t
+{
+    const opcode_entry_t *opcode;
+    // The immediate value for pushi and pushiw, unused otherwise
+    int argument;
+    // Where the instruction came from, for errors when it's finally written
+    int line_number;
+    // Set on a pushi an add was folded into while something might still test
+    // the condition codes that add would have set. folded_addend was the
+    // add's second operand, so it can be split back into pushi, pushi, add.
+    bool sets_condition_codes = false;
+    int folded_addend = 0;
+};
+
+// Rewrites the end of a run of instructions that nothing branches into, for as
+// long as one of the patterns matches:
+//  - a push followed by a pop or pull that undoes it (dup/pop, pushi/pop,
+//    pushx/pullx, pushdp/pulldp and friends) is dropped
+//  - pushi a, pushi b, add becomes pushi a+b, likewise for the word versions
+// The pushi an add was folded into is marked with sets_condition_codes until
+// another add sets them again, and a marked push isn't dropped.
+void optimize_instruction_tail(std::vector<peephole_instruction_t> &instructions);
+
+// Splits a pushi an add was folded into back into pushi, pushi, add, for when
+// a branch or anything else might test the condition codes the add sets
+void restore_condition_codes(std::vector<peephole_instruction_t> &instructions);
+
+// For when the next instruction sets the condition codes itself, so none of
+// the folded adds' have to be kept
+void forget_condition_codes(std::vector<peephole_instruction_t> &instructions);
+
+// Whether an instruction is one the patterns can use. pushi and pushiw are only
+// candidates when their value is known, which is up to the caller to check.
+bool is_peephole_candidate(const opcode_entry_t *opcode);
@@ -0,0 +1,152 @@
+#include "region_map.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+region_map::region_map(uint32_t first_address, uint32_t address_space_size)
+    : address_space_size(address_space_size)
+{
+    // The address space is a power of two, so every node covers a whole
+    // power of two of addresses, and its free runs can be worked out from
+    // where it starts
+    free_space.resize(address_space_size * 2);
+    for (uint32_t level_start = 1, node_length = address_space_size; level_start < free_space.size(); level_start *= 2, node_length /= 2)
+    {
+        for (uint32_t i = 0; i < level_start; i++)
+        {
+            uint32_t node_start = i * node_length;
+            uint32_t free = node_start + node_length - std::clamp(first_address, node_start, node_start + node_length);
+            free_space[level_start + i] = { free == node_length ? free : 0, free, free };
+        }
+    }
+}
+
+void region_map::insert(uint32_t start, uint32_t length, size_t index)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    uint32_t end = std::min(start + length, address_space_size);
+    ranges[start] = { end, index };
+    take(1, 0, address_space_size, start, end);
+}
+
+void region_map::resize(uint32_t start, uint32_t new_length)
+{
+    auto found = ranges.find(start);
+    if (found == ranges.end())
+    {
+        return;
+    }
+
+    uint32_t end = std::min(start + new_length, address_space_size);
+    take(1, 0, address_space_size, found->second.end, end);
+    found->second.end = end;
+}
+
+int region_map::find(uint32_t address) const
+{
+    // The last range starting at or before the address is the only one that
+    // can contain it
+    auto found = ranges.upper_bound(address);
+    if (found == ranges.begin())
+    {
+        return -1;
+    }
+
+    found--;
+    return address < found->second.end ? (int)found->second.index : -1;
+}
+
+bool region_map::intersects(uint32_t start, uint32_t length) const
+{
+    if (length == 0)
+    {
+        return false;
+    }
+
+    // Either a range starts inside [start, start + length), or the range
+    // before start runs into it
+    auto found = ranges.lower_bound(start);
+    if (found != ranges.end() && found->first < start + length)
+    {
+        return true;
+    }
+
+    return found != ranges.begin() && std::prev(found)->second.end > start;
+}
+
+uint32_t region_map::next_start(uint32_t address) const
+{
+    auto found = ranges.upper_bound(address);
+    return found != ranges.end() ? found->first : address_space_size;
+}
+
+int region_map::find_free(uint32_t length) const
+{
+    length = std::max<uint32_t>(length, 1);
+    if (free_space[1].longest < length)
+    {
+        return -1;
+    }
+
+    size_t node = 1;
+    uint32_t node_start = 0;
+    uint32_t node_length = address_space_size;
+    while (node < address_space_size)
+    {
+        // Leftmost first: the left child, then a run across the middle, then
+        // the right child
+        auto &left = free_space[node * 2];
+        auto &right = free_space[node * 2 + 1];
+        node_length /= 2;
+        if (left.longest >= length)
+        {
+            node = node * 2;
+        }
+        else if (left.suffix + right.prefix >= length)
+        {
+            return (int)(node_start + node_length - left.suffix);
+        }
+        else
+        {
+            node = node * 2 + 1;
+            node_start += node_length;
+        }
+    }
+
+    return (int)node_start;
+}
+
+// Marks [start, end) as taken under a node. A node with nothing free has
+// nothing left to take, which saves pushing anything down to its children.
+void region_map::take(size_t node, uint32_t node_start, uint32_t node_length, uint32_t start, uint32_t end)
+{
+    uint32_t node_end = node_start + node_length;
+    if (end <= node_start || start >= node_end || free_space[node].longest == 0)
+    {
+        return;
+    }
+    else if (start <= node_start && end >= node_end)
+    {
+        free_space[node] = { 0, 0, 0 };
+        return;
+    }
+
+    uint32_t child_length = node_length / 2;
+    take(node * 2, node_start, child_length, start, end);
+    take(node * 2 + 1, node_start + child_length, child_length, start, end);
+    update(node, child_length);
+}
+
+void region_map::update(size_t node, uint32_t child_length)
+{
+    auto &left = free_space[node * 2];
+    auto &right = free_space[node * 2 + 1];
+    auto &runs = free_space[node];
+    runs.prefix = left.prefix == child_length ? child_length + right.prefix : left.prefix;
+    runs.suffix = right.suffix == child_length ? child_length + left.suffix : right.suffix;
+    runs.longest = std::max({ left.longest, right.longest, left.suffix + right.prefix });
+}
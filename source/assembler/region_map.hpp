@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+// Keeps track of which addresses are taken by regions, so finding the region
+// holding an address, checking a range is free and finding room for a new
+// region don't have to look at every region:
+// - ranges are kept sorted by start address, for containment and overlap in
+//   O(log n) for n regions
+// - a segment tree over the address space holds the longest free run under
+//   each node, for a first fit search in O(log 64k)
+// Regions only ever grow, so nothing is given back to the free space.
+class region_map
+{
+public:
+    // Addresses below first_address are never handed out by find_free
+    region_map(uint32_t first_address, uint32_t address_space_size);
+
+    // Takes [start, start + length) for the region with the given index. Empty
+    // ranges can't contain anything, so they aren't kept.
+    void insert(uint32_t start, uint32_t length, size_t index);
+    // Grows the range starting at start, which has to have been inserted
+    void resize(uint32_t start, uint32_t new_length);
+
+    // The index of the region containing address, or -1
+    int find(uint32_t address) const;
+    bool intersects(uint32_t start, uint32_t length) const;
+    // Where the first range after address starts, or the end of the address
+    // space if there isn't one
+    uint32_t next_start(uint32_t address) const;
+    // The lowest address with length free bytes from it, or -1
+    int find_free(uint32_t length) const;
+
+private:
+    struct range_t
+    {
+        uint32_t end;
+        size_t index;
+    };
+
+    // Free run lengths in a segment tree node: from its first address, to its
+    // last address and the longest anywhere under it
+    struct free_run_t
+    {
+        uint32_t prefix;
+        uint32_t suffix;
+        uint32_t longest;
+    };
+
+    void take(size_t node, uint32_t node_start, uint32_t node_length, uint32_t start, uint32_t end);
+    void update(size_t node, uint32_t child_length);
+
+    uint32_t address_space_size;
+    std::map<uint32_t, range_t> ranges{};
+    // Heap ordered, with the leaves for each address from address_space_size
+    std::vector<free_run_t> free_space{};
+};
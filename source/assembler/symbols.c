@@ -3,28 +3,39 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "opcodes.h"
 
 typedef struct _symbol_reference symbol_reference_t;
 typedef struct _symbol_table_entry symbol_table_entry_t;
 
+// Both hash tables start with this many buckets and double whenever they
+// hold more items than buckets, so the chains stay a few items long
+#define SYMBOL_TABLE_INITIAL_BUCKETS    256
+
 struct _symbol_reference
 {
     char symbol[SYMBOL_MAX_LENGTH + 1];
     symbol_reference_t *next_reference;
+    symbol_reference_t *next_in_bucket;
+    uint32_t hash;
     symbol_resolve_callback_t callback;
     void *context;
     uint16_t ref_location;
     symbol_resolution_t resolution;
     symbol_signedness_t expected_signedness;
     symbol_type_t expected_type;
+    // Waits for the symbol without a location to patch
+    uint8_t is_dependency;
 };
 
 struct _symbol_table_entry
 {
     char symbol[SYMBOL_MAX_LENGTH + 1];
     symbol_table_entry_t *next_entry;
+    symbol_table_entry_t *next_in_bucket;
+    uint32_t hash;
     symbol_type_t type;
     symbol_signedness_t signedness;
     uint16_t word_value;
@@ -35,10 +46,106 @@ struct _symbol_table_entry
 
 struct _symbol_table
 {
+    // Every symbol and reference in the order they were added, for output
     symbol_table_entry_t *first_entry;
+    symbol_table_entry_t *last_entry;
     symbol_reference_t *first_reference;
+    symbol_reference_t *last_reference;
+
+    symbol_table_entry_t **entry_buckets;
+    uint32_t entry_bucket_count;
+    uint32_t entry_count;
+
+    // Only references still waiting for their symbol are in these buckets
+    symbol_reference_t **reference_buckets;
+    uint32_t reference_bucket_count;
+    uint32_t pending_reference_count;
 };
 
+// FNV-1a over the lower case name, up to the same length strncasecmp compares
+static uint32_t hash_symbol_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < SYMBOL_MAX_LENGTH && name[i] != 0; i++)
+    {
+        hash ^= (uint8_t)tolower((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int symbol_names_match(const char *name, uint32_t hash, const char *other_name, uint32_t other_hash)
+{
+    return hash == other_hash && strncasecmp(name, other_name, SYMBOL_MAX_LENGTH) == 0;
+}
+
+static void grow_entry_buckets(symbol_table_t *symbol_table)
+{
+    uint32_t new_count = symbol_table->entry_bucket_count * 2;
+    symbol_table_entry_t **new_buckets = calloc(new_count, sizeof(symbol_table_entry_t*));
+    if (new_buckets == 0)
+    {
+        // Lookups still work with longer chains
+        return;
+    }
+
+    symbol_table_entry_t *current_entry = symbol_table->first_entry;
+    while (current_entry != 0)
+    {
+        uint32_t bucket = current_entry->hash & (new_count - 1);
+        current_entry->next_in_bucket = new_buckets[bucket];
+        new_buckets[bucket] = current_entry;
+        current_entry = current_entry->next_entry;
+    }
+
+    free(symbol_table->entry_buckets);
+    symbol_table->entry_buckets = new_buckets;
+    symbol_table->entry_bucket_count = new_count;
+}
+
+static void grow_reference_buckets(symbol_table_t *symbol_table)
+{
+    uint32_t new_count = symbol_table->reference_bucket_count * 2;
+    symbol_reference_t **new_buckets = calloc(new_count, sizeof(symbol_reference_t*));
+    if (new_buckets == 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < symbol_table->reference_bucket_count; i++)
+    {
+        symbol_reference_t *current_ref = symbol_table->reference_buckets[i];
+        while (current_ref != 0)
+        {
+            symbol_reference_t *next_ref = current_ref->next_in_bucket;
+            uint32_t bucket = current_ref->hash & (new_count - 1);
+            current_ref->next_in_bucket = new_buckets[bucket];
+            new_buckets[bucket] = current_ref;
+            current_ref = next_ref;
+        }
+    }
+
+    free(symbol_table->reference_buckets);
+    symbol_table->reference_buckets = new_buckets;
+    symbol_table->reference_bucket_count = new_count;
+}
+
+static symbol_table_entry_t *find_symbol(symbol_table_t *symbol_table, const char *name, uint32_t hash)
+{
+    symbol_table_entry_t *current_entry = symbol_table->entry_buckets[hash & (symbol_table->entry_bucket_count - 1)];
+    while (current_entry != 0)
+    {
+        if (symbol_names_match(name, hash, current_entry->symbol, current_entry->hash))
+        {
+            return current_entry;
+        }
+        current_entry = current_entry->next_in_bucket;
+    }
+
+    return 0;
+}
+
 void output_symbols(FILE *output_file, symbol_table_t *symbol_table)
 {
     symbol_table_entry_t *current_entry = symbol_table->first_entry;
@@ -60,7 +167,10 @@ void output_symbols(FILE *output_file, symbol_table_t *symbol_table)
     symbol_reference_t *current_reference = symbol_table->first_reference;
     while (current_reference != 0)
     {
-        fprintf(output_file, "Reference: %s, near location 0x%04x\n", current_reference->symbol, current_reference->ref_location);
+        if (!current_reference->is_dependency)
+        {
+            fprintf(output_file, "Reference: %s, near location 0x%04x\n", current_reference->symbol, current_reference->ref_location);
+        }
         current_reference = current_reference->next_reference;
     }
 }
@@ -72,14 +182,23 @@ symbol_table_error_t create_symbol_table(symbol_table_t **symbol_table)
         return SYMBOL_TABLE_BAD_ARG;
     }
 
-    *symbol_table = malloc(sizeof(struct _symbol_table));
+    *symbol_table = calloc(1, sizeof(struct _symbol_table));
     if (*symbol_table == 0)
     {
         return SYMBOL_TABLE_ALLOC_FAILED;
     }
 
-    (*symbol_table)->first_entry = 0;
-    (*symbol_table)->first_reference = 0;
+    (*symbol_table)->entry_buckets = calloc(SYMBOL_TABLE_INITIAL_BUCKETS, sizeof(symbol_table_entry_t*));
+    (*symbol_table)->entry_bucket_count = SYMBOL_TABLE_INITIAL_BUCKETS;
+    (*symbol_table)->reference_buckets = calloc(SYMBOL_TABLE_INITIAL_BUCKETS, sizeof(symbol_reference_t*));
+    (*symbol_table)->reference_bucket_count = SYMBOL_TABLE_INITIAL_BUCKETS;
+
+    if ((*symbol_table)->entry_buckets == 0 || (*symbol_table)->reference_buckets == 0)
+    {
+        dispose_symbol_table(*symbol_table);
+        *symbol_table = 0;
+        return SYMBOL_TABLE_ALLOC_FAILED;
+    }
 
     return SYMBOL_TABLE_NOERROR;
 }
@@ -104,11 +223,45 @@ symbol_table_error_t dispose_symbol_table(symbol_table_t *symbol_table)
         current_ref = next_ref;
     }
 
+    free(symbol_table->entry_buckets);
+    free(symbol_table->reference_buckets);
     free(symbol_table);
 
     return SYMBOL_TABLE_NOERROR;
 }
 
+// Calls back every reference waiting on the new symbol, and takes them out
+// of the pending buckets since nothing will look for them there again
+static void resolve_pending_references(symbol_table_t *symbol_table, symbol_table_entry_t *entry)
+{
+    symbol_reference_t **link = &symbol_table->reference_buckets[entry->hash & (symbol_table->reference_bucket_count - 1)];
+    while (*link != 0)
+    {
+        symbol_reference_t *current_ref = *link;
+        if (!symbol_names_match(current_ref->symbol, current_ref->hash, entry->symbol, entry->hash))
+        {
+            link = &current_ref->next_in_bucket;
+            continue;
+        }
+
+        *link = current_ref->next_in_bucket;
+        current_ref->next_in_bucket = 0;
+        symbol_table->pending_reference_count--;
+
+        current_ref->resolution = SYMBOL_ASSIGNED;
+        machine_word_t word;
+        if (entry->type != SYMBOL_BYTE)
+        {
+            word.uword = entry->word_value;
+        }
+        else
+        {
+            word.uword = entry->byte_value;
+        }
+        current_ref->callback(current_ref->context, current_ref->ref_location, entry->type, current_ref->expected_signedness, entry->byte_value, word);
+    }
+}
+
 symbol_error_t add_symbol(symbol_table_t *symbol_table, const char *name, symbol_type_t type, symbol_signedness_t signedness, uint16_t word_value, uint8_t byte_value, uint8_t resolve_references)
 {
     if (type == SYMBOL_NO_TYPE)
@@ -117,36 +270,32 @@ symbol_error_t add_symbol(symbol_table_t *symbol_table, const char *name, symbol
         return SYMBOL_ERROR_INTERNAL;
     }
 
-    symbol_table_entry_t *current_entry = symbol_table->first_entry;
-    symbol_table_entry_t *next_entry = 0;
-    symbol_table_entry_t *last_entry = 0;
-    while (current_entry != 0)
+    uint32_t hash = hash_symbol_name(name);
+    if (find_symbol(symbol_table, name, hash) != 0)
     {
-        next_entry = current_entry->next_entry;
-        if (strncasecmp(name, current_entry->symbol, SYMBOL_MAX_LENGTH) == 0)
-        {
-            return SYMBOL_ERROR_EXISTS;
-        }
-        last_entry = current_entry;
-        current_entry = next_entry;
+        return SYMBOL_ERROR_EXISTS;
     }
 
     symbol_table_entry_t *new_entry = malloc(sizeof(symbol_table_entry_t));
     if (new_entry != 0)
     {
-        if (last_entry != 0)
+        if (symbol_table->last_entry != 0)
         {
-            last_entry->next_entry = new_entry;
+            symbol_table->last_entry->next_entry = new_entry;
         }
         else
         {
             symbol_table->first_entry = new_entry;
         }
+        symbol_table->last_entry = new_entry;
         
         strncpy(new_entry->symbol, name, SYMBOL_MAX_LENGTH);
+        new_entry->symbol[SYMBOL_MAX_LENGTH] = 0;
+        new_entry->hash = hash;
         new_entry->type = type;
         if (type == SYMBOL_BYTE)
         {
+            new_entry->word_value = 0;
             new_entry->byte_value = byte_value;
             new_entry->byte_value_valid = 1;
             new_entry->word_value_valid = 0;
@@ -154,33 +303,25 @@ symbol_error_t add_symbol(symbol_table_t *symbol_table, const char *name, symbol
         else
         {
             new_entry->word_value = word_value;
+            new_entry->byte_value = 0;
             new_entry->byte_value_valid = 0;
             new_entry->word_value_valid = 1;
         }
         new_entry->signedness = signedness;
         new_entry->next_entry = 0;
 
+        uint32_t bucket = hash & (symbol_table->entry_bucket_count - 1);
+        new_entry->next_in_bucket = symbol_table->entry_buckets[bucket];
+        symbol_table->entry_buckets[bucket] = new_entry;
+        symbol_table->entry_count++;
+        if (symbol_table->entry_count > symbol_table->entry_bucket_count)
+        {
+            grow_entry_buckets(symbol_table);
+        }
+
         if (resolve_references)
         {
-            symbol_reference_t* current_ref = symbol_table->first_reference;
-            while (current_ref != 0)
-            {
-                if (strncasecmp(current_ref->symbol, new_entry->symbol, SYMBOL_MAX_LENGTH) == 0)
-                {
-                    current_ref->resolution = SYMBOL_ASSIGNED;
-                    machine_word_t word;
-                    if (type != SYMBOL_BYTE)
-                    {
-                        word.uword = word_value;
-                    }
-                    else
-                    {
-                        word.uword = byte_value;
-                    }
-                    current_ref->callback(current_ref->context, current_ref->ref_location, type, current_ref->expected_signedness, byte_value, word);
-                }
-                current_ref = current_ref->next_reference;
-            };
+            resolve_pending_references(symbol_table, new_entry);
         }
 
         // fprintf(stdout, "Creating new symbol \"%s\" with value %d\n", new_entry->symbol, new_entry->byte_value_valid ? new_entry->byte_value : new_entry->word_value);
@@ -193,21 +334,10 @@ symbol_error_t add_symbol(symbol_table_t *symbol_table, const char *name, symbol
     }
 }
 
-symbol_ref_status_t add_symbol_reference(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context, uint16_t ref_location, symbol_signedness_t expected_signedness, symbol_type_t expected_type)
+static symbol_ref_status_t add_reference(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context, uint16_t ref_location, symbol_signedness_t expected_signedness, symbol_type_t expected_type, uint8_t is_dependency)
 {
-    symbol_table_entry_t *current_entry = symbol_table->first_entry;
-    symbol_table_entry_t *next_entry;
-    while (current_entry != 0)
-    {
-        next_entry = current_entry->next_entry;
-        
-        if (strncasecmp(name, current_entry->symbol, SYMBOL_MAX_LENGTH) == 0)
-        {
-            break;
-        }
-        
-        current_entry = next_entry;
-    }
+    uint32_t hash = hash_symbol_name(name);
+    symbol_table_entry_t *current_entry = find_symbol(symbol_table, name, hash);
 
     if (current_entry != 0)
     {
@@ -232,53 +362,59 @@ symbol_ref_status_t add_symbol_reference(symbol_table_t *symbol_table, const cha
     }
 
     new_ref->next_reference = 0;
+    new_ref->next_in_bucket = 0;
+    new_ref->hash = hash;
     new_ref->expected_signedness = expected_signedness;
     new_ref->expected_type = expected_type;
     new_ref->callback = resolve_callback;
     new_ref->context = context;
     new_ref->ref_location = ref_location;
     new_ref->resolution = SYMBOL_UNASSIGNED;
+    new_ref->is_dependency = is_dependency;
     strncpy(new_ref->symbol, name, SYMBOL_MAX_LENGTH);
+    new_ref->symbol[SYMBOL_MAX_LENGTH] = 0;
 
-    symbol_reference_t *current_ref = symbol_table->first_reference;
-
-    if (current_ref == 0)
+    if (symbol_table->last_reference == 0)
     {
         symbol_table->first_reference = new_ref;
     }
     else
     {
-        while (current_ref->next_reference != 0)
-        {
-            current_ref = current_ref->next_reference;
-        }
-
-        current_ref->next_reference = new_ref;
+        symbol_table->last_reference->next_reference = new_ref;
     }
+    symbol_table->last_reference = new_ref;
  
     if (current_entry != 0)
     {
         return SYMBOL_REFERENCE_RESOLVABLE;
     }
 
+    // Only references that are still waiting go in the buckets
+    uint32_t bucket = hash & (symbol_table->reference_bucket_count - 1);
+    new_ref->next_in_bucket = symbol_table->reference_buckets[bucket];
+    symbol_table->reference_buckets[bucket] = new_ref;
+    symbol_table->pending_reference_count++;
+    if (symbol_table->pending_reference_count > symbol_table->reference_bucket_count)
+    {
+        grow_reference_buckets(symbol_table);
+    }
+
     return SYMBOL_REFERENCE_SUCCESS;
 }
 
-symbol_table_entry_t *get_symbol(symbol_table_t *symbol_table, const char *name)
+symbol_ref_status_t add_symbol_reference(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context, uint16_t ref_location, symbol_signedness_t expected_signedness, symbol_type_t expected_type)
 {
-    symbol_table_entry_t *current_entry = symbol_table->first_entry;
-    symbol_table_entry_t *next_entry;
-    while (current_entry != 0)
-    {
-        next_entry = current_entry->next_entry;
-        if (strncasecmp(current_entry->symbol, name, SYMBOL_MAX_LENGTH) == 0)
-        {
-            return current_entry;
-        }
-        current_entry = next_entry;
-    }
+    return add_reference(symbol_table, name, resolve_callback, context, ref_location, expected_signedness, expected_type, 0);
+}
 
-    return 0;
+symbol_ref_status_t add_symbol_dependency(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context)
+{
+    return add_reference(symbol_table, name, resolve_callback, context, 0, SIGNEDNESS_ANY, SYMBOL_WORD, 1);
+}
+
+symbol_table_entry_t *get_symbol(symbol_table_t *symbol_table, const char *name)
+{
+    return find_symbol(symbol_table, name, hash_symbol_name(name));
 }
 
 symbol_resolution_t resolve_symbol(symbol_table_t *symbol_table, const char *name, symbol_type_t *symbol_type, symbol_signedness_t *signedness, uint16_t *word_value, uint8_t *byte_value)
@@ -297,6 +433,29 @@ symbol_resolution_t resolve_symbol(symbol_table_t *symbol_table, const char *nam
     return SYMBOL_ASSIGNED;
 }
 
+void visit_symbols(symbol_table_t *symbol_table, symbol_visit_callback_t callback, void *context)
+{
+    symbol_table_entry_t *current_entry = symbol_table->first_entry;
+    while (current_entry != 0)
+    {
+        callback(context, current_entry->symbol, current_entry->type, current_entry->word_value, current_entry->byte_value);
+        current_entry = current_entry->next_entry;
+    }
+}
+
+void visit_unresolved_references(symbol_table_t *symbol_table, symbol_reference_visit_callback_t callback, void *context)
+{
+    symbol_reference_t *current_ref = symbol_table->first_reference;
+    while (current_ref != 0)
+    {
+        if (current_ref->resolution == SYMBOL_UNASSIGNED && !current_ref->is_dependency)
+        {
+            callback(context, current_ref->symbol, current_ref->ref_location, current_ref->expected_type, current_ref->expected_signedness);
+        }
+        current_ref = current_ref->next_reference;
+    }
+}
+
 symbol_ref_status_t check_all_symbols_resolved(symbol_table_t *symbol_table, int *unresolved_name_count, char **unresolved_symbol_names)
 {
     int unresolved_count = 0;
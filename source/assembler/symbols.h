@@ -75,6 +75,18 @@ void output_symbols(FILE *output_file, symbol_table_t *symbol_table);
 
 typedef void (*symbol_resolve_callback_t)(void *context, uint16_t ref_location, symbol_type_t symbol_type, symbol_signedness_t expected_signedness, uint8_t byte_value, machine_word_t word_value);
 symbol_ref_status_t add_symbol_reference(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context, uint16_t ref_location, symbol_signedness_t expected_signedness, symbol_type_t expected_type);
+// Calls back once name is defined, for something that's waiting on the
+// symbol rather than a place in the code using it. Dependencies count as
+// unresolved, but aren't listed as forward references or visited as imports.
+symbol_ref_status_t add_symbol_dependency(symbol_table_t *symbol_table, const char *name, symbol_resolve_callback_t resolve_callback, void *context);
+
+// Calls back for every symbol in the order they were defined
+typedef void (*symbol_visit_callback_t)(void *context, const char *name, symbol_type_t type, uint16_t word_value, uint8_t byte_value);
+void visit_symbols(symbol_table_t *symbol_table, symbol_visit_callback_t callback, void *context);
+
+// Calls back for every reference whose symbol was never defined
+typedef void (*symbol_reference_visit_callback_t)(void *context, const char *name, uint16_t ref_location, symbol_type_t expected_type, symbol_signedness_t expected_signedness);
+void visit_unresolved_references(symbol_table_t *symbol_table, symbol_reference_visit_callback_t callback, void *context);
 
 // on enter
 // count = number of strings of at least SYMBOL_MAX_LENGTH passed into 'symbols'
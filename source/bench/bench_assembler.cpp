@@ -0,0 +1,233 @@
+#include "assembler.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace po = boost::program_options;
+
+namespace
+{
+    // Every routine is this many lines, and every .data block one
+    const size_t ROUTINE_LINES = 10;
+
+    struct corpus_settings
+    {
+        size_t lines = 10000;
+        // Everything has to fit in 64k, so bigger corpora are split into programs
+        size_t program_lines = 16000;
+        int include_depth = 8;
+        // Bytes in each .data block, and how many routines share one
+        int data_size = 128;
+        int routines_per_block = 16;
+        // How many routines ahead each routine calls
+        int call_distance = 16;
+    };
+
+    // Writes a program of about line_count lines, spread over a main file and
+    // a chain of includes each included by the end of the one before, and
+    // returns the main file's path. Each routine uses a .data block from the
+    // deepest include and calls a routine further on, so nearly every symbol
+    // is used before it's defined.
+    std::string generate_program(const std::filesystem::path &directory, int program, size_t line_count, const corpus_settings &settings)
+    {
+        size_t routines = std::max<size_t>(1, line_count * settings.routines_per_block / (ROUTINE_LINES * settings.routines_per_block + 1));
+        size_t data_blocks = (routines + settings.routines_per_block - 1) / settings.routines_per_block;
+        int file_count = settings.include_depth + 1;
+
+        auto file_name = [program](int depth)
+        {
+            return "program" + std::to_string(program) + (depth == 0 ? "" : "_include" + std::to_string(depth)) + ".asm";
+        };
+
+        for (int depth = 0; depth < file_count; depth++)
+        {
+            std::ofstream file(directory / file_name(depth));
+            file << "; Generated by bench_assembler" << std::endl;
+            for (size_t routine = routines * depth / file_count; routine < routines * (depth + 1) / file_count; routine++)
+            {
+                file << "routine_" << routine << ":" << std::endl;
+                file << "    pushiw data_" << routine % data_blocks << std::endl;
+                file << "    pullx" << std::endl;
+                file << "    push [x+]" << std::endl;
+                file << "    pushi 3         ; add something on" << std::endl;
+                file << "    add" << std::endl;
+                file << "    beq routine_" << routine << "_done" << std::endl;
+                file << "    jsr routine_" << (routine + settings.call_distance) % routines << std::endl;
+                file << "routine_" << routine << "_done:" << std::endl;
+                file << "    rts" << std::endl;
+            }
+
+            if (depth + 1 < file_count)
+            {
+                file << ".include \"" << file_name(depth + 1) << "\"" << std::endl;
+                continue;
+            }
+
+            // Strings, as they're one line however big they get. The string's
+            // terminator makes up the last byte.
+            for (size_t block = 0; block < data_blocks; block++)
+            {
+                file << ".data data_" << block << " \"";
+                for (int i = 0; i < settings.data_size - 1; i++)
+                {
+                    file << (char)('a' + (block + i) % 26);
+                }
+                file << "\"" << std::endl;
+            }
+        }
+
+        return (directory / file_name(0)).string();
+    }
+
+    size_t peak_memory_bytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+    }
+
+    double seconds_since(std::chrono::steady_clock::time_point start_time)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    void usage(char** argv, po::options_description& options)
+    {
+        std::filesystem::path command_path{ argv[0] };
+        std::cout << "Usage: " << command_path.filename().string() << " [options]" << std::endl;
+        std::cout << options << std::endl;
+    }
+} // namespace
+
+// Generates a corpus of programs, assembles and outputs each of them, and
+// reports how long each phase took overall
+int main(int argc, char** argv)
+{
+    corpus_settings settings{};
+    std::string directory_name;
+
+    po::options_description cli_options("Allowed options");
+    cli_options.add_options()
+        ("help,?", "output the help message")
+        ("lines,l", po::value<size_t>(&settings.lines)->default_value(settings.lines), "how many lines of source to generate")
+        ("program-lines", po::value<size_t>(&settings.program_lines)->default_value(settings.program_lines), "the most lines in one program, larger corpora are split into several")
+        ("include-depth,d", po::value<int>(&settings.include_depth)->default_value(settings.include_depth), "how deep each program's chain of includes goes")
+        ("data-size", po::value<int>(&settings.data_size)->default_value(settings.data_size), "how many bytes are in each .data block")
+        ("routines-per-block", po::value<int>(&settings.routines_per_block)->default_value(settings.routines_per_block), "how many routines share each .data block")
+        ("call-distance", po::value<int>(&settings.call_distance)->default_value(settings.call_distance), "how many routines ahead each routine calls")
+        ("directory", po::value<std::string>(&directory_name), "where to write the corpus, a temporary directory by default")
+        ("keep", "leave the corpus and assembled programs behind")
+        ;
+
+    po::variables_map variables;
+    po::store(po::command_line_parser(argc, argv).options(cli_options).run(), variables);
+    po::notify(variables);
+
+    if (variables.count("help") > 0)
+    {
+        usage(argv, cli_options);
+        return 0;
+    }
+
+    if (settings.program_lines == 0 || settings.include_depth < 0 || settings.data_size < 1 || settings.routines_per_block < 1)
+    {
+        std::cerr << "Programs need lines in them, and .data blocks need a byte and a routine to use them" << std::endl;
+        return -1;
+    }
+
+    auto directory = directory_name.empty() ? std::filesystem::temp_directory_path() / "bench_assembler" : std::filesystem::path(directory_name);
+    std::filesystem::create_directories(directory);
+
+    std::vector<std::string> programs;
+    for (size_t generated = 0; generated < settings.lines; generated += settings.program_lines)
+    {
+        auto line_count = std::min(settings.program_lines, settings.lines - generated);
+        programs.push_back(generate_program(directory, (int)programs.size(), line_count, settings));
+    }
+
+    std::string search_path = directory.string();
+    const char *search_paths[] = { search_path.c_str(), nullptr };
+    assembler_options options{};
+    options.measure_phases = true;
+
+    assembler_timings totals{};
+    double assembly_seconds = 0;
+    double output_seconds = 0;
+    for (auto &program : programs)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        auto result = assemble(program.c_str(), search_paths, nullptr, options);
+        assembly_seconds += seconds_since(start_time);
+
+        if (get_error_buffer_size(result.get()) > 0)
+        {
+            std::cerr << program << " failed to assemble:" << std::endl << get_error_buffer(result.get()) << std::endl;
+            return -1;
+        }
+
+        auto output_file = std::filesystem::path(program).replace_extension(".bin").string();
+        start_time = std::chrono::steady_clock::now();
+        auto status = output_assembled_data(result.get(), program.c_str(), output_file.c_str(), assembler_output_type::binary);
+        output_seconds += seconds_since(start_time);
+
+        if (status != assembler_status::SUCCESS)
+        {
+            std::cerr << "Couldn't write " << output_file << std::endl;
+            return -1;
+        }
+
+        auto &timings = get_assembler_timings(result.get());
+        totals.parsing += timings.parsing;
+        totals.symbols += timings.symbols;
+        totals.regions += timings.regions;
+        totals.lines += timings.lines;
+        totals.passes += timings.passes;
+    }
+
+    if (variables.count("keep") == 0)
+    {
+        std::filesystem::remove_all(directory);
+    }
+
+    double total_seconds = assembly_seconds + output_seconds;
+    auto report = [total_seconds](const char *phase, double seconds)
+    {
+        std::cout << std::left << std::setw(12) << phase << std::right << std::fixed << std::setprecision(2)
+            << std::setw(10) << seconds * 1000 << "ms" << std::setw(8) << seconds * 100 / total_seconds << "%" << std::endl;
+    };
+
+    std::cout << totals.lines << " lines in " << programs.size() << " program(s) of " << settings.include_depth + 1
+        << " file(s), " << totals.passes << " pass(es)" << std::endl;
+    report("parsing", totals.parsing);
+    report("symbols", totals.symbols);
+    report("regions", totals.regions);
+    report("the rest", assembly_seconds - totals.parsing - totals.symbols - totals.regions);
+    report("output", output_seconds);
+    report("total", total_seconds);
+    std::cout << std::setprecision(0) << totals.lines / total_seconds << " lines/s, peak memory "
+        << std::setprecision(1) << peak_memory_bytes() / (1024.0 * 1024.0) << "MB" << std::endl;
+
+    return 0;
+}
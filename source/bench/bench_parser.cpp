@@ -0,0 +1,200 @@
+#include "assembler_parser.hpp"
+#include "line_lexer.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+namespace
+{
+    bool same_argument(const rc_assembler::instruction_argument &a, const rc_assembler::instruction_argument &b)
+    {
+        if (a.which() != b.which())
+        {
+            return false;
+        }
+
+        if (auto index = boost::get<register_index_t>(&a))
+        {
+            auto other = boost::get<register_index_t>(&b);
+            return index->index_register == other->index_register
+                && index->is_pre_increment == other->is_pre_increment
+                && index->increment_amount == other->increment_amount;
+        }
+        else if (auto byte = boost::get<uint8_t>(&a))
+        {
+            return *byte == boost::get<uint8_t>(b);
+        }
+        else if (auto word = boost::get<uint16_t>(&a))
+        {
+            return *word == boost::get<uint16_t>(b);
+        }
+        else if (auto number = boost::get<int>(&a))
+        {
+            return *number == boost::get<int>(b);
+        }
+
+        return boost::get<rc_assembler::symbol>(a) == boost::get<rc_assembler::symbol>(b);
+    }
+
+    // Only covers what the lexer produces, anything else counts as different
+    bool same_line(const rc_assembler::assembly_line &a, const rc_assembler::assembly_line &b)
+    {
+        if (a.comment != b.comment || a.line_options.has_value() != b.line_options.has_value())
+        {
+            return false;
+        }
+        else if (!a.line_options.has_value())
+        {
+            return true;
+        }
+
+        auto &options = a.line_options.value();
+        auto &other_options = b.line_options.value();
+        if (options.which() != other_options.which())
+        {
+            return false;
+        }
+
+        if (auto instruction = boost::get<rc_assembler::instruction_line>(&options))
+        {
+            auto other = boost::get<rc_assembler::instruction_line>(&other_options);
+            if (instruction->opcode != other->opcode || instruction->argument.has_value() != other->argument.has_value())
+            {
+                return false;
+            }
+
+            return !instruction->argument.has_value() || same_argument(instruction->argument.value(), other->argument.value());
+        }
+        else if (auto label = boost::get<rc_assembler::label_def>(&options))
+        {
+            return label->label_name == boost::get<rc_assembler::label_def>(other_options).label_name;
+        }
+
+        return false;
+    }
+
+    void usage(char** argv, po::options_description& options)
+    {
+        std::filesystem::path command_path{ argv[0] };
+        std::cout << "Usage: " << command_path.filename().string() << " [options] source..." << std::endl;
+        std::cout << options << std::endl;
+    }
+} // namespace
+
+// Times the Spirit grammar on its own against the lexer with the grammar
+// behind it, over every non-empty line of the given sources, after checking
+// the two agree on every line the lexer handles
+int main(int argc, char** argv)
+{
+    std::vector<std::string> source_files;
+    int iterations = 0;
+
+    po::options_description cli_options("Allowed options");
+    cli_options.add_options()
+        ("help,?", "output the help message")
+        ("source,S", po::value<std::vector<std::string>>(&source_files), "assembly source files to parse")
+        ("iterations,n", po::value<int>(&iterations)->default_value(20), "how many times to parse every line")
+        ;
+
+    po::positional_options_description positional_options;
+    positional_options.add("source", -1);
+
+    po::variables_map variables;
+    po::store(po::command_line_parser(argc, argv).options(cli_options).positional(positional_options).run(), variables);
+    po::notify(variables);
+
+    if (variables.count("help") > 0 || source_files.empty())
+    {
+        usage(argv, cli_options);
+        return variables.count("help") > 0 ? 0 : -1;
+    }
+
+    // Split the same way handle_file does
+    std::vector<std::string> lines;
+    for (auto &source_file : source_files)
+    {
+        std::ifstream file(source_file, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Couldn't read " << source_file << std::endl;
+            return -1;
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+
+            if (!line.empty())
+            {
+                lines.push_back(line);
+            }
+        }
+    }
+
+    rc_assembler::assembler_grammar<const char*> parser;
+    rc_assembler::line_lexer lexer;
+
+    size_t lexed_count = 0;
+    size_t mismatch_count = 0;
+    for (auto &line : lines)
+    {
+        const char *first = line.data();
+        auto last = first + line.size();
+        rc_assembler::assembly_line lexed, parsed;
+        auto result = lexer.lex_line(first, last, lexed);
+        if (result == rc_assembler::lex_result::unhandled)
+        {
+            continue;
+        }
+
+        lexed_count++;
+        bool grammar_parsed = boost::spirit::qi::phrase_parse(first, last, parser, boost::spirit::ascii::space, parsed);
+        if (result == rc_assembler::lex_result::failed ? grammar_parsed : !grammar_parsed || !same_line(lexed, parsed))
+        {
+            std::cerr << "The lexer and grammar disagree on: " << line << std::endl;
+            mismatch_count++;
+        }
+    }
+
+    auto time_lines = [&](bool use_lexer)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            for (auto &line : lines)
+            {
+                const char *first = line.data();
+                auto last = first + line.size();
+                rc_assembler::assembly_line parsed;
+                if (!use_lexer || lexer.lex_line(first, last, parsed) == rc_assembler::lex_result::unhandled)
+                {
+                    boost::spirit::qi::phrase_parse(first, last, parser, boost::spirit::ascii::space, parsed);
+                }
+            }
+        }
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    };
+
+    double grammar_seconds = time_lines(false);
+    double lexer_seconds = time_lines(true);
+    double line_count = (double)lines.size() * iterations;
+
+    std::cout << lines.size() << " lines, " << lexed_count << " handled by the lexer, " << mismatch_count << " mismatched" << std::endl;
+    std::cout << "grammar:         " << grammar_seconds * 1000 << "ms, " << (size_t)(line_count / grammar_seconds) << " lines/s" << std::endl;
+    std::cout << "lexer + grammar: " << lexer_seconds * 1000 << "ms, " << (size_t)(line_count / lexer_seconds) << " lines/s" << std::endl;
+    std::cout << "speedup:         " << grammar_seconds / lexer_seconds << "x" << std::endl;
+
+    return mismatch_count == 0 ? 0 : -1;
+}
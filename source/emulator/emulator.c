@@ -20,6 +20,8 @@ error_t init_emulator(emulator *emulator, arch_t architecture)
     }
 
     emulator->architecture = architecture;
+    emulator->graphics_generation = 0;
+    emulator->graphics_palette_generation = 0;
 
     emulator->memories.data = malloc(DATA_SIZE);
 
@@ -55,8 +57,13 @@ error_t reset_emulator(emulator *emulator)
     memset(emulator->memories.user_stack, 0, STACK_SIZE);
 
     emulator->current_state = RUNNING;
+    emulator->syscall_cycles = 0;
     emulator->graphics_mode.enabled = 0;
     emulator->graphics_start = 0;
+    emulator->graphics_draw_start = 0;
+    emulator->graphics_size = 0;
+    // Not reset to 0, a frame from before the reset could still have the same generation
+    emulator->graphics_generation++;
     emulator->PC = EXECUTE_BEGIN;
     emulator->SP = 0;
     emulator->ISP = 0;
@@ -203,9 +210,20 @@ typedef struct _execute_result_t
     int16_t relative;
 } execute_result_t;
 
+void mark_data_written(emulator *emulator, uint32_t index, uint32_t length)
+{
+    if (emulator->graphics_mode.enabled &&
+        index < (uint32_t)emulator->graphics_start + emulator->graphics_size &&
+        index + length > emulator->graphics_start)
+    {
+        emulator->graphics_generation++;
+    }
+}
+
 void set_data_indexed_byte(emulator *emulator, uint8_t byte, uint16_t index)
 {
     emulator->memories.data[index] = byte;
+    mark_data_written(emulator, index, 1);
 }
 
 uint8_t get_data_indexed_byte(emulator *emulator, uint16_t index)
@@ -219,6 +237,7 @@ void set_data_indexed_word(emulator* emulator, uint16_t word, uint16_t index)
     emWord.word = word;
     emulator->memories.data[index + 1] = emWord.bytes[0];
     emulator->memories.data[index] = emWord.bytes[1];
+    mark_data_written(emulator, index, 2);
 }
 
 // get_stack_indexed_word would be the same as peek_word with an index,
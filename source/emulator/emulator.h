@@ -53,10 +53,28 @@ typedef struct _emulator
     uint16_t current_syscall;
     execution_state_t current_state;
 
-    // Graphics will be in the 'data' memory
+    // Cycles the last syscall took on top of the syscall instruction itself,
+    // for syscalls whose cost depends on how much work they did
+    uint32_t syscall_cycles;
+
+    // Graphics will be in the 'data' memory.
+    // graphics_start is the buffer on screen and blits draw into
+    // graphics_draw_start, which is the other buffer once a program
+    // has flipped between two of them. Both are graphics_size bytes.
     address_t graphics_start;
+    address_t graphics_draw_start;
+    uint32_t graphics_size;
     graphics_mode_t graphics_mode;
 
+    // Changes whenever what's on screen might have, so frames that are
+    // the same as the last one don't have to be converted again
+    uint32_t graphics_generation;
+
+    // GRAPHICSTART resets this to the mode's defaults, and the palette
+    // generation changes with it so the renderer knows to pick it up
+    uint32_t graphics_palette[GRAPHICS_PALETTE_SIZE];
+    uint32_t graphics_palette_generation;
+
     // Registers
     address_t PC;
     address_t X;
@@ -85,6 +103,7 @@ uint8_t pull_byte(emulator *emulator);
 void push_word(emulator *emulator, uint16_t word);
 void push_byte(emulator *emulator, uint8_t byte);
 void pop_bytes(emulator *emulator, uint16_t byte_count);
+void mark_data_written(emulator *emulator, uint32_t index, uint32_t length);
 uint8_t emulator_can_execute(emulator *emulator);
 error_t dispose_emulator(emulator *emulator);
 
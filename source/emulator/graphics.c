@@ -14,6 +14,7 @@ int graphics_get_bit_divisor(graphics_mode_t mode)
 		break;
 
 	case FOUR_BITS_PER_PIXEL:
+	case TILE_MODE:
 		bit_divisor = 2;
 		break;
 	}
@@ -49,6 +50,12 @@ int graphics_mem_size_for_mode(graphics_mode_t mode)
 
 	if (dimensions > 0)
 	{
+		// Tile memory doesn't depend on the resolution, it's always the same set of tables
+		if (mode.depth == TILE_MODE)
+		{
+			return TILE_MODE_MEMORY_SIZE;
+		}
+
 		return dimensions / graphics_get_bit_divisor(mode);
 	}
 
@@ -127,4 +134,34 @@ graphics_mode_t graphics_mode_byte_to_struct(uint8_t byte)
 	mode.resolution = byte & 0b111;
 
 	return mode;
-}
\ No newline at end of file
+}
+
+uint32_t graphics_colour(uint8_t red, uint8_t green, uint8_t blue)
+{
+	return 0xFF000000 | ((uint32_t)blue << 16) | ((uint32_t)green << 8) | red;
+}
+
+void graphics_default_palette(graphics_mode_t mode, uint32_t palette[GRAPHICS_PALETTE_SIZE])
+{
+	int colour_count = 16;
+	switch (mode.depth)
+	{
+	case ONE_BIT_PER_PIXEL:
+		colour_count = 2;
+		break;
+
+	case TWO_BITS_PER_PIXEL:
+		colour_count = 4;
+		break;
+
+	case EIGHT_BITS_PER_PIXEL:
+		colour_count = 256;
+		break;
+	}
+
+	for (int i = 0; i < GRAPHICS_PALETTE_SIZE; i++)
+	{
+		uint8_t green = i < colour_count ? (uint8_t)(i * 255 / (colour_count - 1)) : 0;
+		palette[i] = graphics_colour(0, green, 0);
+	}
+}
@@ -15,7 +15,9 @@ typedef struct _graphics_mode
     // 001 - 2bpp
     // 010 - 4bpp
     // 011 - 8bpp
-    // 1xx - reserved
+    // 100 - tiles and sprites, see the tile mode layout below
+    // 101 - reserved
+    // 11x - reserved
     uint8_t depth;
 
     // 0 - black border
@@ -39,8 +41,41 @@ typedef enum _graphics_depth
     TWO_BITS_PER_PIXEL      = 0b001,
     FOUR_BITS_PER_PIXEL     = 0b010,
     EIGHT_BITS_PER_PIXEL    = 0b011,
+    TILE_MODE               = 0b100,
 } graphics_depth_t;
 
+// Tile mode layout, as offsets from graphics_start.
+// The background is a 64x64 map of 8x8 tiles that wraps around, so it's
+// 512x512 pixels and the scroll registers pick which part of it is shown.
+// Tiles and sprites share the pattern table, and patterns are 4bpp with
+// the low nybble as the left pixel, the same as the 4bpp bitmap mode.
+// Words are stored high byte first, like everything else in data memory.
+//
+// Sprites are drawn over the background, sprite 0 on top of the others,
+// and colour 0 in a sprite's pattern is transparent. Each sprite is:
+// x (word), y (word), pattern index (byte), flags (byte)
+// where x and y are signed screen positions of the sprite's top left.
+#define TILE_MODE_SCROLL_X          0x0000
+#define TILE_MODE_SCROLL_Y          0x0002
+#define TILE_MODE_SPRITES           0x0010
+#define TILE_MODE_SPRITE_COUNT      32
+#define TILE_MODE_SPRITE_SIZE       6
+#define TILE_MODE_MAP               0x0100
+#define TILE_MODE_MAP_WIDTH         64
+#define TILE_MODE_MAP_HEIGHT        64
+#define TILE_MODE_PATTERNS          0x1100
+#define TILE_MODE_PATTERN_COUNT     256
+#define TILE_MODE_PATTERN_SIZE      32
+#define TILE_MODE_TILE_SIZE         8
+#define TILE_MODE_MEMORY_SIZE       0x3100
+
+typedef enum _tile_mode_sprite_flags
+{
+    SPRITE_VISIBLE          = 1 << 0,
+    SPRITE_FLIP_X           = 1 << 1,
+    SPRITE_FLIP_Y           = 1 << 2,
+} tile_mode_sprite_flags_t;
+
 typedef enum _graphics_resolution
 {
     RES_120x80              = 0b000,
@@ -50,6 +85,11 @@ typedef enum _graphics_resolution
     RES_480x320             = 0b100,
 } graphics_resolution_t;
 
+// Every depth looks its colours up in a palette of this many entries,
+// only the first 2, 4 or 16 of them matter below 8bpp and in tile mode.
+// Entries are 32-bit RGBA in the renderer's byte order (R in the low byte).
+#define GRAPHICS_PALETTE_SIZE       256
+
 typedef enum _graphics_error
 {
     GRAPHICS_ERROR_OK                       = 0,
@@ -64,6 +104,9 @@ uint16_t graphics_bytes_per_line(graphics_mode_t mode);
 uint16_t graphics_pixels_per_line(graphics_mode_t mode);
 uint16_t graphics_get_row_count(graphics_mode_t mode);
 graphics_mode_t graphics_mode_byte_to_struct(uint8_t byte);
+uint32_t graphics_colour(uint8_t red, uint8_t green, uint8_t blue);
+// Fills palette with the mode's default green ramp
+void graphics_default_palette(graphics_mode_t mode, uint32_t palette[GRAPHICS_PALETTE_SIZE]);
 
 #ifdef __cplusplus
 }
@@ -37,6 +37,13 @@
 // Graphics display
 #define			SYSCALL_GRAPHICSTART    0x0400
 #define			SYSCALL_GRAPHICEND      0x0401
+#define			SYSCALL_BLITFILL        0x0402
+#define			SYSCALL_BLITCOPY        0x0403
+#define			SYSCALL_BLITMASK        0x0404
+#define			SYSCALL_BLITLINE        0x0405
+#define			SYSCALL_BLITSPAN        0x0406
+#define			SYSCALL_GRAPHICFLIP     0x0407
+#define			SYSCALL_GRAPHICPALETTE  0x0408
 
 // Audio
 #define			SYSCALL_SOUNDACK		0x0500
@@ -0,0 +1,435 @@
+#include "linker.hpp"
+#include "executable_file.h"
+#include "memory.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace
+{
+    // The same place the assembler starts putting regions
+    const uint32_t FIRST_FREE_ADDRESS = 0x100;
+
+    struct address_range_t
+    {
+        uint32_t start;
+        uint32_t end;
+    };
+
+    void add_error(std::vector<std::string> &errors, const char *format, ...)
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        errors.push_back(buffer);
+    }
+
+    std::string symbol_key(const std::string &name)
+    {
+        std::string key{ name };
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)tolower(c); });
+        return key;
+    }
+
+    bool is_address(symbol_type_t type)
+    {
+        return type == SYMBOL_ADDRESS_INST || type == SYMBOL_ADDRESS_DATA;
+    }
+
+    // First fit, the way the assembler finds room for a new region. used is
+    // kept sorted by start address.
+    int find_free_address(const std::vector<address_range_t> &used, uint32_t length)
+    {
+        uint32_t start = FIRST_FREE_ADDRESS;
+        for (auto &range : used)
+        {
+            if (range.end <= start)
+            {
+                continue;
+            }
+
+            if (range.start >= start + length)
+            {
+                break;
+            }
+
+            start = range.end;
+        }
+
+        return (start + length <= DATA_SIZE) ? (int)start : -1;
+    }
+
+    const address_range_t *find_overlap(const std::vector<address_range_t> &used, uint32_t start, uint32_t length)
+    {
+        for (auto &range : used)
+        {
+            if (start < range.end && range.start < start + length)
+            {
+                return &range;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void mark_used(std::vector<address_range_t> &used, uint32_t start, uint32_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+
+        address_range_t range{ start, start + length };
+        used.insert(std::upper_bound(used.begin(), used.end(), range,
+            [](const address_range_t &a, const address_range_t &b) { return a.start < b.start; }), range);
+    }
+
+    const char *section_kind_name(object_section_kind kind)
+    {
+        switch (kind)
+        {
+        case object_section_kind::code:
+            return "code";
+
+        case object_section_kind::data:
+            return "data";
+
+        case object_section_kind::reserved:
+        default:
+            return "reserved";
+        }
+    }
+
+    const char *symbol_type_name(symbol_type_t type)
+    {
+        switch (type)
+        {
+        case SYMBOL_WORD:
+            return "word";
+
+        case SYMBOL_BYTE:
+            return "byte";
+
+        case SYMBOL_ADDRESS_INST:
+            return "code address";
+
+        case SYMBOL_ADDRESS_DATA:
+            return "data address";
+
+        case SYMBOL_NO_TYPE:
+        default:
+            return "unknown";
+        }
+    }
+} // namespace
+
+bool link_objects(const std::vector<link_input_t> &inputs, const link_options &options, linked_program_t &program, std::vector<std::string> &errors)
+{
+    program = linked_program_t{};
+    size_t starting_error_count = errors.size();
+
+    // Index of each input's sections in program.sections
+    std::vector<std::vector<size_t>> section_indices(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        for (uint32_t j = 0; j < inputs[i].object.sections.size(); j++)
+        {
+            auto &section = inputs[i].object.sections[j];
+            section_indices[i].push_back(program.sections.size());
+            program.sections.push_back({ inputs[i].name, j, section.kind, section.address, section.length, section.data });
+        }
+    }
+
+    // Sections placed with .org have to stay where they are, so they go
+    // first and everything else fills in around them
+    std::vector<address_range_t> used;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        for (uint32_t j = 0; j < inputs[i].object.sections.size(); j++)
+        {
+            auto &section = inputs[i].object.sections[j];
+            if (!section.fixed)
+            {
+                continue;
+            }
+
+            if ((uint32_t)section.address + section.length > DATA_SIZE)
+            {
+                add_error(errors, "%s: section at 0x%04x runs past the end of memory", inputs[i].name.c_str(), section.address);
+            }
+            else if (find_overlap(used, section.address, section.length) != nullptr)
+            {
+                add_error(errors, "%s: section at 0x%04x overlaps a section from another object", inputs[i].name.c_str(), section.address);
+            }
+            else
+            {
+                mark_used(used, section.address, section.length);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        for (uint32_t j = 0; j < inputs[i].object.sections.size(); j++)
+        {
+            auto &section = inputs[i].object.sections[j];
+            if (section.fixed)
+            {
+                continue;
+            }
+
+            auto address = find_free_address(used, section.length);
+            if (address < 0)
+            {
+                add_error(errors, "%s: no room for a %s section of %d bytes", inputs[i].name.c_str(), section_kind_name(section.kind), section.length);
+                continue;
+            }
+
+            program.sections[section_indices[i][j]].address = (uint16_t)address;
+            mark_used(used, address, section.length);
+        }
+    }
+
+    if (errors.size() > starting_error_count)
+    {
+        return false;
+    }
+
+    auto section_address = [&](size_t input, int section) -> uint16_t
+    {
+        return program.sections[section_indices[input][section]].address;
+    };
+
+    // Everything every object defines, where a name can only mean one thing.
+    // Constants from a shared include come out of every object that
+    // included it, which is fine as long as they agree.
+    std::map<std::string, size_t> exports;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        for (auto &symbol : inputs[i].object.exports)
+        {
+            linked_symbol_t linked{ inputs[i].name, symbol.name, symbol.type, symbol.value };
+            if (is_address(symbol.type) && symbol.section >= 0)
+            {
+                linked.value = section_address(i, symbol.section) + symbol.value;
+            }
+
+            auto key = symbol_key(symbol.name);
+            auto existing = exports.find(key);
+            if (existing == exports.end())
+            {
+                exports.emplace(key, program.symbols.size());
+                program.symbols.push_back(linked);
+                continue;
+            }
+
+            auto &first = program.symbols[existing->second];
+            if (is_address(symbol.type) || is_address(first.type) || first.type != linked.type || first.value != linked.value)
+            {
+                add_error(errors, "Symbol %s is defined in both %s and %s", symbol.name.c_str(), first.object_name.c_str(), inputs[i].name.c_str());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        auto &object = inputs[i].object;
+        std::set<uint16_t> reported_imports;
+        for (auto &relocation : object.relocations)
+        {
+            auto &section = program.sections[section_indices[i][relocation.section]];
+            uint16_t location = section.address + relocation.offset;
+            uint16_t value;
+            std::string target_name;
+            if (relocation.target_section < 0)
+            {
+                target_name = object.imports[relocation.target];
+                auto found = exports.find(symbol_key(target_name));
+                if (found == exports.end())
+                {
+                    if (reported_imports.insert(relocation.target).second)
+                    {
+                        add_error(errors, "%s: symbol %s isn't defined in any object", inputs[i].name.c_str(), target_name.c_str());
+                    }
+                    continue;
+                }
+
+                value = program.symbols[found->second].value;
+            }
+            else
+            {
+                value = section_address(i, relocation.target_section) + relocation.target;
+                char address_name[16];
+                snprintf(address_name, sizeof(address_name), "0x%04x", value);
+                target_name = address_name;
+            }
+
+            auto bytes = &section.data[relocation.offset];
+            switch (relocation.kind)
+            {
+            case relocation_kind::word:
+                bytes[0] = (uint8_t)(value >> 8);
+                bytes[1] = (uint8_t)(value & 0xff);
+                break;
+
+            case relocation_kind::byte:
+                if (value > 0xff)
+                {
+                    add_error(errors, "%s: %s (0x%04x) doesn't fit in a byte at 0x%04x", inputs[i].name.c_str(), target_name.c_str(), value, location);
+                }
+                bytes[0] = (uint8_t)value;
+                break;
+
+            case relocation_kind::branch:
+            {
+                // Branches are relative to the branch instruction
+                auto address_offset = (int)value - ((int)location - 1);
+                if (address_offset > 127 || address_offset < -128)
+                {
+                    add_error(errors, "%s: tried to branch too far (from 0x%04x to %s)", inputs[i].name.c_str(), location - 1, target_name.c_str());
+                }
+                bytes[0] = (uint8_t)(int8_t)address_offset;
+                break;
+            }
+            }
+        }
+    }
+
+    if (!options.entry_symbol.empty())
+    {
+        auto found = exports.find(symbol_key(options.entry_symbol));
+        if (found == exports.end() || program.symbols[found->second].type != SYMBOL_ADDRESS_INST)
+        {
+            add_error(errors, "Entry point %s isn't a label in any object's code", options.entry_symbol.c_str());
+        }
+        else
+        {
+            program.execution_start = program.symbols[found->second].value;
+        }
+    }
+    else
+    {
+        auto with_entry = std::find_if(inputs.begin(), inputs.end(), [](const link_input_t &input) { return input.object.entry_section >= 0; });
+        if (with_entry == inputs.end())
+        {
+            add_error(errors, "None of the objects has an entry point, give one with --entry");
+        }
+        else
+        {
+            auto input = with_entry - inputs.begin();
+            program.execution_start = section_address(input, with_entry->object.entry_section) + with_entry->object.entry_offset;
+        }
+    }
+
+    std::stable_sort(program.sections.begin(), program.sections.end(),
+        [](const linked_section_t &a, const linked_section_t &b) { return a.address < b.address; });
+    std::stable_sort(program.symbols.begin(), program.symbols.end(),
+        [](const linked_symbol_t &a, const linked_symbol_t &b) { return a.value < b.value; });
+
+    return errors.size() == starting_error_count;
+}
+
+bool write_linked_executable(const linked_program_t &program, const char *path, std::string &error)
+{
+    // Sections that ended up back to back load as one segment, so the file
+    // only has as many segment headers as it needs
+    struct segment_t
+    {
+        uint16_t address;
+        bool is_code;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<segment_t> segments;
+    size_t file_size = sizeof(executable_file_header_t);
+    for (auto &section : program.sections)
+    {
+        if (section.data.empty())
+        {
+            continue;
+        }
+
+        bool is_code = section.kind == object_section_kind::code;
+        if (!segments.empty() && segments.back().is_code == is_code &&
+            segments.back().address + segments.back().data.size() == section.address)
+        {
+            segments.back().data.insert(segments.back().data.end(), section.data.begin(), section.data.end());
+        }
+        else
+        {
+            segments.push_back({ section.address, is_code, section.data });
+            file_size += EXEC_SEGMENT_HEADER_RAW_SIZE;
+        }
+
+        file_size += section.data.size();
+    }
+
+    if (segments.empty())
+    {
+        error = "there's nothing to output";
+        return false;
+    }
+
+    if (file_size > 0xffff)
+    {
+        error = "the program is too big for an executable";
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(file_size);
+    size_t buffer_index = 0;
+    executable_file_header_t header = { (uint16_t)file_size, (uint16_t)segments.size(), program.execution_start };
+    memcpy(&buffer[buffer_index], &header, sizeof(executable_file_header_t));
+    buffer_index += sizeof(executable_file_header_t);
+
+    for (auto &segment : segments)
+    {
+        executable_segment_header_t segment_header{};
+        segment_header.segment_location = segment.address;
+        segment_header.segment_length = (uint16_t)(EXEC_SEGMENT_HEADER_RAW_SIZE + segment.data.size());
+        segment_header.is_code = segment.is_code;
+        memcpy(&buffer[buffer_index], &segment_header, EXEC_SEGMENT_HEADER_RAW_SIZE);
+        buffer_index += EXEC_SEGMENT_HEADER_RAW_SIZE;
+        memcpy(&buffer[buffer_index], segment.data.data(), segment.data.size());
+        buffer_index += segment.data.size();
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        error = "couldn't open it for writing";
+        return false;
+    }
+
+    bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    if (fclose(file) != 0 || !written)
+    {
+        error = "couldn't write all of it";
+        return false;
+    }
+
+    return true;
+}
+
+void write_link_map(const linked_program_t &program, FILE *out)
+{
+    fprintf(out, "Execution start: 0x%04x\n", program.execution_start);
+
+    fprintf(out, "\nSections:\n");
+    for (auto &section : program.sections)
+    {
+        fprintf(out, "0x%04x-0x%04x %-8s %s (section %u)\n", section.address, section.address + section.length,
+            section_kind_name(section.kind), section.object_name.c_str(), section.section_index);
+    }
+
+    fprintf(out, "\nSymbols:\n");
+    for (auto &symbol : program.symbols)
+    {
+        fprintf(out, "0x%04x %-12s %s (%s)\n", symbol.value, symbol_type_name(symbol.type), symbol.name.c_str(), symbol.object_name.c_str());
+    }
+}
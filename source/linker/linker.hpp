@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "object_file.hpp"
+
+struct link_input_t
+{
+    // Used in error messages and the map
+    std::string name{};
+    object_file_t object{};
+};
+
+struct link_options
+{
+    // Start executing at this symbol rather than the first object's entry point
+    std::string entry_symbol{};
+};
+
+struct linked_section_t
+{
+    std::string object_name{};
+    uint32_t section_index = 0;
+    object_section_kind kind = object_section_kind::code;
+    uint16_t address = 0;
+    uint16_t length = 0;
+    // Patched contents, empty for reserved sections
+    std::vector<uint8_t> data{};
+};
+
+struct linked_symbol_t
+{
+    std::string object_name{};
+    std::string name{};
+    symbol_type_t type = SYMBOL_NO_TYPE;
+    uint16_t value = 0;
+};
+
+struct linked_program_t
+{
+    uint16_t execution_start = 0;
+    // Sorted by address
+    std::vector<linked_section_t> sections{};
+    std::vector<linked_symbol_t> symbols{};
+};
+
+// Places every section of the inputs, resolves imports against the exports
+// of all of them and applies the relocations. Nothing is shared between
+// calls, so separate links can run at the same time.
+bool link_objects(const std::vector<link_input_t> &inputs, const link_options &options, linked_program_t &program, std::vector<std::string> &errors);
+
+// Writes the program in the format from executable_file.h
+bool write_linked_executable(const linked_program_t &program, const char *path, std::string &error);
+void write_link_map(const linked_program_t &program, FILE *out);
@@ -0,0 +1,124 @@
+#include "linker.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+void usage(char** argv, po::options_description& options)
+{
+    std::filesystem::path command_path{ argv[0] };
+    std::cout << "Usage: " << command_path.filename().string() << " [options] object..." << std::endl;
+    std::cout << options << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> object_files;
+    std::string output_file;
+    std::string map_file;
+    link_options options{};
+
+    po::options_description cli_options("Allowed options");
+    cli_options.add_options()
+        ("help,?", "output the help message")
+        ("source,S", po::value<std::vector<std::string>>(&object_files), "object files (.rcobj) to link, in placement order")
+        ("output-file,O", po::value<std::string>(&output_file), "the executable to write")
+        ("map,M", po::value<std::string>(&map_file), "write where every section and symbol ended up to this file")
+        ("entry,E", po::value<std::string>(&options.entry_symbol), "label to start executing at, instead of the first object's starting point")
+        ;
+
+    po::positional_options_description positional_options;
+    positional_options.add("source", -1);
+
+    try
+    {
+        po::variables_map variables;
+        po::store(po::command_line_parser(argc, argv).options(cli_options).positional(positional_options).run(), variables);
+        po::notify(variables);
+
+        if (variables.count("help") > 0)
+        {
+            usage(argv, cli_options);
+            return 0;
+        }
+
+        if (object_files.empty())
+        {
+            std::cerr << "No object files to link" << std::endl;
+            usage(argv, cli_options);
+            return -1;
+        }
+
+        if (output_file.empty())
+        {
+            output_file = std::filesystem::path(object_files[0]).stem().string() + ".bin";
+        }
+
+        std::vector<link_input_t> inputs(object_files.size());
+        bool read_failed = false;
+        for (size_t i = 0; i < object_files.size(); i++)
+        {
+            std::string error;
+            inputs[i].name = std::filesystem::path(object_files[i]).filename().string();
+            if (!read_object_file(object_files[i].c_str(), inputs[i].object, error))
+            {
+                std::cerr << object_files[i] << " " << error << std::endl;
+                read_failed = true;
+            }
+        }
+
+        if (read_failed)
+        {
+            return -1;
+        }
+
+        linked_program_t program;
+        std::vector<std::string> errors;
+        if (!link_objects(inputs, options, program, errors))
+        {
+            for (auto& error : errors)
+            {
+                std::cerr << error << std::endl;
+            }
+            return -1;
+        }
+
+        std::string error;
+        if (!write_linked_executable(program, output_file.c_str(), error))
+        {
+            std::cerr << "Couldn't write " << output_file << ", " << error << std::endl;
+            return -1;
+        }
+
+        if (!map_file.empty())
+        {
+            FILE* map = fopen(map_file.c_str(), "w");
+            if (map == nullptr)
+            {
+                std::cerr << "Couldn't open " << map_file << " for writing" << std::endl;
+                return -1;
+            }
+
+            write_link_map(program, map);
+            fclose(map);
+        }
+
+        std::cout << "Linked " << object_files.size() << " object(s) into " << output_file << std::endl;
+    }
+    catch (std::exception& exception)
+    {
+        std::cerr << "Exception \"" << exception.what() << "\"" << std::endl;
+        return 1;
+    }
+    catch (...)
+    {
+        std::cerr << "Unknown exception" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
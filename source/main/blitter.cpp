@@ -0,0 +1,346 @@
+#include "blitter.hpp"
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+    // Pixel access for packed bitmaps. Pixels within a byte go from the low
+    // bits to the high bits, matching how the renderer reads them.
+    template <int bits_per_pixel>
+    struct packed_pixels
+    {
+        static constexpr int pixels_per_byte = 8 / bits_per_pixel;
+        static constexpr int pixel_mask = (1 << bits_per_pixel) - 1;
+
+        static uint8_t get(const uint8_t *line, int x)
+        {
+            int shift = (x % pixels_per_byte) * bits_per_pixel;
+            return (line[x / pixels_per_byte] >> shift) & pixel_mask;
+        }
+
+        static void set(uint8_t *line, int x, uint8_t colour)
+        {
+            int shift = (x % pixels_per_byte) * bits_per_pixel;
+            auto &target = line[x / pixels_per_byte];
+            target = (uint8_t)((target & ~(pixel_mask << shift)) | ((colour & pixel_mask) << shift));
+        }
+
+        // A byte with every pixel in it set to colour
+        static uint8_t replicate(uint8_t colour)
+        {
+            uint8_t result = 0;
+            for (int i = 0; i < pixels_per_byte; i++)
+            {
+                result |= (colour & pixel_mask) << (i * bits_per_pixel);
+            }
+            return result;
+        }
+
+        // How many bytes pixels [x, x + length) are spread over
+        static size_t bytes_spanned(int x, int length)
+        {
+            return (x + length - 1) / pixels_per_byte - x / pixels_per_byte + 1;
+        }
+    };
+
+    // Calls operation with the depth's bits per pixel as a compile time constant,
+    // so each of the drawing routines below gets its own specialized copy
+    template <typename Operation>
+    size_t for_depth(graphics_depth_t depth, Operation &&operation)
+    {
+        switch (depth)
+        {
+        case ONE_BIT_PER_PIXEL:
+            return operation(std::integral_constant<int, 1>{});
+
+        case TWO_BITS_PER_PIXEL:
+            return operation(std::integral_constant<int, 2>{});
+
+        case FOUR_BITS_PER_PIXEL:
+            return operation(std::integral_constant<int, 4>{});
+
+        case EIGHT_BITS_PER_PIXEL:
+            return operation(std::integral_constant<int, 8>{});
+
+        default:
+            return 0;
+        }
+    }
+
+    // Clips a rectangle to the surface. source_x/source_y move along with
+    // any part of the rectangle that gets cut off the top or left.
+    bool clip_rectangle(const blit_surface &surface, int &x, int &y, int &width, int &height, int &source_x, int &source_y)
+    {
+        if (x < 0)
+        {
+            source_x -= x;
+            width += x;
+            x = 0;
+        }
+
+        if (y < 0)
+        {
+            source_y -= y;
+            height += y;
+            y = 0;
+        }
+
+        width = std::min(width, surface.width - x);
+        height = std::min(height, surface.height - y);
+
+        return width > 0 && height > 0;
+    }
+
+    // Whole bytes in the middle of the span are set with memset, which the C
+    // library vectorizes, and only the partial bytes at the ends go pixel by pixel
+    template <int bits_per_pixel>
+    size_t fill_span(uint8_t *line, int x, int length, uint8_t colour)
+    {
+        using pixels = packed_pixels<bits_per_pixel>;
+        constexpr int pixels_per_byte = pixels::pixels_per_byte;
+
+        size_t bytes = pixels::bytes_spanned(x, length);
+        int end = x + length;
+
+        while (x < end && (x % pixels_per_byte) != 0)
+        {
+            pixels::set(line, x++, colour);
+        }
+
+        int whole_end = end - (end % pixels_per_byte);
+        if (whole_end > x)
+        {
+            memset(&line[x / pixels_per_byte], pixels::replicate(colour), (whole_end - x) / pixels_per_byte);
+            x = whole_end;
+        }
+
+        while (x < end)
+        {
+            pixels::set(line, x++, colour);
+        }
+
+        return bytes;
+    }
+
+    template <int bits_per_pixel>
+    size_t fill_rectangle(const blit_surface &surface, int x, int y, int width, int height, uint8_t colour)
+    {
+        size_t bytes = 0;
+        for (int row = y; row < y + height; row++)
+        {
+            bytes += fill_span<bits_per_pixel>(&surface.memory[row * surface.bytes_per_line], x, width, colour);
+        }
+
+        return bytes;
+    }
+
+    template <int bits_per_pixel>
+    size_t copy_rectangle(const blit_surface &surface, int source_x, int source_y, int destination_x, int destination_y, int width, int height)
+    {
+        using pixels = packed_pixels<bits_per_pixel>;
+        constexpr int pixels_per_byte = pixels::pixels_per_byte;
+
+        // Each source row is copied out before it's written back, which takes
+        // care of overlap along the row. Rows are walked bottom up when moving
+        // down, so no row is overwritten before it has been read.
+        std::vector<uint8_t> row_buffer(surface.bytes_per_line);
+        bool aligned = (source_x % pixels_per_byte) == (destination_x % pixels_per_byte);
+        int first_source_byte = source_x / pixels_per_byte;
+        int source_byte_count = (int)pixels::bytes_spanned(source_x, width);
+        size_t bytes = 0;
+
+        for (int i = 0; i < height; i++)
+        {
+            int row = destination_y > source_y ? (height - 1 - i) : i;
+            auto source_line = &surface.memory[(source_y + row) * surface.bytes_per_line];
+            auto destination_line = &surface.memory[(destination_y + row) * surface.bytes_per_line];
+
+            memcpy(&row_buffer[first_source_byte], &source_line[first_source_byte], source_byte_count);
+
+            int x = 0;
+            if (aligned)
+            {
+                while (x < width && ((destination_x + x) % pixels_per_byte) != 0)
+                {
+                    pixels::set(destination_line, destination_x + x, pixels::get(row_buffer.data(), source_x + x));
+                    x++;
+                }
+
+                int whole_pixels = ((width - x) / pixels_per_byte) * pixels_per_byte;
+                if (whole_pixels > 0)
+                {
+                    memcpy(&destination_line[(destination_x + x) / pixels_per_byte], &row_buffer[(source_x + x) / pixels_per_byte], whole_pixels / pixels_per_byte);
+                    x += whole_pixels;
+                }
+            }
+
+            for (; x < width; x++)
+            {
+                pixels::set(destination_line, destination_x + x, pixels::get(row_buffer.data(), source_x + x));
+            }
+
+            bytes += pixels::bytes_spanned(destination_x, width);
+        }
+
+        return bytes;
+    }
+
+    template <int bits_per_pixel>
+    size_t mask_rectangle(const blit_surface &surface, const uint8_t *source, int source_stride, int source_x, int source_y, int destination_x, int destination_y, int width, int height, uint8_t key_colour)
+    {
+        using pixels = packed_pixels<bits_per_pixel>;
+
+        key_colour &= pixels::pixel_mask;
+        size_t bytes = 0;
+        for (int row = 0; row < height; row++)
+        {
+            auto source_line = &source[(source_y + row) * source_stride];
+            auto destination_line = &surface.memory[(destination_y + row) * surface.bytes_per_line];
+            for (int x = 0; x < width; x++)
+            {
+                auto colour = pixels::get(source_line, source_x + x);
+                if (colour != key_colour)
+                {
+                    pixels::set(destination_line, destination_x + x, colour);
+                }
+            }
+
+            bytes += pixels::bytes_spanned(destination_x, width);
+        }
+
+        return bytes;
+    }
+
+    template <int bits_per_pixel>
+    size_t draw_line(const blit_surface &surface, int x0, int y0, int x1, int y1, uint8_t colour)
+    {
+        using pixels = packed_pixels<bits_per_pixel>;
+
+        // Bresenham, clipping each pixel as it goes
+        int delta_x = abs(x1 - x0);
+        int step_x = x0 < x1 ? 1 : -1;
+        int delta_y = -abs(y1 - y0);
+        int step_y = y0 < y1 ? 1 : -1;
+        int error = delta_x + delta_y;
+        size_t bytes = 0;
+
+        while (1)
+        {
+            if (x0 >= 0 && x0 < surface.width && y0 >= 0 && y0 < surface.height)
+            {
+                pixels::set(&surface.memory[y0 * surface.bytes_per_line], x0, colour);
+                bytes++;
+            }
+
+            if (x0 == x1 && y0 == y1)
+            {
+                break;
+            }
+
+            int doubled_error = 2 * error;
+            if (doubled_error >= delta_y)
+            {
+                error += delta_y;
+                x0 += step_x;
+            }
+
+            if (doubled_error <= delta_x)
+            {
+                error += delta_x;
+                y0 += step_y;
+            }
+        }
+
+        return bytes;
+    }
+} // namespace
+
+bool blit_surface_for_mode(graphics_mode_t mode, uint8_t *memory, blit_surface &surface)
+{
+    if (mode.depth > EIGHT_BITS_PER_PIXEL)
+    {
+        return false;
+    }
+
+    surface.memory = memory;
+    surface.depth = (graphics_depth_t)mode.depth;
+    surface.width = graphics_pixels_per_line(mode);
+    surface.height = graphics_get_row_count(mode);
+    surface.bytes_per_line = graphics_bytes_per_line(mode);
+
+    return surface.width > 0 && surface.height > 0;
+}
+
+int blit_row_bytes(graphics_depth_t depth, int width)
+{
+    return (int)for_depth(depth, [&](auto bits_per_pixel)
+    {
+        constexpr int pixels_per_byte = packed_pixels<decltype(bits_per_pixel)::value>::pixels_per_byte;
+        return (size_t)((width + pixels_per_byte - 1) / pixels_per_byte);
+    });
+}
+
+size_t blit_fill(const blit_surface &surface, int x, int y, int width, int height, uint8_t colour)
+{
+    int unused_x = 0;
+    int unused_y = 0;
+    if (!clip_rectangle(surface, x, y, width, height, unused_x, unused_y))
+    {
+        return 0;
+    }
+
+    return for_depth(surface.depth, [&](auto bits_per_pixel)
+    {
+        return fill_rectangle<decltype(bits_per_pixel)::value>(surface, x, y, width, height, colour);
+    });
+}
+
+size_t blit_span(const blit_surface &surface, int x, int y, int length, uint8_t colour)
+{
+    return blit_fill(surface, x, y, length, 1, colour);
+}
+
+size_t blit_line(const blit_surface &surface, int x0, int y0, int x1, int y1, uint8_t colour)
+{
+    return for_depth(surface.depth, [&](auto bits_per_pixel)
+    {
+        return draw_line<decltype(bits_per_pixel)::value>(surface, x0, y0, x1, y1, colour);
+    });
+}
+
+size_t blit_copy(const blit_surface &surface, int source_x, int source_y, int destination_x, int destination_y, int width, int height)
+{
+    // Clip against the destination, then again against the source going the other way
+    if (!clip_rectangle(surface, destination_x, destination_y, width, height, source_x, source_y) ||
+        !clip_rectangle(surface, source_x, source_y, width, height, destination_x, destination_y))
+    {
+        return 0;
+    }
+
+    return for_depth(surface.depth, [&](auto bits_per_pixel)
+    {
+        return copy_rectangle<decltype(bits_per_pixel)::value>(surface, source_x, source_y, destination_x, destination_y, width, height);
+    });
+}
+
+size_t blit_mask(const blit_surface &surface, const uint8_t *source, int source_rows, int destination_x, int destination_y, int width, int height, uint8_t key_colour)
+{
+    int source_stride = blit_row_bytes(surface.depth, width);
+    int source_x = 0;
+    int source_y = 0;
+
+    height = std::min(height, source_rows);
+    if (!clip_rectangle(surface, destination_x, destination_y, width, height, source_x, source_y))
+    {
+        return 0;
+    }
+
+    return for_depth(surface.depth, [&](auto bits_per_pixel)
+    {
+        return mask_rectangle<decltype(bits_per_pixel)::value>(surface, source, source_stride, source_x, source_y, destination_x, destination_y, width, height, key_colour);
+    });
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "graphics.h"
+
+// A bitmap in emulated memory that the blitter draws into
+struct blit_surface
+{
+    uint8_t *memory;
+    graphics_depth_t depth;
+    int width;
+    int height;
+    int bytes_per_line;
+};
+
+// Returns false for modes the blitter can't draw into (tile mode)
+bool blit_surface_for_mode(graphics_mode_t mode, uint8_t *memory, blit_surface &surface);
+
+// All of these clip to the surface, and return how many bytes of
+// graphics memory were written so the caller can charge cycles for them.
+// Colours are palette indices, masked to the surface's depth.
+
+size_t blit_fill(const blit_surface &surface, int x, int y, int width, int height, uint8_t colour);
+size_t blit_span(const blit_surface &surface, int x, int y, int length, uint8_t colour);
+size_t blit_line(const blit_surface &surface, int x0, int y0, int x1, int y1, uint8_t colour);
+
+// Copies a rectangle within the surface, the source and destination can overlap
+size_t blit_copy(const blit_surface &surface, int source_x, int source_y, int destination_x, int destination_y, int width, int height);
+
+// Copies a packed bitmap of the surface's depth onto it, skipping pixels that
+// are the key colour. Each source row starts on a byte boundary.
+// source_rows is how many complete rows are actually readable at source.
+size_t blit_mask(const blit_surface &surface, const uint8_t *source, int source_rows, int destination_x, int destination_y, int width, int height, uint8_t key_colour);
+
+// Bytes used by one row of a packed bitmap with the given depth
+int blit_row_bytes(graphics_depth_t depth, int width);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "Console.h"
+#include "graphics.h"
+
+enum class snapshot_content
+{
+    console,
+    graphics,
+};
+
+// Everything the render loop needs to draw one frame, copied out of the
+// emulator at a frame boundary so the renderer never touches live state
+struct frame_snapshot
+{
+    frame_snapshot() : console(1, 1) {}
+
+    snapshot_content content = snapshot_content::console;
+    Console console;
+    graphics_mode_t graphics_mode{};
+    std::vector<uint8_t> graphics_memory;
+    std::array<uint32_t, GRAPHICS_PALETTE_SIZE> palette{};
+
+    // graphics_generation is the emulator's generation when graphics_memory was
+    // copied, sequence counts published frames
+    uint32_t graphics_generation = 0;
+    uint32_t palette_generation = 0;
+    uint32_t sequence = 0;
+};
+
+// Lock-free triple buffer with one writer and one reader.
+// The writer fills back() and calls publish(), the reader calls acquire()
+// and then reads front(). Neither side ever waits on the other, and the
+// reader always gets the most recently published slot.
+template <typename T>
+class triple_buffer
+{
+public:
+    T &back() { return slots[back_index]; }
+    T &front() { return slots[front_index]; }
+
+    void publish()
+    {
+        back_index = middle.exchange(back_index | fresh_flag, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Returns false if nothing new has been published since the last call
+    bool acquire()
+    {
+        if ((middle.load(std::memory_order_relaxed) & fresh_flag) == 0)
+        {
+            return false;
+        }
+
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+private:
+    static constexpr uint8_t index_mask = 0x03;
+    static constexpr uint8_t fresh_flag = 0x04;
+
+    T slots[3];
+    uint8_t back_index = 0;
+    uint8_t front_index = 1;
+    std::atomic<uint8_t> middle{ 2 };
+};
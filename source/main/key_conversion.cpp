@@ -27,6 +27,14 @@ int sdl_scancode_to_console_key(SDL_Scancode code)
             console_key = (int)console_keycode::KEY_END;
             break;
 
+        case SDLK_PAGEUP:
+            console_key = (int)console_keycode::KEY_PAGE_UP;
+            break;
+
+        case SDLK_PAGEDOWN:
+            console_key = (int)console_keycode::KEY_PAGE_DOWN;
+            break;
+
         case SDLK_LEFT:
             console_key = (int)console_keycode::KEY_LEFT_ARROW;
             break;
@@ -1,4 +1,6 @@
 #include "ConsoleSDLRenderer.h"
+#include "ConsoleBufferRenderer.h"
+#include "FrameRecorder.h"
 #include "Console.h"
 #include "emulator.h"
 #include "syscall.h"
@@ -11,20 +13,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <chrono>
+#include <ctime>
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 #include <boost/program_options.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/algorithm/string/join.hpp>
 
 #include "syscall_handlers.h"
 #include "syscall_holotape_handlers.h"
 #include "key_conversion.h"
 #include "assembler.hpp"
+#include "debug_info.hpp"
+#include "build_cache.hpp"
+#include "binary_stream.hpp"
 #include "opcodes.h"
 #include "sound_system.hpp"
 #include "exceptions.hpp"
 #include "console_drawer.hpp"
 #include "program_options_helpers.hpp"
 #include "filesystem_viewer.hpp"
+#include "frame_snapshot.hpp"
 
 namespace po = boost::program_options;
 
@@ -39,15 +51,41 @@ namespace
     };
 
     const int configuration_console_frame_time = 16;
+
+    // How long the emulation thread waits between snapshots while it has nothing to execute
+    const int idle_frame_time = 10;
+
+    // Input handed from the event loop to the emulation thread
+    enum class emulator_input_type
+    {
+        key,
+        resume,
+        scroll_view,
+        frame_presented,
+    };
+
+    struct emulator_input
+    {
+        emulator_input_type type;
+        int key;
+    };
+
+    const size_t emulator_input_queue_size = 256;
 } // namespace
 
-void handle_key(SDL_Keysym &keysym, emulator &emulator, Console &console)
+template<typename queue_type>
+void handle_key(SDL_Keysym &keysym, queue_type &inputs)
 {
     auto keycode = sdl_keycode_to_console_key(keysym);
 
-    if (keycode != 0)
+    if (keycode == (int)console_keycode::KEY_PAGE_UP || keycode == (int)console_keycode::KEY_PAGE_DOWN)
+    {
+        // Page up/down move through the console's scrollback rather than going to the program
+        inputs.push(emulator_input{ emulator_input_type::scroll_view, keycode });
+    }
+    else if (keycode != 0)
     {
-        handle_keypress_for_syscall(emulator, keycode);
+        inputs.push(emulator_input{ emulator_input_type::key, keycode });
     }
 }
 
@@ -93,22 +131,44 @@ int main (int argc, char **argv)
         ("device,D", po::value<std::string>(), "the audio device to use")
         ("font,F", po::value<std::string>(&font_name)->default_value("font/robco-termfont.png"), "font image file")
         ("source,S", po::value<std::string>(), "assembly source file to run")
+        ("optimize,O", "run the assembler's peephole optimizer over the source before running it")
+        ("strip", "leave routines, data and constants the program never uses out of memory")
+        ("build-cache", po::value<std::string>(), "directory to keep assembled sources in, so one that hasn't changed starts without being assembled again")
+        ("debug-info,G", po::value<std::string>(), "a .rcdbg file for the program on the tape, so the debugger can show source lines")
         ("tape,T", po::value<std::string>(), "a file containing holotape data to be used by the emulator")
         ("exec-tape,X", "execute the first file on the tape provided")
+        ("headless", "render into an offscreen buffer instead of opening a window")
+        ("dump-frames", po::value<std::string>(), "directory into which headless frames are written")
+        ("frame-format", po::value<std::string>()->default_value("png"), "how headless frames are dumped (png, ppm or hash)")
+        ("frame-limit", po::value<int>(), "stop after this many frames have been rendered headless")
+        ("scrollback", po::value<int>()->default_value(500), "lines of console scrollback to keep, viewed with page up/down")
+        ("record", po::value<std::string>(), "record the screen to this .y4m file from startup (F7 toggles recording)")
         ;
 
     po::variables_map variables;
     po::store(po::command_line_parser(argc, argv).options(cli_options).run(), variables);
 
     emulator rcEmulator;
-    ConsoleSDLRenderer *renderer = nullptr;
+    ConsoleRenderer *renderer = nullptr;
+    ConsoleBufferRenderer *buffer_renderer = nullptr;
+    std::unique_ptr<FrameRecorder> recorder{};
+    std::vector<std::unique_ptr<FrameRecorder>> finishing_recorders{};
     bool sdl_initialized = false;
     bool emulator_initialized = false;
     sound_system* synthesizer = nullptr;
-    Console console(60, 24);
+    int scrollback_lines = variables.count("scrollback") > 0 ? variables["scrollback"].as<int>() : 0;
+    Console console(60, 24, scrollback_lines);
     Console debugConsole(60, 24);
     Console uiConsole(60, 24);
-    EmulatorState emulator_state = EmulatorState::Emulating;
+    std::atomic<EmulatorState> emulator_state{ EmulatorState::Emulating };
+    std::atomic<bool> done{ false };
+    std::atomic<bool> show_screen_when_debugging{ false };
+    std::mutex emulator_mutex;
+    boost::lockfree::spsc_queue<emulator_input, boost::lockfree::capacity<emulator_input_queue_size>> emulator_inputs;
+    triple_buffer<frame_snapshot> frames;
+    // Source lines and symbols for the program being run, if there are any
+    debug_info_t debug_info;
+    int exit_code = 0;
 
     auto teardown = [&]() {
         if (holotape_initialized())
@@ -131,6 +191,10 @@ int main (int argc, char **argv)
             delete renderer;
         }
 
+        // These wait for any queued frames to be written out
+        recorder.reset();
+        finishing_recorders.clear();
+
         if (sdl_initialized)
         {
             SDL_Quit();
@@ -169,15 +233,18 @@ int main (int argc, char **argv)
             file_viewer_active = false;
             if (std::regex_match(selected.filename().string(), holo_regex))
             {
-                if (execute_tape(rcEmulator, console, selected.string(), teardown, true))
+                // The emulation thread is still running at this point, so it has to be
+                // stopped and joined before anything gets torn down
+                std::lock_guard<std::mutex> emulator_lock(emulator_mutex);
+                if (execute_tape(rcEmulator, console, selected.string(), []() {}, true))
                 {
                     emulator_state = EmulatorState::Emulating;
                 }
                 else
                 {
-                    teardown();
                     std::cerr << "Your selected tape file could not be executed (" << selected << ")" << std::endl;
-                    exit(-1);
+                    exit_code = -1;
+                    done = true;
                 }
             }
         }
@@ -190,6 +257,10 @@ int main (int argc, char **argv)
         conflicting_options(variables, "source", "exec-tape");
         option_dependency(variables, "exec-tape", "tape");
         option_dependency(variables, "include", "source");
+        option_dependency(variables, "build-cache", "source");
+        option_dependency(variables, "strip", "source");
+        option_dependency(variables, "dump-frames", "headless");
+        option_dependency(variables, "frame-limit", "headless");
 
         one_of_options_required(variables, one_of_options);
 
@@ -215,6 +286,18 @@ int main (int argc, char **argv)
             insert_holotape(variables["tape"].as<std::string>().c_str());
         }
 
+        if (variables.count("debug-info") > 0)
+        {
+            std::string error;
+            auto debug_info_path = variables["debug-info"].as<std::string>();
+            if (!read_debug_info(debug_info_path.c_str(), debug_info, error))
+            {
+                std::cerr << "Debug info " << debug_info_path << " " << error << std::endl;
+                teardown();
+                return -1;
+            }
+        }
+
         if (variables.count("source") > 0)
         {
             const char* sample_file = variables["source"].as<std::string>().c_str();
@@ -228,32 +311,80 @@ int main (int argc, char **argv)
 
             paths[variables.count("include")] = 0;
 
-            assembler_data_t *assembled_data;
-            assemble(sample_file, paths.get(), nullptr, assembler_output_type::none, &assembled_data);
-
-            if (get_error_buffer_size(assembled_data) > 0)
+            assembler_options options{};
+            options.optimize = variables.count("optimize") > 0;
+            options.strip_unused = variables.count("strip") > 0;
+
+            // With a build cache the source is read once, to look it up and
+            // then to assemble it if it isn't there
+            std::unique_ptr<build_cache> builds;
+            std::vector<uint8_t> source;
+            uint64_t build_key = 0;
+            cached_build_t build;
+            bool build_found = false;
+            if (variables.count("build-cache") > 0 && read_binary_file(sample_file, source))
             {
-                std::cerr << get_error_buffer(assembled_data) << std::endl;
-                teardown();
-                return -1;
+                builds.reset(new build_cache(variables["build-cache"].as<std::string>().c_str()));
+                build_key = build_cache::key(reinterpret_cast<const char*>(source.data()), source.size(), paths.get(), options);
+                build_found = builds->find(build_key, build);
             }
 
-            auto apply_result = apply_assembled_data_to_buffer(assembled_data, rcEmulator.memories.data);
-
-            if (apply_result != assembler_status::SUCCESS)
+            if (build_found)
             {
-                std::cerr << "Failed to properly assemble the target " << sample_file << std::endl;
-                teardown();
-                return -1;
+                for (auto &segment : build.segments)
+                {
+                    memcpy(&rcEmulator.memories.data[segment.address], segment.bytes.data(), segment.bytes.size());
+                }
+
+                rcEmulator.PC = build.execution_start;
+                if (debug_info.empty())
+                {
+                    debug_info = std::move(build.debug_info);
+                }
             }
+            else
+            {
+                auto assembled_data = builds != nullptr
+                    ? assemble_from_memory(sample_file, reinterpret_cast<const char*>(source.data()), source.size(), paths.get(), nullptr, options)
+                    : assemble(sample_file, paths.get(), nullptr, options);
+
+                if (get_error_buffer_size(assembled_data.get()) > 0)
+                {
+                    std::cerr << get_error_buffer(assembled_data.get()) << std::endl;
+                    teardown();
+                    return -1;
+                }
 
-            auto exec_address_result = get_starting_executable_address(assembled_data, &rcEmulator.PC);
+                auto apply_result = apply_assembled_data_to_buffer(assembled_data.get(), rcEmulator.memories.data);
 
-            if (exec_address_result != assembler_status::SUCCESS)
-            {
-                std::cerr << "Couldn't get an executable address from the assembled target " << sample_file << std::endl;
-                teardown();
-                return -1;
+                if (apply_result != assembler_status::SUCCESS)
+                {
+                    std::cerr << "Failed to properly assemble the target " << sample_file << std::endl;
+                    teardown();
+                    return -1;
+                }
+
+                auto exec_address_result = get_starting_executable_address(assembled_data.get(), &rcEmulator.PC);
+
+                if (exec_address_result != assembler_status::SUCCESS)
+                {
+                    std::cerr << "Couldn't get an executable address from the assembled target " << sample_file << std::endl;
+                    teardown();
+                    return -1;
+                }
+
+                if (builds != nullptr)
+                {
+                    debug_info_t build_debug_info;
+                    collect_debug_info(assembled_data.get(), build_debug_info);
+                    builds->store(build_key, assembled_data.get(), build_debug_info);
+                }
+
+                // A .rcdbg given with -G wins, as it does for a cached build
+                if (debug_info.empty())
+                {
+                    collect_debug_info(assembled_data.get(), debug_info);
+                }
             }
         }
         else if (variables.count("exec-tape") > 0)
@@ -275,7 +406,8 @@ int main (int argc, char **argv)
             return -1;
         }
         
-        auto result = SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+        bool headless = variables.count("headless") > 0;
+        auto result = SDL_Init(headless ? SDL_INIT_EVENTS : (SDL_INIT_EVENTS | SDL_INIT_VIDEO | SDL_INIT_AUDIO));
         if (result != 0)
         {
             std::cerr << "Failed to initialize SDL (" << SDL_GetError() << ")" << std::endl;
@@ -285,31 +417,51 @@ int main (int argc, char **argv)
 
         sdl_initialized = true;
 
-        if (variables.count("device") > 0)
-        {
-            synthesizer = new sound_system(variables["device"].as<std::string>());
-        }
-        else
+        // No audio on a headless run, sound commands are dropped
+        if (!headless)
         {
-            synthesizer = new sound_system();
-        }
+            if (variables.count("device") > 0)
+            {
+                synthesizer = new sound_system(variables["device"].as<std::string>());
+            }
+            else
+            {
+                synthesizer = new sound_system();
+            }
 
-        if (synthesizer->is_initialized())
-        {
-            synthesizer->start_worker_thread();
-        }
-        else
-        {
-            std::cerr << "Failed to initialize sound system with error \"" << synthesizer->get_error() << "\"" << std::endl;
-            teardown();
-            return -1;
+            if (synthesizer->is_initialized())
+            {
+                synthesizer->start_worker_thread();
+            }
+            else
+            {
+                std::cerr << "Failed to initialize sound system with error \"" << synthesizer->get_error() << "\"" << std::endl;
+                teardown();
+                return -1;
+            }
         }
 
         if (variables.count("font") > 0)
         {
             auto fontfilename = font_name.c_str();
             // Format of the font file is 16 chars wide, 8 chars tall
-            renderer = new ConsoleSDLRenderer(fontfilename, 480, 320, 0xFF00FF00, 0xFF000000, 0xFF007F00, 0xFF000000, 16, 16, 100);
+            if (headless)
+            {
+                buffer_renderer = new ConsoleBufferRenderer(fontfilename, 480, 320, 0xFF00FF00, 0xFF000000, 0xFF007F00, 0xFF000000, 16, 16, 100);
+                renderer = buffer_renderer;
+            }
+            else
+            {
+                renderer = new ConsoleSDLRenderer(fontfilename, 480, 320, 0xFF00FF00, 0xFF000000, 0xFF007F00, 0xFF000000, 16, 16, 100);
+            }
+
+            if (!renderer->IsValid())
+            {
+                std::cerr << "Failed to initialize the renderer" << std::endl;
+                teardown();
+                return -1;
+            }
+
             renderer->Clear();
         }
         else
@@ -322,19 +474,54 @@ int main (int argc, char **argv)
 
         if (renderer != nullptr)
         {
-            bool done = false;
-            bool emulate = true;
             SDL_Event event;
             int frame = 0;
-            opcode_entry_t* executed_opcode = nullptr;
             int key_buffer_size = 0;
             const uint8_t *key_buffer = nullptr;
+            int frames_dumped = 0;
+            // The generation of the graphics last rendered, 0 when something else was
+            uint32_t rendered_generation = 0;
+            uint32_t palette_generation = 0;
+            int frame_limit = variables.count("frame-limit") > 0 ? variables["frame-limit"].as<int>() : 0;
+            std::string frame_format = variables["frame-format"].as<std::string>();
+            std::filesystem::path frame_directory{};
+            if (variables.count("dump-frames") > 0)
+            {
+                frame_directory = variables["dump-frames"].as<std::string>();
+                std::filesystem::create_directories(frame_directory);
+            }
+
+            auto start_recording = [&](const std::string &path)
+            {
+                recorder.reset(new FrameRecorder(path.c_str(), 480, 320));
+                if (recorder->IsValid())
+                {
+                    std::cout << "Recording to " << path << std::endl;
+                    renderer->SetRecorder(recorder.get());
+                    // Make sure the recording gets a first frame even if the screen doesn't change
+                    rendered_generation = 0;
+                }
+                else
+                {
+                    recorder.reset();
+                }
+            };
 
-            int debugging_lines_start = console.GetHeight() - DEBUGGING_BUFFER_COUNT;
-            char *debugging_buffers[DEBUGGING_BUFFER_COUNT]{};
-            for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
+            auto stop_recording = [&]()
             {
-                debugging_buffers[i] = new char[LINE_BUFFER_SIZE + 1];
+                renderer->SetRecorder(nullptr);
+                if (recorder->GetDroppedFrames() > 0)
+                {
+                    std::cout << "Recording stopped, " << recorder->GetDroppedFrames() << " frames were dropped" << std::endl;
+                }
+                // Let the worker finish writing in the background, it's cleaned up once it's done
+                recorder->Stop();
+                finishing_recorders.push_back(std::move(recorder));
+            };
+
+            if (variables.count("record") > 0)
+            {
+                start_recording(variables["record"].as<std::string>());
             }
 
             if (emulator_state == EmulatorState::Debugging)
@@ -342,16 +529,194 @@ int main (int argc, char **argv)
                 rcEmulator.current_state = DEBUGGING;
             }
 
-            while (!done)
+            // The emulator runs on its own thread and publishes a snapshot of what
+            // should be on screen after every batch of cycles, so a slow present
+            // or vsync on this thread never holds up emulation.
+            // SDL wants rendering and event handling on the thread that created
+            // the window (the main thread on macOS), so those stay here.
+            std::thread emulation_thread([&]()
             {
-                inst_result_t result = SUCCESS;
+                // Each emulated cycle takes a microsecond
+                auto spend_cycles = [](uint32_t cycles)
+                {
+                    auto cycle_time = std::chrono::microseconds(cycles);
+                    auto end_time = cycle_time + std::chrono::high_resolution_clock::now();
+                    while (std::chrono::high_resolution_clock::now() < end_time)
+                    {
+                        // max_cycles microseconds of spinning isn't gonna hurt anything
+                    }
+                };
+
+                opcode_entry_t* executed_opcode = nullptr;
+                address_t executed_address = 0;
+                uint32_t published_frames = 0;
+                // The frame a waiting GRAPHICFLIP was published in, 0 when nothing's waiting
+                uint32_t flip_frame = 0;
+                int debugging_lines_start = console.GetHeight() - DEBUGGING_BUFFER_COUNT;
+                char *debugging_buffers[DEBUGGING_BUFFER_COUNT]{};
+                for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
+                {
+                    debugging_buffers[i] = new char[LINE_BUFFER_SIZE + 1];
+                }
+
+                while (!done)
+                {
+                    if (emulator_state == EmulatorState::Configuring)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(idle_frame_time));
+                        continue;
+                    }
 
-                if (emulator_state == EmulatorState::Debugging)
+                    std::unique_lock<std::mutex> emulator_lock(emulator_mutex);
+
+                    emulator_input input;
+                    while (emulator_inputs.pop(input))
+                    {
+                        if (input.type == emulator_input_type::key)
+                        {
+                            handle_keypress_for_syscall(rcEmulator, input.key);
+                        }
+                        else if (input.type == emulator_input_type::scroll_view)
+                        {
+                            int page = console.GetHeight() - 1;
+                            console.ScrollView(input.key == (int)console_keycode::KEY_PAGE_UP ? page : -page);
+                        }
+                        else if (input.type == emulator_input_type::frame_presented)
+                        {
+                            if (flip_frame != 0 && (uint32_t)input.key >= flip_frame)
+                            {
+                                handle_frame_presented_for_syscall(rcEmulator);
+                                flip_frame = 0;
+                            }
+                        }
+                        else if (rcEmulator.current_state == DEBUGGING)
+                        {
+                            rcEmulator.current_state = RUNNING;
+                        }
+                    }
+
+                    bool executed = false;
+                    if (emulator_can_execute(&rcEmulator))
+                    {
+                        executed = true;
+                        inst_result_t result = SUCCESS;
+                        const int max_cycles = 10000;
+                        int current_cycle = 0;
+                        do
+                        {
+                            executed_address = rcEmulator.PC;
+                            result = execute_instruction(&rcEmulator, &executed_opcode);
+                            if (executed_opcode != nullptr && executed_opcode->cycles > 0)
+                            {
+                                current_cycle += executed_opcode->cycles;
+                                spend_cycles(executed_opcode->cycles);
+                            }
+                            else
+                            {
+                                current_cycle++;
+                            }
+
+                            if (emulator_state == EmulatorState::Debugging)
+                            {
+                                break;
+                            }
+                        } while (result == SUCCESS && current_cycle <= max_cycles && emulator_can_execute(&rcEmulator));
+
+                        if (result == EXECUTE_SYSCALL)
+                        {
+                            handle_current_syscall(rcEmulator, console, synthesizer);
+
+                            // Some syscalls cost more depending on how much they did, like blits
+                            if (rcEmulator.syscall_cycles > 0)
+                            {
+                                spend_cycles(rcEmulator.syscall_cycles);
+                                rcEmulator.syscall_cycles = 0;
+                            }
+                        }
+                        else if (result == ILLEGAL_INSTRUCTION)
+                        {
+                            std::cerr << "Emulation failed with an illegal instruction at 0x" << std::hex << executed_address << std::dec;
+                            if (!debug_info.empty())
+                            {
+                                std::cerr << " " << debug_info.describe(executed_address);
+                            }
+                            std::cerr << std::endl;
+                        }
+
+                        if (emulator_state == EmulatorState::Debugging && rcEmulator.current_state != WAITING)
+                        {
+                            rcEmulator.current_state = DEBUGGING;
+                        }
+                    }
+
+                    // Frame boundary, hand the current screen contents over to the render loop
+                    auto &snapshot = frames.back();
+                    if (!show_screen_when_debugging && (emulator_state == EmulatorState::Debugging || rcEmulator.current_state == DEBUGGING))
+                    {
+                        get_debug_info(&rcEmulator, debugging_buffers);
+                        debugConsole.Clear();
+                        for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
+                        {
+                            debugConsole.PrintLineAt(debugging_buffers[i], 2, debugging_lines_start + i);
+                        }
+
+                        if (!debug_info.empty())
+                        {
+                            auto source_line = "Source: " + debug_info.describe(rcEmulator.PC);
+                            debugConsole.PrintLineAt(source_line.c_str(), 2, debugging_lines_start - 2);
+                        }
+
+                        snapshot.content = snapshot_content::console;
+                        snapshot.console.CopyFrom(debugConsole);
+                    }
+                    else if (rcEmulator.graphics_mode.enabled)
+                    {
+                        snapshot.content = snapshot_content::graphics;
+
+                        // Only the buffer on screen is copied, and not even that if this
+                        // slot already holds it from an earlier frame
+                        if (snapshot.graphics_generation != rcEmulator.graphics_generation)
+                        {
+                            auto graphics_size = std::min<size_t>(rcEmulator.graphics_size, DATA_SIZE - rcEmulator.graphics_start);
+                            auto graphics_memory = &rcEmulator.memories.data[rcEmulator.graphics_start];
+                            snapshot.graphics_mode = rcEmulator.graphics_mode;
+                            snapshot.graphics_memory.assign(graphics_memory, graphics_memory + graphics_size);
+                            snapshot.graphics_generation = rcEmulator.graphics_generation;
+                            std::copy_n(rcEmulator.graphics_palette, GRAPHICS_PALETTE_SIZE, snapshot.palette.begin());
+                            snapshot.palette_generation = rcEmulator.graphics_palette_generation;
+                        }
+                    }
+                    else
+                    {
+                        snapshot.content = snapshot_content::console;
+                        snapshot.console.CopyFrom(console);
+                    }
+                    snapshot.sequence = ++published_frames;
+                    frames.publish();
+
+                    if (flip_frame == 0 && is_waiting_for_frame(rcEmulator))
+                    {
+                        flip_frame = published_frames;
+                    }
+
+                    emulator_lock.unlock();
+
+                    if (!executed)
+                    {
+                        // Nothing to run until input arrives, don't spin on it
+                        std::this_thread::sleep_for(std::chrono::milliseconds(idle_frame_time));
+                    }
+                }
+
+                for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
                 {
-                    get_debug_info(&rcEmulator, debugging_buffers);
+                    delete [] (debugging_buffers[i]);
                 }
+            });
 
-                if (SDL_PollEvent(&event))
+            while (!done)
+            {
+                while (SDL_PollEvent(&event))
                 {
                     if (event.type == SDL_QUIT)
                     {
@@ -363,6 +728,7 @@ int main (int argc, char **argv)
                         {
                             if (emulator_state == EmulatorState::Configuring)
                             {
+                                std::lock_guard<std::mutex> emulator_lock(emulator_mutex);
                                 emulator_state = (rcEmulator.current_state == DEBUGGING) ? EmulatorState::Debugging : EmulatorState::Emulating;
                             }
                             else
@@ -371,15 +737,26 @@ int main (int argc, char **argv)
                                 file_viewer_active = true;
                             }
                         }
-                        if (event.key.keysym.sym == SDLK_F5)
+                        if (event.key.keysym.sym == SDLK_F7)
+                        {
+                            if (recorder)
+                            {
+                                stop_recording();
+                            }
+                            else
+                            {
+                                char recording_name[64];
+                                auto now = std::time(nullptr);
+                                std::strftime(recording_name, sizeof(recording_name), "robcoterm_%Y%m%d_%H%M%S.y4m", std::localtime(&now));
+                                start_recording(recording_name);
+                            }
+                        }
+                        else if (event.key.keysym.sym == SDLK_F5)
                         {
                             if (emulator_state == EmulatorState::Debugging)
                             {
                                 emulator_state = EmulatorState::Emulating;
-                                if (rcEmulator.current_state == DEBUGGING)
-                                {
-                                    rcEmulator.current_state = RUNNING;
-                                }
+                                emulator_inputs.push(emulator_input{ emulator_input_type::resume, 0 });
                             }
                         }
                         else if (emulator_state == EmulatorState::Configuring)
@@ -413,7 +790,7 @@ int main (int argc, char **argv)
                         }
                         else
                         {
-                            handle_key(event.key.keysym, rcEmulator, console);
+                            handle_key(event.key.keysym, emulator_inputs);
                         }
                     }
                     else if (event.type == SDL_MOUSEBUTTONDOWN)
@@ -428,17 +805,16 @@ int main (int argc, char **argv)
                             }
                             else
                             {
-                                if (rcEmulator.current_state == DEBUGGING)
-                                {
-                                    rcEmulator.current_state = RUNNING;
-                                }
-
+                                emulator_inputs.push(emulator_input{ emulator_input_type::resume, 0 });
                                 emulator_state = EmulatorState::Debugging;
                             }
                         }
                     }
                 }
 
+                finishing_recorders.erase(std::remove_if(finishing_recorders.begin(), finishing_recorders.end(),
+                    [](const std::unique_ptr<FrameRecorder> &finishing) { return finishing->IsFinished(); }), finishing_recorders.end());
+
                 key_buffer = SDL_GetKeyboardState(&key_buffer_size);
                 for (int i = 0; i < key_buffer_size; i++)
                 {
@@ -452,7 +828,7 @@ int main (int argc, char **argv)
                     }
                 }
 
-                bool show_screen_when_debugging = SDL_GetMouseState(nullptr, nullptr) & SDL_BUTTON(SDL_BUTTON_RIGHT);
+                show_screen_when_debugging = SDL_GetMouseState(nullptr, nullptr) & SDL_BUTTON(SDL_BUTTON_RIGHT);
                 if (emulator_state == EmulatorState::Configuring)
                 {
                     // Pause for a bit
@@ -473,77 +849,72 @@ int main (int argc, char **argv)
 
                     renderer->Render(&uiConsole, frame++);
                     renderer->SetCursorBlinkFrames(previousBlinkFrames);
+                    rendered_generation = 0;
                 }
-                else if (!show_screen_when_debugging && (emulator_state == EmulatorState::Debugging || rcEmulator.current_state == DEBUGGING))
-                {
-                    debugConsole.Clear();
-                    for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
-                    {
-                        debugConsole.PrintLineAt(debugging_buffers[i], 2, debugging_lines_start + i);
-                    }
-                    renderer->Render(&debugConsole, frame++);
-                }
-                else
+                else if (frames.acquire())
                 {
-                    if (rcEmulator.graphics_mode.enabled)
+                    auto &snapshot = frames.front();
+                    if (snapshot.content == snapshot_content::graphics)
                     {
-                        renderer->Render(&rcEmulator);
+                        if (snapshot.palette_generation != palette_generation)
+                        {
+                            renderer->SetPalette(snapshot.palette.data());
+                            palette_generation = snapshot.palette_generation;
+                        }
+
+                        // Nothing was written to the screen or flipped since the last frame,
+                        // so what's already presented is still right. Headless runs dump
+                        // and count every frame, so those always render.
+                        if (snapshot.graphics_generation != rendered_generation || buffer_renderer != nullptr)
+                        {
+                            renderer->Render(snapshot.graphics_mode, snapshot.graphics_memory.data());
+                            rendered_generation = snapshot.graphics_generation;
+                        }
                     }
                     else
                     {
-                        renderer->Render(&console, frame++);
+                        renderer->Render(&snapshot.console, frame++);
+                        rendered_generation = 0;
                     }
+
+                    emulator_inputs.push(emulator_input{ emulator_input_type::frame_presented, (int)snapshot.sequence });
+                }
+                else
+                {
+                    // No new frame yet
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 }
 
-                if (emulator_state != EmulatorState::Configuring && emulator_can_execute(&rcEmulator))
+                if (buffer_renderer != nullptr && buffer_renderer->GetFrameCount() > frames_dumped)
                 {
-                    const int max_cycles = 10000;
-                    int current_cycle = 0;
-                    do
+                    frames_dumped = buffer_renderer->GetFrameCount();
+                    if (frame_format == "hash")
                     {
-                        result = execute_instruction(&rcEmulator, &executed_opcode);
-                        if (executed_opcode != nullptr && executed_opcode->cycles > 0)
+                        printf("frame %d 0x%016llx\n", frames_dumped, (unsigned long long)buffer_renderer->HashFrame());
+                    }
+                    else if (!frame_directory.empty())
+                    {
+                        char frame_name[32];
+                        snprintf(frame_name, sizeof(frame_name), "frame_%06d.%s", frames_dumped, frame_format == "ppm" ? "ppm" : "png");
+                        auto frame_path = (frame_directory / frame_name).string();
+                        if (frame_format == "ppm")
                         {
-                            current_cycle += executed_opcode->cycles;
-                            auto cycle_time = std::chrono::microseconds(executed_opcode->cycles);
-                            auto end_time = cycle_time + std::chrono::high_resolution_clock::now();
-                            while (std::chrono::high_resolution_clock::now() < end_time)
-                            {
-                                // max_cycles microseconds of spinning isn't gonna hurt anything
-                            }
+                            buffer_renderer->WritePPM(frame_path.c_str());
                         }
                         else
                         {
-                            current_cycle++;
+                            buffer_renderer->WritePNG(frame_path.c_str());
                         }
-
-                        if (emulator_state == EmulatorState::Debugging)
-                        {
-                            break;
-                        }
-                    } while (result == SUCCESS && current_cycle <= max_cycles && emulator_can_execute(&rcEmulator));
-
-                    if (result == EXECUTE_SYSCALL)
-                    {
-                        handle_current_syscall(rcEmulator, console, synthesizer);
-                    }
-                    else if (result == ILLEGAL_INSTRUCTION)
-                    {
-                        std::cerr << "Emulation failed with an illegal instruction" << std::endl;
-                        emulate = false;
                     }
 
-                    if (emulator_state == EmulatorState::Debugging && rcEmulator.current_state != WAITING)
+                    if (frame_limit > 0 && frames_dumped >= frame_limit)
                     {
-                        rcEmulator.current_state = DEBUGGING;
+                        done = true;
                     }
                 }
             }
 
-            for (int i = 0; i < DEBUGGING_BUFFER_COUNT; i++)
-            {
-                delete [] (debugging_buffers[i]);
-            }
+            emulation_thread.join();
         }
     }
     catch (const basic_error& error)
@@ -582,5 +953,5 @@ int main (int argc, char **argv)
     }
 
     teardown();
-    return 0;
+    return exit_code;
 }
@@ -79,8 +79,6 @@ register_argument_t registers[] =
     { 0, 0 }
 };
 
-static int opcode_count = -1;
-
 opcode_entry_t *get_opcode_entry(const char *opcode_name)
 {
     int index = 0;
@@ -98,18 +96,8 @@ opcode_entry_t *get_opcode_entry(const char *opcode_name)
 
 int opcode_entry_count()
 {
-    if (opcode_count >= 0)
-    {
-        return opcode_count;
-    }
-
-    int count = 0;
-    while (opcode_entries[count].name != 0)
-    {
-        count++;
-    }
-    opcode_count = count;
-    return count;
+    // Less the terminating entry
+    return (int)(sizeof(opcode_entries) / sizeof(opcode_entries[0])) - 1;
 }
 
 opcode_entry_t* get_opcode_entry_by_index(int index)
@@ -0,0 +1,179 @@
+#include "syscall_graphics_handlers.h"
+
+#include <algorithm>
+
+#include "syscall.h"
+#include "graphics.h"
+#include "blitter.hpp"
+
+namespace
+{
+    void charge_blit(emulator &emulator, size_t bytes)
+    {
+        emulator.syscall_cycles += (uint32_t)(bytes * blit_cycles_per_byte);
+        if (bytes > 0)
+        {
+            mark_data_written(&emulator, emulator.graphics_draw_start, emulator.graphics_size);
+        }
+    }
+
+    int16_t pull_coordinate(emulator &emulator)
+    {
+        return (int16_t)pull_word(&emulator);
+    }
+}
+
+void handle_blit_fill(emulator &emulator, const blit_surface &surface)
+{
+    uint8_t colour = pull_byte(&emulator);
+    int height = pull_word(&emulator);
+    int width = pull_word(&emulator);
+    int y = pull_coordinate(emulator);
+    int x = pull_coordinate(emulator);
+    charge_blit(emulator, blit_fill(surface, x, y, width, height, colour));
+}
+
+void handle_blit_copy(emulator &emulator, const blit_surface &surface)
+{
+    int height = pull_word(&emulator);
+    int width = pull_word(&emulator);
+    int destination_y = pull_coordinate(emulator);
+    int destination_x = pull_coordinate(emulator);
+    int source_y = pull_coordinate(emulator);
+    int source_x = pull_coordinate(emulator);
+    charge_blit(emulator, blit_copy(surface, source_x, source_y, destination_x, destination_y, width, height));
+}
+
+void handle_blit_mask(emulator &emulator, const blit_surface &surface)
+{
+    uint8_t key_colour = pull_byte(&emulator);
+    int height = pull_word(&emulator);
+    int width = pull_word(&emulator);
+    int y = pull_coordinate(emulator);
+    int x = pull_coordinate(emulator);
+
+    // Only read as many source rows as fit in data memory
+    int row_bytes = blit_row_bytes(surface.depth, width);
+    int source_rows = row_bytes > 0 ? (int)((DATA_SIZE - emulator.X) / row_bytes) : 0;
+    charge_blit(emulator, blit_mask(surface, &emulator.memories.data[emulator.X], source_rows, x, y, width, height, key_colour));
+}
+
+void handle_blit_line(emulator &emulator, const blit_surface &surface)
+{
+    uint8_t colour = pull_byte(&emulator);
+    int y1 = pull_coordinate(emulator);
+    int x1 = pull_coordinate(emulator);
+    int y0 = pull_coordinate(emulator);
+    int x0 = pull_coordinate(emulator);
+    charge_blit(emulator, blit_line(surface, x0, y0, x1, y1, colour));
+}
+
+void handle_blit_span(emulator &emulator, const blit_surface &surface)
+{
+    uint8_t colour = pull_byte(&emulator);
+    int length = pull_word(&emulator);
+    int y = pull_coordinate(emulator);
+    int x = pull_coordinate(emulator);
+    charge_blit(emulator, blit_span(surface, x, y, length, colour));
+}
+
+execution_state_t handle_graphic_flip(emulator &emulator)
+{
+    bool wait_for_frame = pull_byte(&emulator) != 0;
+    auto display_start = emulator.X;
+
+    if (!emulator.graphics_mode.enabled)
+    {
+        push_byte(&emulator, GRAPHICS_ERROR_UNSUPPORTED_MODE);
+        return RUNNING;
+    }
+
+    if ((display_start + emulator.graphics_size) > DATA_SIZE)
+    {
+        push_byte(&emulator, GRAPHICS_ERROR_SPACE_TOO_SMALL);
+        return RUNNING;
+    }
+
+    // The buffer going off screen becomes the one blits draw into
+    if (display_start != emulator.graphics_start)
+    {
+        emulator.graphics_draw_start = emulator.graphics_start;
+        emulator.graphics_start = display_start;
+        emulator.graphics_generation++;
+    }
+
+    push_byte(&emulator, GRAPHICS_ERROR_OK);
+    return wait_for_frame ? WAITING : RUNNING;
+}
+
+execution_state_t handle_graphic_palette(emulator &emulator)
+{
+    int count = pull_word(&emulator);
+    int first = pull_byte(&emulator);
+
+    // Entries past the end of the palette or of data memory are ignored
+    count = std::min(count, GRAPHICS_PALETTE_SIZE - first);
+    count = std::min<int>(count, (DATA_SIZE - emulator.X) / 3);
+
+    auto entries = &emulator.memories.data[emulator.X];
+    for (int i = 0; i < count; i++)
+    {
+        emulator.graphics_palette[first + i] = graphics_colour(entries[i * 3], entries[i * 3 + 1], entries[i * 3 + 2]);
+    }
+
+    if (count > 0)
+    {
+        emulator.graphics_palette_generation++;
+        emulator.graphics_generation++;
+    }
+
+    return RUNNING;
+}
+
+execution_state_t handle_graphics_syscall(emulator &emulator)
+{
+    if (emulator.current_syscall == SYSCALL_GRAPHICFLIP)
+    {
+        return handle_graphic_flip(emulator);
+    }
+
+    if (emulator.current_syscall == SYSCALL_GRAPHICPALETTE)
+    {
+        return handle_graphic_palette(emulator);
+    }
+
+    // Blits still take their arguments off the stack when there's nothing to draw on,
+    // so a program's stack stays balanced whether graphics are enabled or not
+    blit_surface surface{};
+    uint8_t scratch = 0;
+    bool can_draw = emulator.graphics_mode.enabled && blit_surface_for_mode(emulator.graphics_mode, &emulator.memories.data[emulator.graphics_draw_start], surface);
+    if (!can_draw)
+    {
+        surface = blit_surface{ &scratch, ONE_BIT_PER_PIXEL, 0, 0, 0 };
+    }
+
+    switch (emulator.current_syscall)
+    {
+    case SYSCALL_BLITFILL:
+        handle_blit_fill(emulator, surface);
+        break;
+
+    case SYSCALL_BLITCOPY:
+        handle_blit_copy(emulator, surface);
+        break;
+
+    case SYSCALL_BLITMASK:
+        handle_blit_mask(emulator, surface);
+        break;
+
+    case SYSCALL_BLITLINE:
+        handle_blit_line(emulator, surface);
+        break;
+
+    case SYSCALL_BLITSPAN:
+        handle_blit_span(emulator, surface);
+        break;
+    }
+
+    return RUNNING;
+}
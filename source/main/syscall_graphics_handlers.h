@@ -0,0 +1,8 @@
+#pragma once
+
+#include "emulator.h"
+
+// Emulated cycles charged for each byte of graphics memory a blit writes
+const int blit_cycles_per_byte = 1;
+
+execution_state_t handle_graphics_syscall(emulator &emulator);
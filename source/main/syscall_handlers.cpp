@@ -4,6 +4,7 @@
 #include "graphics.h"
 #include "holotape.h"
 #include "syscall_holotape_handlers.h"
+#include "syscall_graphics_handlers.h"
 #include "sound_system.hpp"
 
 #include <deque>
@@ -132,7 +133,7 @@ execution_state_t handle_syscall_graphicstart(emulator& emulator, Console& conso
     {
         push_byte(&emulator, GRAPHICS_ERROR_SPACE_TOO_SMALL);
     }
-    else if (mode.depth > EIGHT_BITS_PER_PIXEL || mode.resolution > RES_480x320)
+    else if (mode.depth > TILE_MODE || mode.resolution > RES_480x320)
     {
         push_byte(&emulator, GRAPHICS_ERROR_UNSUPPORTED_MODE);
     }
@@ -141,6 +142,11 @@ execution_state_t handle_syscall_graphicstart(emulator& emulator, Console& conso
         mode.enabled = true;
         emulator.graphics_mode = mode;
         emulator.graphics_start = graphics_begin;
+        emulator.graphics_draw_start = graphics_begin;
+        emulator.graphics_size = memory_required;
+        emulator.graphics_generation++;
+        graphics_default_palette(mode, emulator.graphics_palette);
+        emulator.graphics_palette_generation++;
         push_byte(&emulator, GRAPHICS_ERROR_OK);
     }
 
@@ -164,7 +170,10 @@ execution_state_t handle_syscall_soundcmd(emulator& emulator, Console& console,
         &emulator.memories.data[emulator.X]
     };
 
-    synthesizer->process_command(current_command);
+    if (synthesizer != nullptr)
+    {
+        synthesizer->process_command(current_command);
+    }
 
     return RUNNING;
 }
@@ -226,6 +235,16 @@ void handle_current_syscall(emulator &emulator, Console &console, sound_system*
         nextState = handle_syscall_graphicend(emulator, console);
         break;
 
+    case SYSCALL_BLITFILL:
+    case SYSCALL_BLITCOPY:
+    case SYSCALL_BLITMASK:
+    case SYSCALL_BLITLINE:
+    case SYSCALL_BLITSPAN:
+    case SYSCALL_GRAPHICFLIP:
+    case SYSCALL_GRAPHICPALETTE:
+        nextState = handle_graphics_syscall(emulator);
+        break;
+
     case SYSCALL_SOUNDCMD:
         nextState = handle_syscall_soundcmd(emulator, console, synthesizer);
         break;
@@ -271,4 +290,18 @@ void handle_keypress_for_syscall(emulator &emulator, int key)
     {
         character_queue.push_back(key);
     }
+}
+
+bool is_waiting_for_frame(const emulator &emulator)
+{
+    return emulator.current_state == WAITING && emulator.current_syscall == SYSCALL_GRAPHICFLIP;
+}
+
+void handle_frame_presented_for_syscall(emulator &emulator)
+{
+    if (is_waiting_for_frame(emulator))
+    {
+        emulator.current_syscall = SYSCALL_NONE;
+        emulator.current_state = RUNNING;
+    }
 }
\ No newline at end of file
@@ -8,3 +8,7 @@ class sound_system;
 
 void handle_current_syscall(emulator &emulator, Console &console, sound_system* synthesizer = nullptr);
 void handle_keypress_for_syscall(emulator &emulator, int key);
+
+// A GRAPHICFLIP that asked to wait stays waiting until the renderer has shown the flipped frame
+bool is_waiting_for_frame(const emulator &emulator);
+void handle_frame_presented_for_syscall(emulator &emulator);
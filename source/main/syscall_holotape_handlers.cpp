@@ -124,6 +124,7 @@ void handle_holotape_read(emulator &emulator)
     {
         uint8_t *buffer = &emulator.memories.data[emulator.X];
         memcpy(buffer, current_deck->block_buffer.buffer, HOLOTAPE_BLOCK_SIZE);
+        mark_data_written(&emulator, emulator.X, HOLOTAPE_BLOCK_SIZE);
     }
     
     push_word(&emulator, result);
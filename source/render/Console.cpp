@@ -1,13 +1,15 @@
 #include "Console.h"
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
 #include <stdio.h>
 
-Console::Console(int width, int height) : buffer(nullptr), attributeBuffer(nullptr)
+Console::Console(int width, int height, int scrollbackLines) : buffer(nullptr), attributeBuffer(nullptr)
 {
 	this->width = width;
 	this->height = height;
+	this->scrollbackLines = std::clamp(scrollbackLines, 0, MaxScrollbackLines);
 	Reset();
 }
 
@@ -24,7 +26,7 @@ void Console::SetChar(int x, int y, char character)
 		return;
 	}
 
-	int position = y * width + x;
+	int position = RowStart(y) + x;
 	buffer[position] = character;
 	attributeBuffer[position] = currentAttribute | CharacterAttribute::Dirty;
 }
@@ -36,7 +38,7 @@ char Console::GetChar(int x, int y)
 		return -1;
 	}
 
-	return buffer[y * width + x];
+	return buffer[RowStart(y) + x];
 }
 
 bool Console::SetCursor(int x, int y)
@@ -55,7 +57,15 @@ bool Console::SetCursor(int x, int y)
 void Console::GetCursor(int &x, int &y)
 {
 	x = cursorX;
-	y = cursorY;
+	y = std::min(cursorY, height - 1);
+}
+
+bool Console::GetViewCursor(int &x, int &y) const
+{
+	x = cursorX;
+	y = std::min(cursorY, height - 1) + viewOffset;
+
+	return cursorVisible && y < height;
 }
 
 void Console::PrintChar(const char character)
@@ -66,37 +76,34 @@ void Console::PrintChar(const char character)
 		return;
 	}
 
-	int position = cursorY * width + cursorX;
+	ResolvePendingScroll();
+
+	int position = RowStart(cursorY) + cursorX;
 	buffer[position] = character;
 	attributeBuffer[position] = currentAttribute | CharacterAttribute::Dirty;
 	cursorX++;
 
 	if (cursorX >= width)
 	{
-		cursorX = 0;
-		cursorY++;
-	}
-
-	if (cursorY >= height)
-	{
-		cursorY = 0;
+		NewLine(cursorY);
 	}
 }
 
 void Console::PrintLine(const char *text)
 {
-	PrintLineAt(text, cursorX, cursorY);
+	PrintAtCursor(text);
+	NewLine(cursorY);
 }
 
 void Console::Print(const char *text)
 {
-	PrintAt(text, cursorX, cursorY);
+	PrintAtCursor(text);
 }
 
 void Console::PrintLineAt(const char *text, int x, int y)
 {
 	PrintAt(text, x, y);
-	NewLine(y);
+	NewLine(cursorY);
 }
 
 void Console::PrintAt(const char *text, int x, int y)
@@ -108,38 +115,94 @@ void Console::PrintAt(const char *text, int x, int y)
 		return;
 	}
 
-	int position = y * width + x;
-	int stringLength = std::strlen(text);
-	int finalPosition = position + stringLength;
+	cursorX = x;
+	cursorY = y;
+	PrintAtCursor(text);
+}
 
-	if (finalPosition >= bufferSize)
+void Console::PrintAtCursor(const char *text)
+{
+	// Copy a run at a time, each run ends at a line break or the end of the row
+	while (*text != 0)
 	{
-		// Truncate the string if it'd go past the end of the buffer
-		stringLength = (bufferSize - position) - 1;
-		finalPosition = bufferSize - 1;
+		if (*text == '\n' || *text == '\r')
+		{
+			// Treat \r\n as a single line break
+			if (text[0] == '\r' && text[1] == '\n')
+			{
+				text++;
+			}
+
+			NewLine(cursorY);
+			text++;
+			continue;
+		}
+
+		ResolvePendingScroll();
+
+		int space = width - cursorX;
+		int runLength = 0;
+		while (runLength < space && text[runLength] != 0 && text[runLength] != '\n' && text[runLength] != '\r')
+		{
+			runLength++;
+		}
+
+		int position = RowStart(cursorY) + cursorX;
+		std::memcpy(&buffer[position], text, runLength);
+		std::fill_n(&attributeBuffer[position], runLength, currentAttribute | CharacterAttribute::Dirty);
+
+		text += runLength;
+		cursorX += runLength;
+		if (cursorX >= width)
+		{
+			NewLine(cursorY);
+		}
 	}
+}
 
-	std::strncpy(&buffer[position], text, stringLength);
+void Console::NewLine(int afterLine)
+{
+	cursorX = 0;
+	cursorY = afterLine + 1;
 
-	for (int i = position; i < finalPosition; i++)
+	// Scrolling for a newline on the last row waits for the next print
+	while (cursorY > height)
 	{
-		attributeBuffer[i] = currentAttribute | CharacterAttribute::Dirty;
+		Scroll();
+		cursorY--;
 	}
+}
 
-	cursorY = (finalPosition / width) % height;
-	cursorX = finalPosition % width;
+void Console::Scroll()
+{
+	topRow = (topRow + 1) % rowCount;
 
-	auto lastChar = text[stringLength-1];
-	if (lastChar == '\n' || lastChar == '\r')
+	if (scrollbackCount < scrollbackLines)
 	{
-		NewLine(cursorY);
+		scrollbackCount++;
 	}
+
+	// Keep the same lines in view while looking at the scrollback
+	if (viewOffset > 0)
+	{
+		viewOffset = std::min(viewOffset + 1, scrollbackCount);
+	}
+
+	ClearRow(height - 1);
 }
 
-void Console::NewLine(int afterLine)
+void Console::ScrollView(int lines)
 {
-	cursorX = 0;
-	cursorY = (afterLine + 1) % height;
+	viewOffset = std::clamp(viewOffset + lines, 0, scrollbackCount);
+}
+
+void Console::ResolvePendingScroll()
+{
+	if (cursorY >= height)
+	{
+		Scroll();
+		cursorY = height - 1;
+	}
 }
 
 void Console::SetAttribute(CharacterAttribute attribute, int x, int y)
@@ -149,12 +212,12 @@ void Console::SetAttribute(CharacterAttribute attribute, int x, int y)
 		return;
 	}
 
-	attributeBuffer[y * width + x] = attribute | CharacterAttribute::Dirty;
+	attributeBuffer[RowStart(y) + x] = attribute | CharacterAttribute::Dirty;
 }
 
 void Console::SetAttributeAtCursor(CharacterAttribute attribute)
 {
-	SetAttribute(attribute, cursorX, cursorY);
+	SetAttribute(attribute, cursorX, std::min(cursorY, height - 1));
 }
 
 void Console::SetCurrentAttribute(CharacterAttribute attribute)
@@ -169,32 +232,69 @@ CharacterAttribute Console::GetAttribute(int x, int y)
 		return CharacterAttribute::None;
 	}
 
-	return attributeBuffer[y * width + x];
+	return attributeBuffer[RowStart(y) + x];
 }
 
 void Console::Visit(std::function<void(int, int, char, CharacterAttribute)> visitor)
 {
-	for (int y = 0; y < height; y++)
+	VisitCells(visitor);
+}
+
+ConsoleRow Console::GetRow(int y) const
+{
+	int position = RowStart(y - viewOffset);
+	return ConsoleRow{ &buffer[position], &attributeBuffer[position], width };
+}
+
+void Console::ClearDirty(int y)
+{
+	auto attributes = &attributeBuffer[RowStart(y - viewOffset)];
+	for (int x = 0; x < width; x++)
 	{
-		for (int x = 0; x < width; x++)
-		{
-			int position = y * width + x;
-			visitor(x, y, buffer[position], attributeBuffer[position]);
-			if ((attributeBuffer[position] & CharacterAttribute::Dirty) != CharacterAttribute::None)
-			{
-				attributeBuffer[position] = attributeBuffer[position] & ~CharacterAttribute::Dirty;
-			}
-		}
+		attributes[x] = attributes[x] & ~CharacterAttribute::Dirty;
 	}
 }
 
+void Console::ClearRow(int y)
+{
+	int position = RowStart(y);
+	std::memset(&buffer[position], 0, width);
+	std::fill_n(&attributeBuffer[position], width, CharacterAttribute::Dirty);
+}
+
 void Console::Clear()
 {
-	std::memset(buffer, 0, bufferSize);
-	std::memset(attributeBuffer, (int)CharacterAttribute::Dirty, bufferSize * sizeof(CharacterAttribute));
+	for (int y = 0; y < height; y++)
+	{
+		ClearRow(y);
+	}
+
 	currentAttribute = CharacterAttribute::None;
 	cursorX = 0;
 	cursorY = 0;
+	viewOffset = 0;
+}
+
+void Console::CopyFrom(const Console &other)
+{
+	if (width != other.width || height != other.height || scrollbackLines != 0)
+	{
+		width = other.width;
+		height = other.height;
+		scrollbackLines = 0;
+		Reset();
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		auto row = other.GetRow(y);
+		int position = RowStart(y);
+		std::memcpy(&buffer[position], row.characters, width);
+		std::memcpy(&attributeBuffer[position], row.attributes, width * sizeof(CharacterAttribute));
+	}
+
+	currentAttribute = other.currentAttribute;
+	cursorVisible = other.GetViewCursor(cursorX, cursorY);
 }
 
 void Console::Reset()
@@ -204,7 +304,8 @@ void Console::Reset()
 		delete [] buffer;
 	}
 
-	bufferSize = width * height;
+	rowCount = height + scrollbackLines;
+	bufferSize = width * rowCount;
 
 	buffer = new char[bufferSize];
 
@@ -214,5 +315,12 @@ void Console::Reset()
 	}
 
 	attributeBuffer = new CharacterAttribute[bufferSize];
+
+	std::memset(buffer, 0, bufferSize);
+	std::fill_n(attributeBuffer, bufferSize, CharacterAttribute::Dirty);
+	topRow = 0;
+	scrollbackCount = 0;
+	viewOffset = 0;
+	cursorVisible = true;
 	Clear();
 }
@@ -65,10 +65,24 @@ inline CharacterAttribute& operator|=(CharacterAttribute& lhs, CharacterAttribut
 	return (CharacterAttribute&)((unsigned int&)lhs |= (unsigned int)rhs);
 }
 
+// A view of one row of console cells. Both arrays are width entries long.
+struct ConsoleRow
+{
+	const char *characters;
+	const CharacterAttribute *attributes;
+	int width;
+};
+
+// Rows are kept in a ring, so scrolling moves the top row index and clears
+// one row instead of moving the whole screen. Rows that scroll off the top
+// are kept as scrollback, up to the line count given to the constructor,
+// and the view can be moved back into them with ScrollView.
 class Console
 {
 public:
-	Console(int width, int height);
+	static constexpr int MaxScrollbackLines = 10000;
+
+	Console(int width, int height, int scrollbackLines = 0);
 	~Console();
 
 	int GetWidth() { return width; }
@@ -80,6 +94,9 @@ public:
 	bool SetCursor(int x, int y);
 	void GetCursor(int &x, int &y);
 
+	// Where the cursor is within the current view, returns false if it's scrolled out of view
+	bool GetViewCursor(int &x, int &y) const;
+
 	void PrintChar(const char character);
 	void PrintLine(const char *text);
 	void Print(const char *text);
@@ -88,23 +105,80 @@ public:
 
 	void NewLine(int afterLine);
 
+	// Moves the screen contents up one line, the top line goes into scrollback
+	void Scroll();
+
+	// Positive values look further back into the scrollback, 0 is the live screen
+	void ScrollView(int lines);
+	int GetViewOffset() const { return viewOffset; }
+
 	void SetAttribute(CharacterAttribute attribute, int x, int y);
 	void SetAttributeAtCursor(CharacterAttribute attribute);
 	void SetCurrentAttribute(CharacterAttribute attribute);
 	CharacterAttribute GetAttribute(int x, int y);
 
+	// Clears the screen, scrollback is kept
 	void Clear();
 
+	// Copies what's currently in view on another console, along with its
+	// cursor, resizing to match. The copy has no scrollback of its own.
+	void CopyFrom(const Console &other);
+
+	// Calls visitor(x, y, character, attribute) for every cell in view, then clears the dirty flags.
+	// Kept for compatibility, VisitCells and VisitRows avoid the per-cell indirect call.
 	void Visit(std::function<void(int, int, char, CharacterAttribute)> visitor);
 
+	// Same as Visit, but the visitor can be inlined
+	template <typename Visitor>
+	void VisitCells(Visitor &&visitor)
+	{
+		VisitRows([&](int y, const ConsoleRow &row)
+		{
+			for (int x = 0; x < row.width; x++)
+			{
+				visitor(x, y, row.characters[x], row.attributes[x]);
+			}
+		});
+	}
+
+	// Calls visitor(y, row) once per row in view, then clears the dirty flags on that row
+	template <typename Visitor>
+	void VisitRows(Visitor &&visitor)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			visitor(y, GetRow(y));
+			ClearDirty(y);
+		}
+	}
+
+	// Row y of the current view, which is the live screen unless it's been scrolled back
+	ConsoleRow GetRow(int y) const;
+
 private:
 	void Reset();
+	void ClearRow(int y);
+	void ClearDirty(int y);
+	void ResolvePendingScroll();
+	void PrintAtCursor(const char *text);
+
+	// Offset into the buffers of a row, y is relative to the top of the live
+	// screen, negative values reach back into the scrollback
+	int RowStart(int y) const { return ((topRow + y + rowCount) % rowCount) * width; }
 
 private:
 	int width;
 	int height;
+	int scrollbackLines;
+	int rowCount;
+	int topRow;
+	int scrollbackCount;
+	int viewOffset;
+	// cursorY is height when a newline on the last row is waiting for the
+	// next print before it scrolls, so a full screen doesn't scroll early
 	int cursorX;
 	int cursorY;
+	bool cursorVisible;
 	int bufferSize;
 	char *buffer;
 	CharacterAttribute *attributeBuffer;
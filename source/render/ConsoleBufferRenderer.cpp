@@ -0,0 +1,126 @@
+#include "ConsoleBufferRenderer.h"
+
+#if APPLE
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#else // APPLE
+#include <SDL.h>
+#include <SDL_image.h>
+#endif // APPLE
+#include <stdio.h>
+#include <algorithm>
+
+#include "Console.h"
+#include "graphics.h"
+#include "FrameRecorder.h"
+#include "binary_stream.hpp"
+
+ConsoleBufferRenderer::ConsoleBufferRenderer(const char *fontFilename, int width, int height, uint32_t foregroundColour, uint32_t backgroundColour, uint32_t dimForegroundColour, uint32_t dimBackgroundColour, uint16_t fontCharsWide, uint16_t fontCharsHigh, int cursorBlinkFrames)
+    : ConsoleRenderer(width, height, foregroundColour, backgroundColour, dimForegroundColour, dimBackgroundColour, fontCharsWide, fontCharsHigh, cursorBlinkFrames),
+      pixels((size_t)width * height, 0xFF000000),
+      width(width), height(height), frameCount(0)
+{
+    // Image loading doesn't need a video subsystem, so this works without a display
+    auto formatsFlags = IMG_Init(IMG_INIT_PNG);
+
+    if ((formatsFlags & IMG_INIT_PNG) == 0)
+    {
+        fprintf(stderr, "Failed to initialize image loading %s\n", IMG_GetError());
+        return;
+    }
+
+    if (!rasterizer.LoadFont(fontFilename))
+    {
+        return;
+    }
+
+    isValid = true;
+}
+
+ConsoleBufferRenderer::~ConsoleBufferRenderer()
+{
+}
+
+void ConsoleBufferRenderer::Clear()
+{
+    std::fill(pixels.begin(), pixels.end(), 0xFF000000);
+}
+
+void ConsoleBufferRenderer::Render(Console *console, int frame)
+{
+    if (!isValid) return;
+
+    rasterizer.RasterizeConsole(console, frame, pixels.data(), width);
+    if (recorder != nullptr)
+    {
+        recorder->Submit(pixels.data(), width);
+    }
+    frameCount++;
+}
+
+void ConsoleBufferRenderer::Render(graphics_mode_t mode, const uint8_t *graphicsMemory)
+{
+    if (!isValid) return;
+    if (!mode.enabled) return;
+
+    rasterizer.RasterizeGraphics(mode, graphicsMemory, pixels.data(), width);
+    if (recorder != nullptr)
+    {
+        recorder->Submit(pixels.data(), width);
+    }
+    frameCount++;
+}
+
+uint64_t ConsoleBufferRenderer::HashFrame() const
+{
+    return hash_bytes(pixels.data(), pixels.size() * sizeof(uint32_t));
+}
+
+bool ConsoleBufferRenderer::WritePPM(const char *filename) const
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Couldn't open %s to write a frame\n", filename);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    std::vector<uint8_t> row((size_t)width * 3);
+    auto rgba = reinterpret_cast<const uint8_t*>(pixels.data());
+    for (int y = 0; y < height; y++)
+    {
+        auto source = &rgba[(size_t)y * width * 4];
+        for (int x = 0; x < width; x++)
+        {
+            row[x * 3] = source[x * 4];
+            row[x * 3 + 1] = source[x * 4 + 1];
+            row[x * 3 + 2] = source[x * 4 + 2];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    bool success = ferror(file) == 0;
+    fclose(file);
+    return success;
+}
+
+bool ConsoleBufferRenderer::WritePNG(const char *filename) const
+{
+    auto surface = SDL_CreateRGBSurfaceWithFormatFrom(const_cast<uint32_t*>(pixels.data()), width, height, 32, width * 4, SDL_PIXELFORMAT_RGBA32);
+    if (surface == nullptr)
+    {
+        fprintf(stderr, "Failed to create a surface for frame output (%s)\n", SDL_GetError());
+        return false;
+    }
+
+    auto result = IMG_SavePNG(surface, filename);
+    if (result != 0)
+    {
+        fprintf(stderr, "Failed to write %s (%s)\n", filename, IMG_GetError());
+    }
+
+    SDL_FreeSurface(surface);
+    return result == 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "ConsoleRenderer.h"
+
+// Renders into a plain in-memory RGBA buffer instead of a window, for
+// golden-image comparisons and for measuring render cost without a display
+class ConsoleBufferRenderer : public ConsoleRenderer
+{
+public:
+    ConsoleBufferRenderer(const char *fontFilename, int width, int height, uint32_t foregroundColour, uint32_t backgroundColour, uint32_t dimForegroundColour, uint32_t dimBackgroundColour, uint16_t fontCharsWide, uint16_t fontCharsHigh, int cursorBlinkFrames);
+    virtual ~ConsoleBufferRenderer();
+
+    virtual void Clear() override;
+
+    virtual void Render(Console *console, int frame) override;
+    virtual void Render(graphics_mode_t mode, const uint8_t *graphicsMemory) override;
+
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+    int GetFrameCount() const { return frameCount; }
+
+    // Pixels are in the same RGBA byte order as SDL_PIXELFORMAT_RGBA32,
+    // and rows are tightly packed (pitch is width * 4 bytes)
+    const uint32_t *GetPixels() const { return pixels.data(); }
+
+    // 64-bit FNV-1a hash of the current frame's pixels
+    uint64_t HashFrame() const;
+
+    bool WritePPM(const char *filename) const;
+    bool WritePNG(const char *filename) const;
+
+private:
+    std::vector<uint32_t> pixels;
+    int width;
+    int height;
+    int frameCount;
+};
@@ -0,0 +1,364 @@
+#include "ConsoleRasterizer.h"
+
+#if APPLE
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#else // APPLE
+#include <SDL.h>
+#include <SDL_image.h>
+#endif // APPLE
+#include <stdio.h>
+#include <algorithm>
+#include <utility>
+
+#include "Console.h"
+
+ConsoleRasterizer::ConsoleRasterizer(int width, int height, uint32_t foregroundColour, uint32_t backgroundColour, uint32_t dimForegroundColour, uint32_t dimBackgroundColour, uint16_t fontCharsWide, uint16_t fontCharsHigh, int cursorBlinkFrames)
+    : fontBuffer(nullptr),
+      width(width), height(height), foregroundColour(foregroundColour), backgroundColour(backgroundColour),
+      dimForegroundColour(dimForegroundColour), dimBackgroundColour(dimBackgroundColour),
+      fontBufferWidth(0), fontBufferHeight(0),
+      fontCharsWide(fontCharsWide), fontCharsHigh(fontCharsHigh),
+      charPixelsWide(0), charPixelsHigh(0),
+      cursorBlinkFrames(cursorBlinkFrames)
+{
+    // Programs get their mode's defaults with GRAPHICSTART, this is only
+    // until a palette is set
+    graphics_mode_t mode{};
+    mode.depth = EIGHT_BITS_PER_PIXEL;
+    uint32_t defaultPalette[GRAPHICS_PALETTE_SIZE];
+    graphics_default_palette(mode, defaultPalette);
+    SetPalette(defaultPalette);
+}
+
+ConsoleRasterizer::~ConsoleRasterizer()
+{
+    if (fontBuffer != nullptr)
+    {
+        delete [] fontBuffer;
+        fontBuffer = nullptr;
+    }
+}
+
+bool ConsoleRasterizer::LoadFont(const char *fontFilename)
+{
+    auto fontSurface = IMG_Load(fontFilename);
+    if (fontSurface == nullptr)
+    {
+        fprintf(stderr, "Failed to load image (%s), error: (%s)", fontFilename, IMG_GetError());
+        return false;
+    }
+
+    bool fontSuccess = true;
+
+    if (fontBuffer != nullptr)
+    {
+        delete [] fontBuffer;
+    }
+
+    auto fontBufferSize = (uint64_t)fontSurface->w * fontSurface->h;
+    fontBuffer = new bool[fontBufferSize];
+
+    SDL_LockSurface(fontSurface);
+
+    auto fontSurfaceFormat = fontSurface->format->format;
+    if (SDL_PIXELTYPE(fontSurfaceFormat) == SDL_PIXELTYPE_INDEX8)
+    {
+        fontBufferWidth = fontSurface->w;
+        fontBufferHeight = fontSurface->h;
+        charPixelsWide = fontBufferWidth / fontCharsWide;
+        charPixelsHigh = fontBufferHeight / fontCharsHigh;
+        auto pixels = (uint8_t*)fontSurface->pixels;
+        for (int y = 0; y < fontSurface->h; y++)
+        {
+            for (int x = 0; x < fontSurface->w; x++)
+            {
+                int surfaceIndex = (y * fontSurface->pitch + x);
+                int fontIndex = (y * fontSurface->w + x);
+                fontBuffer[fontIndex] = (bool)(pixels[surfaceIndex] > 0);
+            }
+        }
+    }
+    else
+    {
+        unsigned int pixelType = SDL_PIXELTYPE(fontSurfaceFormat);
+        unsigned int pixelLayout = SDL_PIXELLAYOUT(fontSurfaceFormat);
+        fprintf(stderr, "Couldn't handle the font buffer's format (type: %u, layout: %u)\n", pixelType, pixelLayout);
+        fontSuccess = false;
+    }
+
+    SDL_UnlockSurface(fontSurface);
+
+    SDL_FreeSurface(fontSurface);
+
+    if (!fontSuccess)
+    {
+        delete [] fontBuffer;
+        fontBuffer = nullptr;
+    }
+
+    return fontSuccess;
+}
+
+void ConsoleRasterizer::SetColours(uint32_t foregroundColour, uint32_t backgroundColour)
+{
+    this->foregroundColour = foregroundColour;
+    this->backgroundColour = backgroundColour;
+}
+
+void ConsoleRasterizer::SetPalette(const uint32_t *colours)
+{
+    std::copy_n(colours, GRAPHICS_PALETTE_SIZE, palette);
+
+    // Pixels go from the low bits of a byte to the high bits
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            expand1[byte][i] = palette[(byte >> i) & 1];
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            expand2[byte][i] = palette[(byte >> (i * 2)) & 0b11];
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            expand4[byte][i] = palette[(byte >> (i * 4)) & 0xF];
+        }
+    }
+}
+
+void ConsoleRasterizer::RasterizeConsole(Console *console, int frame, uint32_t *pixels, int pixelPitch)
+{
+    if (fontBuffer == nullptr) return;
+
+    bool cursorOn = false;
+    if (cursorBlinkFrames > 0)
+    {
+        cursorOn = (frame / cursorBlinkFrames) % 2;
+    }
+
+    int cursorX;
+    int cursorY;
+    bool cursorInView = console->GetViewCursor(cursorX, cursorY);
+
+    // TODO: Figure out a way to use the dirty character attribute to cut down on character drawing
+    console->VisitRows([&](int y, const ConsoleRow &row)
+    {
+        auto rowPixels = &pixels[y * charPixelsHigh * pixelPitch];
+        for (uint16_t charLine = 0; charLine < charPixelsHigh; charLine++)
+        {
+            auto linePixels = &rowPixels[charLine * pixelPitch];
+            for (int x = 0; x < row.width; x++)
+            {
+                uint8_t unsigned_char = *((uint8_t*)&row.characters[x]);
+                auto attribute = row.attributes[x];
+                auto charXStart = (unsigned_char % fontCharsWide) * charPixelsWide;
+                auto charYStart = (unsigned_char / fontCharsWide) * charPixelsHigh;
+                auto isCursor = cursorInView && (x == cursorX) && (y == cursorY);
+
+                bool dim = (attribute & CharacterAttribute::Dim) == CharacterAttribute::Dim;
+                uint32_t onColour = dim ? dimForegroundColour : foregroundColour;
+                uint32_t offColour = dim ? dimBackgroundColour : backgroundColour;
+                if (((attribute & CharacterAttribute::Inverted) == CharacterAttribute::Inverted) ^ (cursorOn && isCursor))
+                {
+                    std::swap(onColour, offColour);
+                }
+
+                auto glyphLine = &fontBuffer[(charYStart + charLine) * fontBufferWidth + charXStart];
+                auto cellPixels = &linePixels[x * charPixelsWide];
+                for (uint16_t charColumn = 0; charColumn < charPixelsWide; charColumn++)
+                {
+                    cellPixels[charColumn] = glyphLine[charColumn] ? onColour : offColour;
+                }
+            }
+        }
+    });
+}
+
+void ConsoleRasterizer::RasterizeGraphics(graphics_mode_t mode, const uint8_t *graphicsMemory, uint32_t *pixels, int pixelPitch)
+{
+    auto emulator_pix_per_line = graphics_pixels_per_line(mode);
+    int pix_per_emu_pix = 1;
+    if (emulator_pix_per_line < 192)
+    {
+        pix_per_emu_pix = 4;
+    }
+    else if (emulator_pix_per_line < 320)
+    {
+        pix_per_emu_pix = 2;
+    }
+
+    auto emulator_lines = graphics_get_row_count(mode);
+    int image_width = emulator_pix_per_line * pix_per_emu_pix;
+    int image_height = emulator_lines * pix_per_emu_pix;
+    auto border_width = (width - image_width) / 2;
+    auto border_height = (height - image_height) / 2;
+    uint32_t border_colour = mode.border ? foregroundColour : backgroundColour;
+
+    if (mode.depth == TILE_MODE)
+    {
+        CompositeTiles(emulator_pix_per_line, emulator_lines, graphicsMemory);
+    }
+
+    lineColours.resize(emulator_pix_per_line);
+
+    for (int y = 0; y < height; y++)
+    {
+        auto row = &pixels[y * pixelPitch];
+        int image_y = y - border_height;
+        if (image_y < 0 || image_y >= image_height)
+        {
+            std::fill_n(row, width, border_colour);
+            continue;
+        }
+
+        // Scaled up modes repeat each emulated line, so copy the row above
+        if ((image_y % pix_per_emu_pix) != 0)
+        {
+            std::copy_n(row - pixelPitch, width, row);
+            continue;
+        }
+
+        ExpandLine(mode, graphicsMemory, image_y / pix_per_emu_pix, emulator_pix_per_line);
+
+        std::fill_n(row, border_width, border_colour);
+        auto image_row = &row[border_width];
+        for (int x = 0; x < emulator_pix_per_line; x++)
+        {
+            std::fill_n(&image_row[x * pix_per_emu_pix], pix_per_emu_pix, lineColours[x]);
+        }
+        std::fill_n(&image_row[image_width], width - border_width - image_width, border_colour);
+    }
+}
+
+void ConsoleRasterizer::ExpandLine(graphics_mode_t mode, const uint8_t *graphicsMemory, int line, int pixelsPerLine)
+{
+    auto colours = lineColours.data();
+    auto lineBytes = mode.depth == TILE_MODE ? nullptr : &graphicsMemory[line * graphics_bytes_per_line(mode)];
+
+    // Every line width is a multiple of 8 pixels, so there are no partial bytes
+    switch (mode.depth)
+    {
+    case ONE_BIT_PER_PIXEL:
+        for (int i = 0; i < pixelsPerLine / 8; i++)
+        {
+            std::copy_n(expand1[lineBytes[i]], 8, &colours[i * 8]);
+        }
+        break;
+
+    case TWO_BITS_PER_PIXEL:
+        for (int i = 0; i < pixelsPerLine / 4; i++)
+        {
+            std::copy_n(expand2[lineBytes[i]], 4, &colours[i * 4]);
+        }
+        break;
+
+    case FOUR_BITS_PER_PIXEL:
+        for (int i = 0; i < pixelsPerLine / 2; i++)
+        {
+            std::copy_n(expand4[lineBytes[i]], 2, &colours[i * 2]);
+        }
+        break;
+
+    case EIGHT_BITS_PER_PIXEL:
+        for (int i = 0; i < pixelsPerLine; i++)
+        {
+            colours[i] = palette[lineBytes[i]];
+        }
+        break;
+
+    case TILE_MODE:
+    {
+        auto indices = &tileFrame[(size_t)line * pixelsPerLine];
+        for (int i = 0; i < pixelsPerLine; i++)
+        {
+            colours[i] = palette[indices[i]];
+        }
+        break;
+    }
+
+    default:
+        std::fill_n(colours, pixelsPerLine, backgroundColour);
+        break;
+    }
+}
+
+void ConsoleRasterizer::CompositeTiles(int frameWidth, int frameHeight, const uint8_t *graphicsMemory)
+{
+    tileFrame.resize((size_t)frameWidth * frameHeight);
+
+    auto readWord = [&](int offset)
+    {
+        return (uint16_t)((graphicsMemory[offset] << 8) | graphicsMemory[offset + 1]);
+    };
+
+    auto map = &graphicsMemory[TILE_MODE_MAP];
+    auto patterns = &graphicsMemory[TILE_MODE_PATTERNS];
+    const int mapPixelsWide = TILE_MODE_MAP_WIDTH * TILE_MODE_TILE_SIZE;
+    const int mapPixelsHigh = TILE_MODE_MAP_HEIGHT * TILE_MODE_TILE_SIZE;
+    const int patternBytesPerLine = TILE_MODE_TILE_SIZE / 2;
+    int scrollX = readWord(TILE_MODE_SCROLL_X) % mapPixelsWide;
+    int scrollY = readWord(TILE_MODE_SCROLL_Y) % mapPixelsHigh;
+
+    // Background, wrapping around the map
+    for (int y = 0; y < frameHeight; y++)
+    {
+        int mapY = (y + scrollY) % mapPixelsHigh;
+        auto mapRow = &map[(mapY / TILE_MODE_TILE_SIZE) * TILE_MODE_MAP_WIDTH];
+        int patternLine = (mapY % TILE_MODE_TILE_SIZE) * patternBytesPerLine;
+        auto frameRow = &tileFrame[(size_t)y * frameWidth];
+        for (int x = 0; x < frameWidth; x++)
+        {
+            int mapX = (x + scrollX) % mapPixelsWide;
+            int tileX = mapX % TILE_MODE_TILE_SIZE;
+            auto patternByte = patterns[mapRow[mapX / TILE_MODE_TILE_SIZE] * TILE_MODE_PATTERN_SIZE + patternLine + tileX / 2];
+            frameRow[x] = (tileX & 1) ? (patternByte >> 4) : (patternByte & 0xF);
+        }
+    }
+
+    // Sprites, drawn last to first so lower numbered sprites end up on top
+    for (int sprite = TILE_MODE_SPRITE_COUNT - 1; sprite >= 0; sprite--)
+    {
+        int attributes = TILE_MODE_SPRITES + sprite * TILE_MODE_SPRITE_SIZE;
+        uint8_t flags = graphicsMemory[attributes + 5];
+        if ((flags & SPRITE_VISIBLE) == 0)
+        {
+            continue;
+        }
+
+        int spriteX = (int16_t)readWord(attributes);
+        int spriteY = (int16_t)readWord(attributes + 2);
+        auto pattern = &patterns[graphicsMemory[attributes + 4] * TILE_MODE_PATTERN_SIZE];
+
+        for (int line = 0; line < TILE_MODE_TILE_SIZE; line++)
+        {
+            int y = spriteY + line;
+            if (y < 0 || y >= frameHeight)
+            {
+                continue;
+            }
+
+            int patternY = (flags & SPRITE_FLIP_Y) ? (TILE_MODE_TILE_SIZE - 1 - line) : line;
+            auto frameRow = &tileFrame[(size_t)y * frameWidth];
+            for (int column = 0; column < TILE_MODE_TILE_SIZE; column++)
+            {
+                int x = spriteX + column;
+                if (x < 0 || x >= frameWidth)
+                {
+                    continue;
+                }
+
+                int patternX = (flags & SPRITE_FLIP_X) ? (TILE_MODE_TILE_SIZE - 1 - column) : column;
+                auto patternByte = pattern[patternY * patternBytesPerLine + patternX / 2];
+                uint8_t colour = (patternX & 1) ? (patternByte >> 4) : (patternByte & 0xF);
+                if (colour != 0)
+                {
+                    frameRow[x] = colour;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "graphics.h"
+
+class Console;
+
+// Turns console cells and emulator graphics memory into 32-bit RGBA pixels.
+// This is shared by every renderer backend, so the same code runs whether
+// the pixels end up in an SDL texture or in an offscreen buffer.
+class ConsoleRasterizer
+{
+public:
+    ConsoleRasterizer(int width, int height, uint32_t foregroundColour, uint32_t backgroundColour, uint32_t dimForegroundColour, uint32_t dimBackgroundColour, uint16_t fontCharsWide, uint16_t fontCharsHigh, int cursorBlinkFrames);
+    ~ConsoleRasterizer();
+
+    // Requires SDL_image to have been initialized for PNG loading
+    bool LoadFont(const char *fontFilename);
+
+    void SetColours(uint32_t foregroundColour, uint32_t backgroundColour);
+
+    // Takes GRAPHICS_PALETTE_SIZE colours and rebuilds the expansion tables from them
+    void SetPalette(const uint32_t *colours);
+
+    int GetCursorBlinkFrames() const { return cursorBlinkFrames; }
+    void SetCursorBlinkFrames(int frames) { cursorBlinkFrames = frames; }
+
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+
+    // pixelPitch is in pixels, not bytes
+    void RasterizeConsole(Console *console, int frame, uint32_t *pixels, int pixelPitch);
+    void RasterizeGraphics(graphics_mode_t mode, const uint8_t *graphicsMemory, uint32_t *pixels, int pixelPitch);
+
+private:
+    // Fills tileFrame with one palette index per emulated pixel
+    void CompositeTiles(int frameWidth, int frameHeight, const uint8_t *graphicsMemory);
+
+    // Fills lineColours with the colours of one emulated line
+    void ExpandLine(graphics_mode_t mode, const uint8_t *graphicsMemory, int line, int pixelsPerLine);
+
+private:
+    bool *fontBuffer;
+    std::vector<uint8_t> tileFrame;
+    std::vector<uint32_t> lineColours;
+
+    // Each possible byte of a 1, 2 or 4bpp line expanded to its 8, 4 or 2 colours,
+    // so a line is converted a whole byte at a time
+    uint32_t palette[GRAPHICS_PALETTE_SIZE];
+    uint32_t expand1[256][8];
+    uint32_t expand2[256][4];
+    uint32_t expand4[256][2];
+
+    int width;
+    int height;
+    uint32_t foregroundColour;
+    uint32_t backgroundColour;
+    uint32_t dimForegroundColour;
+    uint32_t dimBackgroundColour;
+    uint16_t fontBufferWidth;
+    uint16_t fontBufferHeight;
+    uint16_t fontCharsWide;
+    uint16_t fontCharsHigh;
+    uint16_t charPixelsWide;
+    uint16_t charPixelsHigh;
+    int cursorBlinkFrames;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ConsoleRasterizer.h"
+
+class Console;
+class FrameRecorder;
+
+// Base for the renderer backends. Pixel generation lives in the shared
+// rasterizer, the backends only decide where the pixels end up.
+class ConsoleRenderer
+{
+public:
+    ConsoleRenderer(int width, int height, uint32_t foregroundColour, uint32_t backgroundColour, uint32_t dimForegroundColour, uint32_t dimBackgroundColour, uint16_t fontCharsWide, uint16_t fontCharsHigh, int cursorBlinkFrames)
+        : rasterizer(width, height, foregroundColour, backgroundColour, dimForegroundColour, dimBackgroundColour, fontCharsWide, fontCharsHigh, cursorBlinkFrames),
+          recorder(nullptr), isValid(false)
+    {
+    }
+
+    virtual ~ConsoleRenderer() {}
+
+    virtual void Clear() = 0;
+    void SetColours(uint32_t foregroundColour, uint32_t backgroundColour) { rasterizer.SetColours(foregroundColour, backgroundColour); }
+    void SetPalette(const uint32_t *palette) { rasterizer.SetPalette(palette); }
+
+    virtual void Render(Console *console, int frame) = 0;
+    virtual void Render(graphics_mode_t mode, const uint8_t *graphicsMemory) = 0;
+
+    bool IsValid() { return isValid; }
+
+    // Every rendered frame is also handed to the recorder, pass nullptr to stop
+    void SetRecorder(FrameRecorder *frameRecorder) { recorder = frameRecorder; }
+
+    int GetCursorBlinkFrames() const { return rasterizer.GetCursorBlinkFrames(); }
+    void SetCursorBlinkFrames(int frames) { rasterizer.SetCursorBlinkFrames(frames); }
+
+protected:
+    ConsoleRasterizer rasterizer;
+    FrameRecorder *recorder;
+    bool isValid;
+};
@@ -0,0 +1,167 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <functional>
+
+FrameRecorder::FrameRecorder(const char *filename, int width, int height, int framesPerSecond, int poolSize)
+    : file(nullptr), width(width), height(height), framesPerSecond(framesPerSecond),
+      framesWritten(0), droppedFrames(0), valid(false), started(false), stopping(false), finished(false)
+{
+    // 4:2:0 chroma needs even dimensions
+    if ((width & 1) != 0 || (height & 1) != 0)
+    {
+        fprintf(stderr, "Can't record a %dx%d frame, dimensions must be even\n", width, height);
+        finished = true;
+        return;
+    }
+
+    file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Couldn't open %s for recording\n", filename);
+        finished = true;
+        return;
+    }
+
+    fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, framesPerSecond);
+
+    poolSize = std::clamp(poolSize, 1, maxPoolSize);
+    pool.resize(poolSize);
+    for (int i = 0; i < poolSize; i++)
+    {
+        pool[i].pixels.resize((size_t)width * height);
+        freeFrames.push(i);
+    }
+
+    planes.resize((size_t)width * height * 3 / 2);
+    valid = true;
+
+    workerThread.reset(new std::thread(std::bind(&FrameRecorder::WorkerThreadEntry, this)));
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    Stop();
+
+    if (workerThread.get() != nullptr && workerThread->joinable())
+    {
+        workerThread->join();
+    }
+}
+
+void FrameRecorder::Submit(const uint32_t *pixels, int pixelPitch)
+{
+    if (!IsValid() || stopping)
+    {
+        return;
+    }
+
+    int index;
+    if (!freeFrames.pop(index))
+    {
+        droppedFrames++;
+        return;
+    }
+
+    auto &frame = pool[index];
+    frame.time = std::chrono::high_resolution_clock::now();
+    if (!started)
+    {
+        startTime = frame.time;
+        started = true;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        std::copy_n(&pixels[(size_t)y * pixelPitch], width, &frame.pixels[(size_t)y * width]);
+    }
+
+    queuedFrames.push(index);
+}
+
+void FrameRecorder::Stop()
+{
+    stopping = true;
+}
+
+void FrameRecorder::WorkerThreadEntry()
+{
+    while (1)
+    {
+        // Read stopping before draining, so nothing submitted before Stop is lost
+        bool stopRequested = stopping;
+
+        int index;
+        while (queuedFrames.pop(index))
+        {
+            WriteFrame(pool[index]);
+            freeFrames.push(index);
+        }
+
+        if (stopRequested)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+
+    fclose(file);
+    file = nullptr;
+    finished = true;
+}
+
+void FrameRecorder::WriteFrame(const Frame &frame)
+{
+    // The file has a fixed frame rate, but frames arrive whenever the emulator
+    // produces them. Repeat a frame until the file catches up to its timestamp,
+    // and skip it if an earlier one already covered its slot.
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(frame.time - startTime).count();
+    int64_t slot = elapsed * framesPerSecond / 1000000;
+    int64_t repeats = slot + 1 - framesWritten;
+    if (repeats <= 0)
+    {
+        return;
+    }
+
+    // Full range BT.601, which is what C420jpeg means, in 8.8 fixed point
+    uint8_t *yPlane = planes.data();
+    uint8_t *uPlane = yPlane + (size_t)width * height;
+    uint8_t *vPlane = uPlane + (size_t)width * height / 4;
+    auto rgba = reinterpret_cast<const uint8_t*>(frame.pixels.data());
+
+    for (int y = 0; y < height; y++)
+    {
+        auto source = &rgba[(size_t)y * width * 4];
+        auto destination = &yPlane[(size_t)y * width];
+        for (int x = 0; x < width; x++)
+        {
+            int r = source[x * 4], g = source[x * 4 + 1], b = source[x * 4 + 2];
+            destination[x] = (uint8_t)((77 * r + 150 * g + 29 * b + 128) >> 8);
+        }
+    }
+
+    for (int y = 0; y < height; y += 2)
+    {
+        auto top = &rgba[(size_t)y * width * 4];
+        auto bottom = top + (size_t)width * 4;
+        for (int x = 0; x < width; x += 2)
+        {
+            int r = top[x * 4] + top[x * 4 + 4] + bottom[x * 4] + bottom[x * 4 + 4];
+            int g = top[x * 4 + 1] + top[x * 4 + 5] + bottom[x * 4 + 1] + bottom[x * 4 + 5];
+            int b = top[x * 4 + 2] + top[x * 4 + 6] + bottom[x * 4 + 2] + bottom[x * 4 + 6];
+            size_t chroma = (size_t)(y / 2) * (width / 2) + x / 2;
+            // Sums of four pixels, so the extra >> 2 averages them
+            uPlane[chroma] = (uint8_t)std::clamp(128 + ((-43 * r - 85 * g + 128 * b) >> 10), 0, 255);
+            vPlane[chroma] = (uint8_t)std::clamp(128 + ((128 * r - 107 * g - 21 * b) >> 10), 0, 255);
+        }
+    }
+
+    for (int64_t i = 0; i < repeats; i++)
+    {
+        fputs("FRAME\n", file);
+        fwrite(planes.data(), 1, planes.size(), file);
+    }
+
+    framesWritten += repeats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+// Records rendered frames into a raw YUV4MPEG2 (.y4m) file.
+// Submit copies the frame into a buffer taken from a fixed pool and queues
+// it, conversion and writing happen on a worker thread. If the worker falls
+// behind and the pool runs dry, frames are dropped rather than waiting on
+// the disk, so the render loop is never held up by a recording.
+class FrameRecorder
+{
+public:
+    FrameRecorder(const char *filename, int width, int height, int framesPerSecond = 30, int poolSize = 8);
+    ~FrameRecorder();
+
+    bool IsValid() const { return valid; }
+
+    // Must always be called from the same thread. pixelPitch is in pixels, not bytes.
+    void Submit(const uint32_t *pixels, int pixelPitch);
+
+    // Asks the worker to write what's queued and close the file, without waiting for it
+    void Stop();
+    bool IsFinished() const { return finished; }
+
+    int GetDroppedFrames() const { return droppedFrames; }
+
+private:
+    struct Frame
+    {
+        std::vector<uint32_t> pixels;
+        std::chrono::high_resolution_clock::time_point time;
+    };
+
+    void WorkerThreadEntry();
+    void WriteFrame(const Frame &frame);
+
+private:
+    static const int maxPoolSize = 32;
+
+    std::vector<Frame> pool;
+    boost::lockfree::spsc_queue<int, boost::lockfree::capacity<maxPoolSize>> freeFrames;
+    boost::lockfree::spsc_queue<int, boost::lockfree::capacity<maxPoolSize>> queuedFrames;
+    std::unique_ptr<std::thread> workerThread;
+    std::vector<uint8_t> planes;
+    std::chrono::high_resolution_clock::time_point startTime;
+    FILE *file;
+    int width;
+    int height;
+    int framesPerSecond;
+    int64_t framesWritten;
+    int droppedFrames;
+    bool valid;
+    bool started;
+    std::atomic<bool> stopping;
+    std::atomic<bool> finished;
+};
@@ -0,0 +1,40 @@
+# Assembles NAME.asm with OPTIONS and compares the summary with NAME.summary,
+# or what the assembler printed with NAME.errors for a source that shouldn't
+# assemble. Run from the test directory, so errors name files the same way
+# wherever the tree is.
+#   cmake -DASSEMBLER=<path> -DNAME=<test> -DOUTPUT_DIR=<dir> [-DOPTIONS=<a;b>] -P assembler_test.cmake
+
+set(summary_file ${OUTPUT_DIR}/${NAME}.summary)
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+file(REMOVE ${summary_file})
+
+execute_process(
+    COMMAND ${ASSEMBLER} -S ${NAME}.asm ${OPTIONS} -T summary -O ${summary_file}
+    RESULT_VARIABLE result
+    OUTPUT_QUIET
+    ERROR_VARIABLE errors)
+
+# Checkouts on Windows may have turned the expected files' line endings into CRLF
+macro(read_expected path variable)
+    file(READ ${path} ${variable})
+    string(REPLACE "\r\n" "\n" ${variable} "${${variable}}")
+endmacro()
+
+if (EXISTS ${NAME}.errors)
+    read_expected(${NAME}.errors expected)
+    if (result EQUAL 0)
+        message(FATAL_ERROR "${NAME}.asm assembled, but it should have failed with:\n${expected}")
+    elseif (NOT errors STREQUAL expected)
+        message(FATAL_ERROR "${NAME}.asm failed with:\n${errors}\nbut should have failed with:\n${expected}")
+    endif ()
+else ()
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${NAME}.asm didn't assemble:\n${errors}")
+    endif ()
+
+    read_expected(${NAME}.summary expected)
+    file(READ ${summary_file} actual)
+    if (NOT actual STREQUAL expected)
+        message(FATAL_ERROR "The summary of ${NAME}.asm in ${summary_file} isn't the same as ${NAME}.summary")
+    endif ()
+endif ()
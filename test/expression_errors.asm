@@ -0,0 +1,9 @@
+start:
+    rts
+.defword DIVIDED 7 / 0
+.defword OVERFLOWED (-2147483647 - 1) / -1
+.defword TOO_FAR 1 << 32
+.defword BACKWARDS 1 << -1
+.defword TOO_BIG -3 << 31
+.defword NOT_A_WORD 0x10000
+.defbyte UNDEFINED nowhere + 1
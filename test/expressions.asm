@@ -0,0 +1,25 @@
+.struct point
+    x   1
+    y   2
+.endstruct
+
+.defbyte COUNT 3
+.defword TOTAL sizeof(point) * COUNT
+.defbyte MASKED (0x1234 >> 4) & 0xff | 1
+.defword NEGATIVE -(2 + 3) * 4
+.defbyte SHIFTED 1 << 7
+.defword LATER_PLUS finish + 2
+.defbyte CHARACTER 'a' + 1
+.defbyte ESCAPED '\n'
+
+.data table 0x0102
+.reserve buffer COUNT * 2
+
+start:
+    pushi COUNT + 1
+    pushiw table + 2 * 4
+    pushiw TOTAL / (COUNT - 1)
+    pushi ';'               ; A quoted ; isn't a comment
+    jmp finish + 0
+finish:
+    rts
@@ -0,0 +1,150 @@
+; The beq can't reach, so it becomes a beq onto a jmp with a b past it. The b
+; back to start can still reach after that, and stays short.
+start:
+    pushi 0
+    pushi 0
+    cmp
+    beq far_away
+    b start
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+    dup
+    pop
+far_away:
+    rts
@@ -0,0 +1,31 @@
+; Assembled with --optimize
+start:
+    dup                     ; Dropped with the pop
+    pop
+    pushx                   ; Dropped with the pullx
+    pullx
+    pushi 1                 ; Folded into pushi 6, as the cmp sets the
+    pushi 2                 ; condition codes again
+    add
+    pushi 3
+    add
+    cmp
+    pushi 255               ; Kept, bcr tests the add's condition codes
+    pushi 1
+    add
+    bcr wrapped
+    pushiw 1                ; Kept, beq tests the addw's condition codes
+    pushiw 2
+    addw
+    beq start
+    pushi 4                 ; Kept, the label could be branched to and
+    pushi 5                 ; test them
+    add
+wrapped:
+    pushi 1                 ; Kept rather than dropped with the pop
+    pushi 2
+    add
+    pop
+    b next                  ; Dropped, next is the next instruction
+next:
+    rts
@@ -0,0 +1,26 @@
+; Assembled with --strip
+.defbyte USED 3
+.defbyte UNUSED 7
+.defbyte USED_BY_USED USED * 2
+.data used_data 0x01
+.data unused_data 0x09
+
+start:
+    pushi USED_BY_USED
+    jsr helper
+    pushiw used_data
+    pop
+    b done
+dead_code:                  ; Nothing reaches it, and it's the only use of
+    pushi UNUSED            ; UNUSED and unused_routine
+    jsr unused_routine
+done:
+    rts
+helper:
+    dup
+    pop
+runs_into:                  ; Kept, helper runs on into it
+    rts
+unused_routine:
+    pushiw unused_data
+    rts